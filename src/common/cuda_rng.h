@@ -27,8 +27,33 @@ Device interface:
 #include <cmath>
 #include <cstring>
 
+// Build with ZIGGURAT_GAUSSIAN=1 (cmake -DZIGGURAT_GAUSSIAN=ON) to make
+// rng::gaussian() use the Ziggurat instead of the polar method. It's
+// faster, but draws a different sequence of deviates, so the catalogs
+// generated for a given seed change.
+#ifndef ZIGGURAT_GAUSSIAN
+#define ZIGGURAT_GAUSSIAN 0
+#endif
+
 namespace prngs
 {
+	// log(k!), for poisson_ptrs. lgamma() isn't usable there, as glibc's
+	// sets the global signgam, which races when the CPU kernels run on
+	// multiple threads. Exact for k < 10, Stirling's series above (agrees
+	// with lgamma(k + 1) to within double precision roundoff).
+	__device__ inline double logfact(double k)
+	{
+		if(k < 10)
+		{
+			double f = 1.;
+			for(int i = 2; i <= k; i++) { f *= i; }
+			return log(f);
+		}
+		double x = k + 1., x2 = x*x;
+		return (x - 0.5)*log(x) - x + 0.91893853320467274	// log(sqrt(2 pi))
+			+ (1./12. - (1./360. - 1./(1260.*x2)) / x2) / x;
+	}
+
 	template<uint32_t state_dim, bool on_gpu>
 	struct rng_base
 	{
@@ -69,6 +94,11 @@ namespace prngs
 		}
 //		#endif
 
+		// position the generator at the start of the substream identified
+		// by (c0, c1, c2). A no-op for sequential generators, whose streams
+		// are tied to threads (see philox_impl for one where it isn't).
+		__device__ void seek(uint32_t c0, uint32_t c1 = 0, uint32_t c2 = 0) const { }
+
 	public:
 		// upload the state vector to the GPU
 		void upload(const uint32_t *states, const uint32_t nstreams)
@@ -144,6 +174,93 @@ namespace prngs
 
 	};
 
+	//
+	// Tables for the 128-layer Ziggurat of the unit gaussian (see
+	// rng::gaussian_ziggurat). x[i] is the right edge of layer i (with x[0]
+	// the pseudo-width of the base layer, whose area includes the tail),
+	// r[i] = x[i+1]/x[i], and f[i] = exp(-x[i]^2/2). Generated with the
+	// recurrence from Marsaglia & Tsang (2000), for R=3.442619855899 and
+	// V=9.91256303526217e-3.
+	//
+	namespace ziggurat
+	{
+		static const int N = 128;
+		static const float R = 3.442619855899f;
+
+		static __device__ const float x[129] = {
+			3.71308625f, 3.44261986f, 3.22308498f, 3.08322886f, 2.97869625f, 2.89434401f,
+			2.82312535f, 2.76116937f, 2.70611357f, 2.65640641f, 2.61097225f, 2.56903363f,
+			2.53000967f, 2.49345452f, 2.45901818f, 2.42642065f, 2.39543428f, 2.36587137f,
+			2.33757524f, 2.31041368f, 2.28427406f, 2.25905957f, 2.2346864f, 2.21108141f,
+			2.18818043f, 2.16592679f, 2.14427018f, 2.12316571f, 2.10257314f, 2.08245624f,
+			2.06278227f, 2.04352154f, 2.02464697f, 2.00613387f, 1.98795957f, 1.97010326f,
+			1.95254573f, 1.93526923f, 1.9182573f, 1.90149465f, 1.88496704f, 1.86866114f,
+			1.85256451f, 1.83666546f, 1.820953f, 1.80541676f, 1.79004698f, 1.7748344f,
+			1.75977022f, 1.74484613f, 1.73005416f, 1.71538674f, 1.70083662f, 1.68639685f,
+			1.67206075f, 1.65782192f, 1.64367416f, 1.62961148f, 1.6156281f, 1.60171838f,
+			1.58787686f, 1.57409822f, 1.56037722f, 1.54670878f, 1.53308788f, 1.51950958f,
+			1.50596904f, 1.49246142f, 1.47898198f, 1.46552596f, 1.45208864f, 1.43866532f,
+			1.42525125f, 1.41184171f, 1.39843191f, 1.38501704f, 1.3715922f, 1.35815245f,
+			1.34469275f, 1.33120795f, 1.31769278f, 1.30414185f, 1.29054959f, 1.27691027f,
+			1.26321796f, 1.2494665f, 1.23564948f, 1.22176023f, 1.20779175f, 1.19373671f,
+			1.17958738f, 1.16533564f, 1.15097284f, 1.13648985f, 1.12187692f, 1.10712365f,
+			1.09221888f, 1.07715062f, 1.06190596f, 1.0464709f, 1.03083024f, 1.0149674f,
+			0.998864233f, 0.982500804f, 0.965855079f, 0.948902626f, 0.931616197f, 0.913965251f,
+			0.895915353f, 0.877427429f, 0.858456843f, 0.838952214f, 0.818853907f, 0.798092061f,
+			0.776583988f, 0.754230664f, 0.730911911f, 0.706479611f, 0.680747919f, 0.653478639f,
+			0.624358597f, 0.592962942f, 0.558692178f, 0.520656039f, 0.477437837f, 0.426547986f,
+			0.362871431f, 0.272320865f, 0.f,
+		};
+		static __device__ const float r[128] = {
+			0.927158603f, 0.93623029f, 0.956607993f, 0.966096385f, 0.971681488f, 0.975393852f,
+			0.978054117f, 0.980060695f, 0.981631532f, 0.982896381f, 0.983937546f, 0.98480987f,
+			0.985551379f, 0.986189303f, 0.98674368f, 0.987229598f, 0.987658644f, 0.98803987f,
+			0.988380456f, 0.988686172f, 0.988961707f, 0.989210918f, 0.989437003f, 0.989642635f,
+			0.989830072f, 0.990001227f, 0.990157736f, 0.990301005f, 0.990432249f, 0.99055252f,
+			0.990662738f, 0.990763707f, 0.990856133f, 0.990940637f, 0.991017768f, 0.991088015f,
+			0.991151807f, 0.991209529f, 0.991261523f, 0.991308092f, 0.991349507f, 0.99138601f,
+			0.991417815f, 0.991445114f, 0.991468076f, 0.991486851f, 0.991501571f, 0.991512351f,
+			0.991519292f, 0.99152248f, 0.991521988f, 0.991517877f, 0.991510195f, 0.99149898f,
+			0.991484261f, 0.991466053f, 0.991444364f, 0.991419191f, 0.991390522f, 0.991358334f,
+			0.991322596f, 0.991283267f, 0.991240296f, 0.991193622f, 0.991143174f, 0.99108887f,
+			0.991030617f, 0.990968311f, 0.990901837f, 0.990831063f, 0.990755849f, 0.990676037f,
+			0.990591454f, 0.990501911f, 0.990407201f, 0.990307097f, 0.990201353f, 0.990089697f,
+			0.989971834f, 0.989847442f, 0.989716167f, 0.989577623f, 0.989431388f, 0.989276997f,
+			0.989113944f, 0.988941667f, 0.988759553f, 0.988566922f, 0.988363025f, 0.988147032f,
+			0.987918022f, 0.987674972f, 0.98741674f, 0.98714205f, 0.986849471f, 0.986537393f,
+			0.986204f, 0.985847234f, 0.985464755f, 0.985053894f, 0.984611588f, 0.984134306f,
+			0.983617964f, 0.983057801f, 0.982448243f, 0.981782716f, 0.981053415f, 0.980251001f,
+			0.979364207f, 0.978379311f, 0.97727943f, 0.976043561f, 0.974645238f, 0.973050637f,
+			0.971215833f, 0.969082729f, 0.966572854f, 0.963577586f, 0.959942177f, 0.955438419f,
+			0.949715348f, 0.942204206f, 0.931919327f, 0.916992797f, 0.89341052f, 0.850716549f,
+			0.750461021f, 0.f,
+		};
+		static __device__ const float f[129] = {
+			0.00101435256f, 0.00266962908f, 0.00554899522f, 0.00862448441f, 0.0118394787f, 0.015167298f,
+			0.0185921027f, 0.0221033046f, 0.0256932919f, 0.0293563174f, 0.0330878861f, 0.0368843888f,
+			0.0407428681f, 0.0446608622f, 0.0486362959f, 0.0526674019f, 0.0567526635f, 0.0608907703f,
+			0.0650805852f, 0.0693211174f, 0.0736115019f, 0.0779509825f, 0.0823388982f, 0.0867746719f,
+			0.0912578008f, 0.0957878491f, 0.100364441f, 0.104987255f, 0.109656021f, 0.114370512f,
+			0.119130547f, 0.12393598f, 0.128786706f, 0.133682653f, 0.13862378f, 0.14361008f,
+			0.148641574f, 0.153718312f, 0.158840371f, 0.164007855f, 0.169220892f, 0.174479638f,
+			0.179784272f, 0.185134997f, 0.19053204f, 0.195975653f, 0.20146611f, 0.207003709f,
+			0.212588773f, 0.218221647f, 0.223902699f, 0.229632325f, 0.235410942f, 0.241238994f,
+			0.247116948f, 0.253045299f, 0.259024567f, 0.265055302f, 0.271138079f, 0.277273503f,
+			0.283462208f, 0.28970486f, 0.296002157f, 0.302354828f, 0.308763638f, 0.315229388f,
+			0.321752916f, 0.328335098f, 0.334976853f, 0.341679141f, 0.348442968f, 0.355269385f,
+			0.362159495f, 0.369114454f, 0.37613547f, 0.383223811f, 0.390380808f, 0.397607856f,
+			0.404906421f, 0.41227804f, 0.419724332f, 0.427246998f, 0.43484783f, 0.442528715f,
+			0.450291644f, 0.458138716f, 0.466072153f, 0.474094301f, 0.482207646f, 0.490414825f,
+			0.498718635f, 0.507122051f, 0.515628238f, 0.524240573f, 0.532962659f, 0.541798355f,
+			0.550751793f, 0.559827413f, 0.569029991f, 0.578364681f, 0.587837054f, 0.597453151f,
+			0.607219537f, 0.617143371f, 0.627232485f, 0.637495477f, 0.647941821f, 0.658582f,
+			0.669427667f, 0.680491841f, 0.691789143f, 0.703336099f, 0.715151507f, 0.727256918f,
+			0.739677244f, 0.752441559f, 0.765584174f, 0.779146086f, 0.793177012f, 0.807738295f,
+			0.822907211f, 0.838783605f, 0.855500608f, 0.873243049f, 0.892281651f, 0.913043648f,
+			0.936282682f, 0.963599693f, 1.f,
+		};
+	}
+
 	template<typename rng_impl>
 	struct rng : public rng_impl
 	{
@@ -162,7 +279,19 @@ namespace prngs
 			return x;
 		}
 
+		// Gaussian deviate with mean zero and standard deviation sigma.
+		// Uses the Ziggurat method, unless built with ZIGGURAT_GAUSSIAN=0.
 		__device__ float gaussian(const float sigma) const
+		{
+		#if ZIGGURAT_GAUSSIAN
+			return sigma * gaussian_ziggurat();
+		#else
+			return gaussian_polar(sigma);
+		#endif
+		}
+
+		// Marsaglia's polar method
+		__device__ float gaussian_polar(const float sigma) const
 		{
 			float x, y, r2;
 
@@ -181,6 +310,58 @@ namespace prngs
 			return sigma * y * sqrt (-2.0f * logf (r2) / r2);
 		}
 
+		// Unit gaussian deviate, with the Ziggurat method of Marsaglia &
+		// Tsang (2000), as modified by Doornik (2005) to draw the layer
+		// index and the abscissa from independent uniforms. About 99% of
+		// the draws return after two uniforms and a table lookup, with no
+		// transcendental functions.
+		__device__ float gaussian_ziggurat() const
+		{
+			while(true)
+			{
+				float u = 2.f * this->uniform() - 1.f;
+				int i = (int)(this->uniform() * ziggurat::N) & (ziggurat::N-1);
+
+				// the rectangular part of the layer
+				if(fabsf(u) < ziggurat::r[i]) { return u * ziggurat::x[i]; }
+
+				if(i == 0)
+				{
+					// the tail beyond R (Marsaglia 1964)
+					float xt, yt;
+					do
+					{
+						xt = logf(this->uniform_pos()) / ziggurat::R;
+						yt = logf(this->uniform_pos());
+					} while(-2.f * yt < xt * xt);
+					return u < 0 ? xt - ziggurat::R : ziggurat::R - xt;
+				}
+
+				// the wedge
+				float xx = u * ziggurat::x[i];
+				if(ziggurat::f[i+1] + this->uniform() * (ziggurat::f[i] - ziggurat::f[i+1]) < expf(-0.5f * xx * xx)) { return xx; }
+			}
+		}
+
+		// Two independent unit gaussian deviates, from a single polar
+		// Box-Muller draw (gaussian() uses only one of them)
+		__device__ void gaussian2(float &z0, float &z1) const
+		{
+			float x, y, r2;
+
+			do
+			{
+				x = -1.f + 2.f * this->uniform();
+				y = -1.f + 2.f * this->uniform();
+				r2 = x * x + y * y;
+			}
+			while (r2 > 1.0f || r2 == 0.f || r2 == 4.f);
+
+			float f = sqrt (-2.0f * logf (r2) / r2);
+			z0 = x * f;
+			z1 = y * f;
+		}
+
 		// adapted from GNU Scientific Library (GSL)
 		__device__ float gamma_large(const float a) const
 		{
@@ -340,30 +521,53 @@ namespace prngs
 		}
 
 
-		// Adapted from GNU Scientific Library (GSL)
-		__device__ unsigned int poisson(float mu) const
+		// Poisson deviate for mu >= 10, by transformed rejection with
+		// squeeze (PTRS), from:
+		//
+		//	W. Hoermann, "The transformed rejection method for generating
+		//	Poisson random variables", Insurance: Mathematics and
+		//	Economics 12, 39 (1993)
+		//
+		// The expected number of uniforms per deviate is ~2.2, independent
+		// of mu. The final acceptance test is done in double precision, as
+		// log f(k) = k log(mu) - mu - log(k!) loses all significant digits
+		// in single precision for large mu.
+		__device__ unsigned int poisson_ptrs(float mu) const
 		{
-			float emu;
-			float prod = 1.0;
-			unsigned int k = 0;
-#if 1
-			while (mu > 10)
+
+			double smu = sqrt((double)mu), lmu = log((double)mu);
+			double b = 0.931 + 2.53 * smu;
+			double a = -0.059 + 0.02483 * b;
+			double invalpha = 1.1239 + 1.1328 / (b - 3.4);
+			double vr = 0.9277 - 3.6224 / (b - 2);
+
+			while(true)
 			{
-				unsigned int m = mu * (7.0 / 8.0);
-				float X = gamma_int(m);
-		
-				if (X >= mu)
-				{
-					return k + binomial(mu / X, m - 1);
-				}
-				else
+				double U = this->uniform() - 0.5;
+				double V = this->uniform();
+				double us = 0.5 - fabs(U);
+				double k = floor((2 * a / us + b) * U + mu + 0.43);
+
+				// squeeze (accepts ~86% of draws)
+				if(us >= 0.07 && V <= vr) { return (unsigned int)k; }
+
+				if(k < 0 || (us < 0.013 && V > us)) { continue; }
+				if(log(V) + log(invalpha) - log(a / (us * us) + b) <= -mu + k * lmu - logfact(k))
 				{
-					k += m;
-					mu -= X; 
+					return (unsigned int)k;
 				}
 			}
-#endif
-			/* This following method works well when mu is small */
+		}
+
+		__device__ unsigned int poisson(float mu) const
+		{
+			if(mu >= 10) { return poisson_ptrs(mu); }
+
+			/* This following method works well when mu is small (adapted from GSL) */
+			float emu;
+			float prod = 1.0;
+			unsigned int k = 0;
+
 			emu = expf(-mu);
 			do
 			{
@@ -411,9 +615,49 @@ namespace prngs
 		static const char *name() { return "ran0"; }
 	};
 
+#if !__CUDACC__
+	//
+	// Host state of the active mwc_impl stream. CPU kernels run their
+	// emulated threads one after another, so a pool thread only ever needs
+	// the state of one stream at a time. Keeping it here, instead of in
+	// emulated shared memory indexed by threadIdx and blockDim, lets the
+	// compiler address it directly. The carry and x are packed into one
+	// 64-bit word, which is exactly a*x + c of the previous step.
+	//
+	// Each pool thread has its own instance (mwc_host, in cux.cpp).
+	//
+	struct mwc_host_state
+	{
+		uint64_t cx;	// (carry << 32) | x
+		uint32_t a;	// multiplier
+	};
+	extern __TLS mwc_host_state mwc_host;
+#endif
+
 	template<bool on_gpu>
 	struct mwc_impl : public rng_base<3, on_gpu>
 	{
+#if !__CUDACC__
+		// Marsaglia's Multiply-With-Carry RNG, on the host (see mwc_host_state)
+		__device__ void load(uint32_t tid) const
+		{
+			mwc_host.a  = this->gstate[tid];
+			mwc_host.cx = (uint64_t)this->gstate[this->nstreams + tid] << 32 | this->gstate[2*this->nstreams + tid];
+		}
+
+		__device__ void store(uint32_t tid) const
+		{
+			this->gstate[this->nstreams + tid]   = mwc_host.cx >> 32;
+			this->gstate[2*this->nstreams + tid] = (uint32_t)mwc_host.cx;
+		}
+
+		__device__ float uniform() const
+		{
+			uint64_t cx = mwc_host.cx;
+			mwc_host.cx = cx = (uint64_t)mwc_host.a * (uint32_t)cx + (cx >> 32);
+			return 2.32830643708e-10f * (uint32_t)cx;
+		}
+#else
 //		#ifdef __CUDACC__
 #if 0	// if this is on, the integrator state is stored in registers
 		uint32_t a, c, xn;
@@ -462,6 +706,7 @@ namespace prngs
 			#undef xn
 		}
 //		#endif
+#endif
 
 		void srand(uint32_t seed, uint32_t nstreams=0, const char *safeprimes_file = NULL)
 		{
@@ -624,12 +869,99 @@ namespace prngs
 		static const char *name() { return "rand48"; }
 	};
 	
+	//
+	// Philox4x32-10 counter-based generator, from:
+	//
+	//	Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3", SC11
+	//
+	// Each output block is a pure function of the key (set by srand()) and
+	// a 128-bit counter. The first three counter words select a substream
+	// (set with seek()), the fourth counts the blocks drawn from it. Work
+	// that seeks to a substream derived from its own coordinates (e.g., a
+	// row index) draws the same numbers no matter which thread executes it,
+	// or how many threads there are.
+	//
+	// Per-thread state (in shared memory): substream (3 words), number of
+	// numbers drawn (1 word), and the last generated block (4 words).
+	// Nothing needs to persist between kernel launches, so there's no
+	// global state to upload or download.
+	//
+	template<bool on_gpu>
+	struct philox_impl : public rng_base<8, on_gpu>
+	{
+		static const uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;	// multipliers
+		static const uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;	// Weyl sequence key increments
+
+		uint32_t key[2];
+
+		__device__ uint32_t &st(int i) const { return shmem(uint32_t)[i*blockDim.x + threadIdx.x]; }
+
+		__device__ static void philox_round(uint32_t c[4], const uint32_t k[2])
+		{
+			uint64_t p0 = (uint64_t)M0 * c[0];
+			uint64_t p1 = (uint64_t)M1 * c[2];
+			uint32_t hi0 = p0 >> 32, lo0 = (uint32_t)p0;
+			uint32_t hi1 = p1 >> 32, lo1 = (uint32_t)p1;
+
+			c[0] = hi1 ^ c[1] ^ k[0];
+			c[1] = lo1;
+			c[2] = hi0 ^ c[3] ^ k[1];
+			c[3] = lo0;
+		}
+
+		// the Philox4x32-10 bijection of counter c, with the given key
+		__device__ static void block(uint32_t c[4], uint32_t k0, uint32_t k1)
+		{
+			uint32_t k[2] = { k0, k1 };
+			for(int r = 0; r != 10; r++)
+			{
+				if(r) { k[0] += W0; k[1] += W1; }
+				philox_round(c, k);
+			}
+		}
+
+		__device__ void seek(uint32_t c0, uint32_t c1 = 0, uint32_t c2 = 0) const
+		{
+			st(0) = c0; st(1) = c1; st(2) = c2;
+			st(3) = 0;
+		}
+
+		// Kernels that don't seek() draw from a per-thread substream
+		// (and are thus not decomposition-independent).
+		__device__ void load(uint32_t tid) const { seek(tid, 0xFFFFFFFF, 0xFFFFFFFF); }
+		__device__ void store(uint32_t tid) const { }
+
+		__device__ float uniform() const
+		{
+			uint32_t n = st(3);
+			if((n & 3) == 0)
+			{
+				uint32_t c[4] = { st(0), st(1), st(2), n >> 2 };
+				block(c, key[0], key[1]);
+				st(4) = c[0]; st(5) = c[1]; st(6) = c[2]; st(7) = c[3];
+			}
+			st(3) = n + 1;
+
+			// use the upper 24 bits, so that the result is in [0, 1)
+			return (st(4 + (n & 3)) >> 8) * (1.f / 16777216.f);
+		}
+
+		void srand(uint32_t seed0, uint32_t seed1 = 0)
+		{
+			key[0] = seed0;
+			key[1] = seed1;
+		}
+
+		static const char *name() { return "philox"; }
+	};
+
 	namespace gpu
 	{
 		typedef rng<ran0_impl<true> >   ran0;
 		typedef rng<mwc_impl<true> >    mwc;
 		typedef rng<taus2_impl<true> >  taus2;
 		typedef rng<rand48_impl<true> > rand48;
+		typedef rng<philox_impl<true> > philox;
 	}
 	
 	namespace cpu
@@ -638,6 +970,7 @@ namespace prngs
 		typedef rng<mwc_impl<false> >    mwc;
 		typedef rng<taus2_impl<false> >  taus2;
 		typedef rng<rand48_impl<false> > rand48;
+		typedef rng<philox_impl<false> > philox;
 	}
 }
 
@@ -31,6 +31,8 @@
 #include <astro/useall.h>
 
 #include <vector>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 #include "gpu.h"
 #include "io.h"
 #include "analysis.h"
@@ -55,6 +57,15 @@ size_t arrayMemSize_impl(size_t nx, size_t ny, size_t nz, size_t align, size_t e
 	return size;
 }
 
+// Guards all_cuxSmartPtrs(), as pointers may be created and destroyed on
+// several host threads (e.g., by skygen and the pipeline, see skygenBatchQueue).
+// Never deallocated, as pointers may outlive static objects.
+static boost::mutex &all_cuxSmartPtrs_mx()
+{
+	static boost::mutex *mx = new boost::mutex();
+	return *mx;
+}
+
 cuxSmartPtr_impl_t::cuxSmartPtr_impl_t(size_t es, size_t pitch, size_t width, size_t height, size_t depth)
 {
 	ASSERT(pitch >= width*es);
@@ -70,7 +81,10 @@ cuxSmartPtr_impl_t::cuxSmartPtr_impl_t(size_t es, size_t pitch, size_t width, si
 
 	// reference counting and garbage collection
 	refcnt = 1;
-	all_cuxSmartPtrs().insert(this);
+	{
+		boost::mutex::scoped_lock lock(all_cuxSmartPtrs_mx());
+		all_cuxSmartPtrs().insert(this);
+	}
 
 	// NOTE: storage is lazily allocated the first time this pointer
 	// is accessed through syncTo* methods
@@ -98,6 +112,7 @@ cuxSmartPtr_impl_t::~cuxSmartPtr_impl_t()
 		cuxErrCheck( cudaFree(m_data.ptr) );
 	}
 
+	boost::mutex::scoped_lock lock(all_cuxSmartPtrs_mx());
 	all_cuxSmartPtrs().erase(this);
 }
 
@@ -129,6 +144,7 @@ cuxSmartPtr_impl_t::allocated_pointers &cuxSmartPtr_impl_t::all_cuxSmartPtrs()
 
 void cuxSmartPtr_impl_t::global_gc()
 {
+	boost::mutex::scoped_lock lock(all_cuxSmartPtrs_mx());
 	FOREACH(all_cuxSmartPtrs())
 	{
 		(*i)->gc();
@@ -403,6 +419,14 @@ gpu_rng_t::persistent_rng gpu_rng_t::gpuRNG;
 
 gpu_prng_impl &gpu_rng_t::persistent_rng::get(rng_t &seeder)
 {
+#if COUNTER_RNG
+	// a fresh 48-bit key for every user
+	uint32_t k0 = (uint32_t)(seeder.uniform()*(1<<24));
+	uint32_t k1 = (uint32_t)(seeder.uniform()*(1<<24));
+	gpuRNG = gpu_prng_impl::create();
+	gpuRNG.srand(k0, k1);
+	return gpuRNG;
+#else
 	if(state == EMPTY)
 	{
 		// initialize CPU and GPU RNGs
@@ -432,6 +456,46 @@ gpu_prng_impl &gpu_rng_t::persistent_rng::get(rng_t &seeder)
 		state = CPU;
 	}
 	return (gpu_prng_impl&)cpuRNG;
+#endif
+}
+
+gpu_rng_t gpu_rng_t::create_private(rng_t &seeder)
+{
+	gpu_rng_t rng;
+#if COUNTER_RNG
+	// instances never share state anyway
+	(gpu_prng_impl&)rng = gpuRNG.get(seeder);
+#else
+	uint32_t seed = (uint32_t)(seeder.uniform()*(1<<24));
+	std::string file = datadir() + "/safeprimes32.txt";
+
+	cpu_prng_impl cpuRNG = cpu_prng_impl::create();
+	cpuRNG.srand(seed, 1<<16, file.c_str());
+
+	if(gpuGetActiveDevice() >= 0)
+	{
+		(gpu_prng_impl&)rng = gpu_prng_impl::create();
+		rng.upload(cpuRNG.gstate, cpuRNG.nstreams);
+		cpuRNG.free();
+	}
+	else
+	{
+		(gpu_prng_impl&)rng = (gpu_prng_impl&)cpuRNG;
+	}
+#endif
+	return rng;
+}
+
+void gpu_rng_t::free_private(gpu_rng_t &rng)
+{
+#if !COUNTER_RNG
+	if(gpuGetActiveDevice() < 0)
+	{
+		((cpu_prng_impl&)(gpu_prng_impl&)rng).free();
+		return;
+	}
+#endif
+	rng.free();
 }
 
 // CUDA emulation for the CPU
@@ -445,8 +509,136 @@ namespace gpuemu	// prevent collision with nvcc's symbols
 	__TLS uint3 gridDim;		// Note: uint3 instead of dim3, because __TLS variables have to be PODs
 }
 
+// State of the MWC stream used by this thread (see cuda_rng.h)
+__TLS prngs::mwc_host_state prngs::mwc_host;
+
 __TLS int  active_compute_device;
 
+//
+// Pool of threads executing CPU versions of kernels (see the KERNEL
+// macro in gpu.h). The launching thread takes part in the work, so a
+// pool of N threads starts N-1 workers.
+//
+class cpu_thread_pool
+{
+protected:
+	boost::mutex launch_mx;			// serializes launches from different host threads
+	boost::mutex mx;			// guards all the fields below
+	boost::condition_variable work_cv;	// signaled when a new launch begins (or the pool is stopping)
+	boost::condition_variable done_cv;	// signaled when the last slice of a launch completes
+	boost::thread_group workers;
+
+	const cpu_kernel_pool::slice_t *slice;	// the launch being executed
+	uint32_t n, chunk, next;		// number of items, items per slice, and first unassigned item
+	uint32_t pending;			// number of slices not yet completed
+	uint64_t launch;			// serial number of the current launch
+	bool stopping;
+
+	// Execute slices of the current launch until there are none left.
+	// Must be called with mx locked.
+	void drain(boost::mutex::scoped_lock &lock)
+	{
+		while(next < n)
+		{
+			uint32_t begin = next;
+			uint32_t end = std::min(n, begin + chunk);
+			next = end;
+
+			lock.unlock();
+			(*slice)(begin, end);
+			lock.lock();
+
+			if(--pending == 0) { done_cv.notify_all(); }
+		}
+	}
+
+	void worker()
+	{
+		active_compute_device = -1;
+
+		uint64_t seen = 0;
+		boost::mutex::scoped_lock lock(mx);
+		while(true)
+		{
+			while(!stopping && launch == seen) { work_cv.wait(lock); }
+			if(stopping) { return; }
+
+			seen = launch;
+			drain(lock);
+		}
+	}
+
+public:
+	int nthreads;
+
+	cpu_thread_pool()
+		: slice(NULL), n(0), chunk(1), next(0), pending(0), launch(0), stopping(false)
+	{
+		// HACK: Env. variable override of the number of threads, until we make this configurable
+		const char *thrStr = getenv("CPU_THREADS");
+		nthreads = thrStr ? atoi(thrStr) : boost::thread::hardware_concurrency();
+		if(nthreads < 1) { nthreads = 1; }
+
+		FOR(1, nthreads)
+		{
+			workers.create_thread(boost::bind(&cpu_thread_pool::worker, this));
+		}
+		DLOG(verb1) << "Executing CPU kernels on " << nthreads << " thread(s).";
+	}
+
+	~cpu_thread_pool()
+	{
+		{
+			boost::mutex::scoped_lock lock(mx);
+			stopping = true;
+			work_cv.notify_all();
+		}
+		workers.join_all();
+	}
+
+	void run(uint32_t nitems, const cpu_kernel_pool::slice_t &s)
+	{
+		if(nitems == 0) { return; }
+		if(nthreads == 1 || nitems == 1)
+		{
+			s(0, nitems);
+			return;
+		}
+
+		boost::mutex::scoped_lock launching(launch_mx);
+		boost::mutex::scoped_lock lock(mx);
+
+		// a few slices per thread, to even out the load
+		slice = &s;
+		n = nitems;
+		next = 0;
+		chunk = std::max(1U, n / (4*nthreads));
+		pending = (n + chunk - 1) / chunk;
+		launch++;
+		work_cv.notify_all();
+
+		drain(lock);
+		while(pending) { done_cv.wait(lock); }
+		slice = NULL;
+	}
+};
+
+static cpu_thread_pool &cpu_pool()
+{
+	static cpu_thread_pool pool;
+	return pool;
+}
+
+int cpu_kernel_pool::nthreads()
+{
+	return cpu_pool().nthreads;
+}
+
+void cpu_kernel_pool::run(uint32_t n, const slice_t &slice)
+{
+	cpu_pool().run(n, slice);
+}
+
 #if 0
 #if HAVE_CUDA || !ALIAS_GPU_RNG
 struct rng_mwc
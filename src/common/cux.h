@@ -26,8 +26,16 @@
 #include <map>
 #include <set>
 #include <algorithm>
+#include <cmath>
 #include <stdint.h>
 
+#if !__CUDACC__ && __SSE2__
+	#include <emmintrin.h>
+	#define CUX_SSE 1
+#else
+	#define CUX_SSE 0
+#endif
+
 #include <astro/assert.h>
 
 #include "cux_lowlevel.h"
@@ -720,6 +728,239 @@ template<int dim>
 		__device__ __host__       float2 &operator[](int i)       { return tc[i]; }
 	};
 
+/**
+	cuxTexSampler<T,dim> -- host emulation of texture fetches
+
+	Emulates CUDA texture fetches from unnormalized texture coordinates
+	with clamp addressing, in point or linear filtering mode. As on the
+	GPU, texel i is centered at coordinate i+0.5. Linear filtering
+	interpolates between the 2 (1D), 4 (2D) or 8 (3D) nearest texels.
+	T must be a float or a struct of floats (float2, float4, ...).
+
+	Note: the GPU stores the interpolation weights as 8-bit fractions, so
+	the two agree only to about 1/256th of the difference between
+	neighboring texels.
+
+	The batch sample() methods take real-space coordinates and apply the
+	texture coordinates first. With SSE2 they compute texel indices and
+	weights for four samples at a time. They use the same sequence of
+	float operations as the scalar path, so both give bit-identical
+	results.
+*/
+template<typename T, int dim>
+	struct cuxTexSampler
+	{
+		const char *data;	// texture data (host memory)
+		uint32_t pitch, slice;	// bytes per row and bytes per 2D slice
+		float nmax[3];		// index of the last texel in each dimension
+		afloat2 tc[dim];	// texture coordinates
+		bool linear;		// true for linear, false for point filtering
+
+		cuxTexSampler() : data(NULL), linear(false) {}
+		cuxTexSampler(cuxTexture<T, dim> &tex, bool linear_) { set(tex, linear_); }
+
+		void set(cuxTexture<T, dim> &tex, bool linear_)
+		{
+			hptr<T, 3> h = tex;
+			data  = (const char *)h.ptr;
+			pitch = h.extent[0];
+			slice = h.extent[0] * h.extent[1];
+			for(int d = 0; d != 3; d++) { nmax[d] = d < dim ? tex.extent(d) - 1 : 0; }
+			for(int d = 0; d != dim; d++) { tc[d] = tex.coords[d]; }
+			linear = linear_;
+		}
+
+		const T &texel(int i, int j = 0, int k = 0) const
+		{
+			return *((const T *)(data + j*pitch + k*slice) + i);
+		}
+
+		static T lerp(const T &a, const T &b, float t)
+		{
+			T r;
+			const float *pa = (const float *)&a, *pb = (const float *)&b;
+			float *pr = (float *)&r;
+			for(int c = 0; c != sizeof(T)/sizeof(float); c++)
+			{
+				pr[c] = (1.f - t) * pa[c] + t * pb[c];
+			}
+			return r;
+		}
+
+		// texel index for point sampling at texture-space coordinate x
+		int pointIdx(float x, int d) const
+		{
+			if(!(x >= 0.f)) { x = 0.f; }
+			if(x > nmax[d]) { x = nmax[d]; }
+			return (int)x;
+		}
+
+		// the two texels bracketing texture-space coordinate x along dimension d,
+		// and the weight of the second one. The initial clamping of x keeps the
+		// index in int range, and does not change the result.
+		void linearIdx(float x, int d, int &i0, int &i1, float &a) const
+		{
+			x -= 0.5f;
+			if(!(x >= -1.f)) { x = -1.f; }
+			if(x > nmax[d] + 1.f) { x = nmax[d] + 1.f; }
+
+			float f0 = floorf(x);
+			a = x - f0;
+
+			float f1 = f0 + 1.f;
+			f0 = f0 < 0.f ? 0.f : f0;  f0 = f0 > nmax[d] ? nmax[d] : f0;
+			f1 = f1 < 0.f ? 0.f : f1;  f1 = f1 > nmax[d] ? nmax[d] : f1;
+			i0 = (int)f0; i1 = (int)f1;
+		}
+
+		// sample at texture-space coordinates
+		T fetch(float x) const
+		{
+			if(!linear) { return texel(pointIdx(x, 0)); }
+
+			int i0, i1; float a;
+			linearIdx(x, 0, i0, i1, a);
+			return lerp(texel(i0), texel(i1), a);
+		}
+		T fetch(float x, float y) const
+		{
+			if(!linear) { return texel(pointIdx(x, 0), pointIdx(y, 1)); }
+
+			int i0, i1, j0, j1; float a, b;
+			linearIdx(x, 0, i0, i1, a);
+			linearIdx(y, 1, j0, j1, b);
+			return lerp(	lerp(texel(i0, j0), texel(i1, j0), a),
+					lerp(texel(i0, j1), texel(i1, j1), a), b);
+		}
+		T fetch(float x, float y, float z) const
+		{
+			if(!linear) { return texel(pointIdx(x, 0), pointIdx(y, 1), pointIdx(z, 2)); }
+
+			int i0, i1, j0, j1, k0, k1; float a, b, c;
+			linearIdx(x, 0, i0, i1, a);
+			linearIdx(y, 1, j0, j1, b);
+			linearIdx(z, 2, k0, k1, c);
+			return lerp(
+				lerp(	lerp(texel(i0, j0, k0), texel(i1, j0, k0), a),
+					lerp(texel(i0, j1, k0), texel(i1, j1, k0), a), b),
+				lerp(	lerp(texel(i0, j0, k1), texel(i1, j0, k1), a),
+					lerp(texel(i0, j1, k1), texel(i1, j1, k1), a), b), c);
+		}
+
+		// real-space to texture-space coordinates (see sample_impl)
+		float texcoord(float x, int d) const { return (x - tc[d].x) * tc[d].y + 0.5f; }
+
+		// Compute linearIdx() for n <= 4 real-space coordinates
+		void linearIdx4(const float *x, int d, int n, int *i0, int *i1, float *a) const
+		{
+#if CUX_SSE
+			if(n == 4)
+			{
+				__m128 v = _mm_loadu_ps(x);
+				v = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(v, _mm_set1_ps(tc[d].x)), _mm_set1_ps(tc[d].y)), _mm_set1_ps(0.5f));
+				v = _mm_sub_ps(v, _mm_set1_ps(0.5f));
+				v = _mm_max_ps(v, _mm_set1_ps(-1.f));	// NaN -> -1, as in linearIdx()
+				v = _mm_min_ps(v, _mm_set1_ps(nmax[d] + 1.f));
+
+				__m128 f0 = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));		// floor()
+				f0 = _mm_sub_ps(f0, _mm_and_ps(_mm_cmpgt_ps(f0, v), _mm_set1_ps(1.f)));
+				_mm_storeu_ps(a, _mm_sub_ps(v, f0));
+
+				__m128 f1 = _mm_add_ps(f0, _mm_set1_ps(1.f));
+				__m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(nmax[d]);
+				f0 = _mm_min_ps(_mm_max_ps(f0, lo), hi);
+				f1 = _mm_min_ps(_mm_max_ps(f1, lo), hi);
+				_mm_storeu_si128((__m128i *)i0, _mm_cvttps_epi32(f0));
+				_mm_storeu_si128((__m128i *)i1, _mm_cvttps_epi32(f1));
+				return;
+			}
+#endif
+			for(int s = 0; s != n; s++)
+			{
+				linearIdx(texcoord(x[s], d), d, i0[s], i1[s], a[s]);
+			}
+		}
+
+		// sample n points at real-space coordinates
+		void sample(T *out, const float *x, int n) const
+		{
+			int i0[4], i1[4]; float a[4];
+			for(int s0 = 0; s0 < n; s0 += 4)
+			{
+				int m = std::min(4, n - s0);
+				if(!linear)
+				{
+					for(int s = 0; s != m; s++) { out[s0+s] = fetch(texcoord(x[s0+s], 0)); }
+					continue;
+				}
+
+				linearIdx4(x + s0, 0, m, i0, i1, a);
+				for(int s = 0; s != m; s++)
+				{
+					out[s0+s] = lerp(texel(i0[s]), texel(i1[s]), a[s]);
+				}
+			}
+		}
+		void sample(T *out, const float *x, const float *y, int n) const
+		{
+			int i0[4], i1[4], j0[4], j1[4]; float a[4], b[4];
+			for(int s0 = 0; s0 < n; s0 += 4)
+			{
+				int m = std::min(4, n - s0);
+				if(!linear)
+				{
+					for(int s = 0; s != m; s++) { out[s0+s] = fetch(texcoord(x[s0+s], 0), texcoord(y[s0+s], 1)); }
+					continue;
+				}
+
+				linearIdx4(x + s0, 0, m, i0, i1, a);
+				linearIdx4(y + s0, 1, m, j0, j1, b);
+				for(int s = 0; s != m; s++)
+				{
+					out[s0+s] = lerp(	lerp(texel(i0[s], j0[s]), texel(i1[s], j0[s]), a[s]),
+								lerp(texel(i0[s], j1[s]), texel(i1[s], j1[s]), a[s]), b[s]);
+				}
+			}
+		}
+		void sample(T *out, const float *x, const float *y, const float *z, int n) const
+		{
+			int i0[4], i1[4], j0[4], j1[4], k0[4], k1[4]; float a[4], b[4], c[4];
+			for(int s0 = 0; s0 < n; s0 += 4)
+			{
+				int m = std::min(4, n - s0);
+				if(!linear)
+				{
+					for(int s = 0; s != m; s++) { out[s0+s] = fetch(texcoord(x[s0+s], 0), texcoord(y[s0+s], 1), texcoord(z[s0+s], 2)); }
+					continue;
+				}
+
+				linearIdx4(x + s0, 0, m, i0, i1, a);
+				linearIdx4(y + s0, 1, m, j0, j1, b);
+				linearIdx4(z + s0, 2, m, k0, k1, c);
+				for(int s = 0; s != m; s++)
+				{
+					out[s0+s] = lerp(
+						lerp(	lerp(texel(i0[s], j0[s], k0[s]), texel(i1[s], j0[s], k0[s]), a[s]),
+							lerp(texel(i0[s], j1[s], k0[s]), texel(i1[s], j1[s], k0[s]), a[s]), b[s]),
+						lerp(	lerp(texel(i0[s], j0[s], k1[s]), texel(i1[s], j0[s], k1[s]), a[s]),
+							lerp(texel(i0[s], j1[s], k1[s]), texel(i1[s], j1[s], k1[s]), a[s]), b[s]), c[s]);
+				}
+			}
+		}
+	};
+
+#if CUX_SSE
+	// SSE interpolation of four-component texels (the common float4 case)
+	template<>
+		inline float4 cuxTexSampler<float4, 2>::lerp(const float4 &a, const float4 &b, float t)
+		{
+			float4 r;
+			__m128 v = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(1.f - t), _mm_loadu_ps(&a.x)), _mm_mul_ps(_mm_set1_ps(t), _mm_loadu_ps(&b.x)));
+			_mm_storeu_ps(&r.x, v);
+			return r;
+		}
+#endif
+
 /**
 	cuxTextureReference<T,dim,readmode> -- host texture reference interface
 
@@ -741,6 +982,7 @@ template<typename T, int dim, enum cudaTextureReadMode mode>
 		textureReference &texref;	// the CUDA texture reference to which the current texture will be bound
 		const char *tcSymbolName;	// the symbol name of the __constant__ variable that holds the texture
 						// coordinates on device
+		cuxTexSampler<T, dim> sampler;	// host emulation of the texture unit (set up on bind())
 	public:
 		cuxTextureReference(textureReference &texref_, const char *tcSymbolName)
 			: texref(texref_), tcSymbolName(tcSymbolName)
@@ -760,6 +1002,9 @@ template<typename T, int dim, enum cudaTextureReadMode mode>
 
 			cuxUploadConst(tcSymbolName, tex.coords);
 			tex.bind_texture(texref);
+
+			// bind_texture() has synced the data to the host, so it's safe to keep the pointer
+			sampler.set(tex, texref.filterMode == cudaFilterModeLinear);
 		}
 
 		void bind(const cuxTexture<T, dim> &tex)
@@ -773,41 +1018,13 @@ template<typename T, int dim, enum cudaTextureReadMode mode>
 
 			tex.unbind_texture(texref);
 			tex.reset();
+			sampler = cuxTexSampler<T, dim>();
 		}
 
-		float clamp(float i, int d) const
-		{
-			if(i < 0.f) { i = 0.f; }
-			else if(i >= tex.extent(d)) { i = tex.extent(d)-1; }
-
-			return i;
-		}
-
-		T tex1D(float x) const		// sample a 1D texture
-		{
-			// FIXME: implement interpolation, clamp modes, normalized coordinates
-			uint32_t i = (uint32_t)clamp(x, 0);
-
-			return tex(i);
-		}
-
-		T tex2D(float x, float y) const		// sample from 3D texture
-		{
-			// FIXME: implement interpolation, clamp modes, normalized coordinates
-			uint32_t i = (uint32_t)clamp(x, 0);
-			uint32_t j = (uint32_t)clamp(y, 1);
-
-			return tex(i, j);
-		}
-		T tex3D(float x, float y, float z) const		// sample from 3D texture
-		{
-			// FIXME: implement interpolation, clamp modes, normalized coordinates
-			uint32_t i = (uint32_t)clamp(x, 0);
-			uint32_t j = (uint32_t)clamp(y, 1);
-			uint32_t k = (uint32_t)clamp(z, 2);
-
-			return tex(i, j, k);
-		}
+		// host sampling, at texture-space coordinates
+		T tex1D(float x) const			{ return sampler.fetch(x); }
+		T tex2D(float x, float y) const		{ return sampler.fetch(x, y); }
+		T tex3D(float x, float y, float z) const	{ return sampler.fetch(x, y, z); }
 };
 
 /**
@@ -52,8 +52,8 @@
 #endif
 
 // Thread local storage -- use for shared memory emulation in CPU mode
-//#define __TLS __thread
-#define __TLS
+// (CPU kernels are executed by a pool of threads; see cpu_kernel_pool in gpu.h)
+#define __TLS __thread
 
 //////////////////////////////////////////////////////////////////////////
 // Shared memory access and CPU emulation
@@ -262,10 +262,104 @@ typedef kernel_state otable_ks;
 		__global__ void gpu_##kDecl
 #endif
 
+//
+// Pool of host threads executing the CPU versions of kernels. The
+// pool is started on first use and lives until the program exits. By
+// default it has as many threads as there are cores; set the
+// CPU_THREADS environment variable to override (CPU_THREADS=1 runs
+// everything serially on the calling thread).
+//
+#if !__CUDACC__
+	#include <boost/function.hpp>
+
+	namespace cpu_kernel_pool
+	{
+		typedef boost::function<void (uint32_t begin, uint32_t end)> slice_t;
+
+		// Number of threads (including the caller) kernels are executed on
+		int nthreads();
+
+		// Split [0, n) into contiguous slices, and call slice(begin, end)
+		// for each one on the pool threads. Returns after all slices
+		// have been processed.
+		void run(uint32_t n, const slice_t &slice);
+	}
+#endif
+
 //
 // No CUDA, or building the CPU version of the kernel.
 //
 #if !HAVE_CUDA || BUILD_FOR_CPU
+	#include <boost/preprocessor/repetition.hpp>
+	#include <boost/preprocessor/cat.hpp>
+
+	//
+	// cpu_kernel_callN<F, A0, ..., AN-1> -- a CPU kernel bound to its
+	// arguments, so that it can be handed over to the pool threads. Use
+	// bind_cpu_kernel(f, a0, ...) to construct one.
+	//
+	#define CPU_KERNEL_MAX_ARGS 16
+	#define CPU_KERNEL_CALL_MEMBER(z, n, unused) A##n a##n;
+	#define CPU_KERNEL_CALL(z, n, unused) \
+		template<typename F BOOST_PP_ENUM_TRAILING_PARAMS(n, typename A)> \
+		struct BOOST_PP_CAT(cpu_kernel_call, n) \
+		{ \
+			F f; \
+			BOOST_PP_REPEAT(n, CPU_KERNEL_CALL_MEMBER, ~) \
+			void operator()() const { f(BOOST_PP_ENUM_PARAMS(n, a)); } \
+		}; \
+		template<typename F BOOST_PP_ENUM_TRAILING_PARAMS(n, typename A)> \
+		inline BOOST_PP_CAT(cpu_kernel_call, n)<F BOOST_PP_ENUM_TRAILING_PARAMS(n, A)> \
+			bind_cpu_kernel(F f BOOST_PP_ENUM_TRAILING_BINARY_PARAMS(n, const A, &a)) \
+		{ \
+			BOOST_PP_CAT(cpu_kernel_call, n)<F BOOST_PP_ENUM_TRAILING_PARAMS(n, A)> k = { f BOOST_PP_ENUM_TRAILING_PARAMS(n, a) }; \
+			return k; \
+		}
+	BOOST_PP_REPEAT(CPU_KERNEL_MAX_ARGS, CPU_KERNEL_CALL, ~)
+	#undef CPU_KERNEL_CALL
+	#undef CPU_KERNEL_CALL_MEMBER
+
+	//
+	// Runs emulated GPU threads [begin, end) of a bound kernel on the
+	// calling host thread. The emulated CUDA built-ins (threadIdx, blockIdx,
+	// etc.) and shared memory are thread-local, so each pool thread keeps
+	// its own copy. Blocks must be one-dimensional (blockDim.y == blockDim.z == 1).
+	//
+	template<typename K>
+	struct cpu_kernel_slice
+	{
+		K kernel;
+		uint3 grid, block;
+
+		void operator()(uint32_t begin, uint32_t end) const
+		{
+			ASSERT(block.y == 1 && block.z == 1);
+
+			gridDim = grid;
+			blockDim = block;
+			threadIdx.y = threadIdx.z = 0;
+			for(uint32_t i = begin; i != end; i++)
+			{
+				// inverse of threadID()
+				uint32_t b = i / block.x;
+				threadIdx.x = i % block.x;
+				blockIdx.x = b % grid.x; b /= grid.x;
+				blockIdx.y = b % grid.y;
+				blockIdx.z = b / grid.y;
+
+				kernel();
+			}
+		}
+	};
+
+	template<typename K>
+	void cpu_kernel_launch(const K &kernel, uint32_t nthreads, const dim3 &gridDim, uint32_t threadsPerBlock)
+	{
+		cpu_kernel_slice<K> s = { kernel, { gridDim.x, gridDim.y, gridDim.z }, { threadsPerBlock, 1, 1 } };
+		cpu_kernel_pool::run(nthreads, s);
+	}
+
+	#define CPU_KERNEL_ARGS(...) __VA_ARGS__
 	#define KERNEL(ks, shmemPerThread, kDecl, kName, kArgs) \
 		void cpu_##kDecl; \
 		void cpulaunch_##kDecl \
@@ -273,23 +367,11 @@ typedef kernel_state otable_ks;
 			int dynShmemPerThread = shmemPerThread;      /* built in the algorithm */ \
 		        int staticShmemPerBlock = 96;   /* read from .cubin file */ \
 		        int threadsPerBlock = 192;      /* TODO: This should be computed as well */ \
-			calculate_grid_parameters((dim3 &)gridDim, threadsPerBlock, ks.nthreads(), dynShmemPerThread, staticShmemPerBlock); \
+			dim3 gridDim; \
+			calculate_grid_parameters(gridDim, threadsPerBlock, ks.nthreads(), dynShmemPerThread, staticShmemPerBlock); \
 			\
 			kernelRunSwatch.start(); \
-			threadIdx.x = threadIdx.y = threadIdx.z = 0; \
-			blockIdx.x = blockIdx.y = blockIdx.z = 0; \
-			blockDim.x = threadsPerBlock; blockDim.y = blockDim.z = 1; \
-			for(uint32_t __i=0; __i != ks.nthreads(); __i++) \
-			{ \
-				if(0) { MLOG(verb1) << "t(" << threadIdx.x << "), b(" << blockIdx.x << "," << blockIdx.y << "," << blockIdx.z << ")"; } \
-				if(0) { MLOG(verb1) << "  db(" << blockDim.x << "," << blockDim.y << "," << blockDim.z << ")"; } \
-				if(0) { MLOG(verb1) << "  dg(" << gridDim.x << "," << gridDim.y << "," << gridDim.z << ")"; } \
-				cpu_##kName kArgs; \
-				threadIdx.x++; \
-				if(threadIdx.x == blockDim.x) { threadIdx.x = 0; blockIdx.x++; } \
-				if(blockIdx.x  == gridDim.x) { blockIdx.x = 0;  blockIdx.y++; } \
-				if(blockIdx.y  == gridDim.y) { blockIdx.y = 0;  blockIdx.z++; } \
-			} \
+			cpu_kernel_launch(bind_cpu_kernel(cpu_##kName, CPU_KERNEL_ARGS kArgs), ks.nthreads(), gridDim, threadsPerBlock); \
 			kernelRunSwatch.stop(); \
 		} \
 		void cpu_##kDecl
@@ -321,8 +403,22 @@ typedef rng_t &gpu_rng_t;
 
 #if HAVE_CUDA || !ALIAS_GPU_RNG
 	#include "cuda_rng.h"
+
+	// Build with COUNTER_RNG=1 (cmake -DCOUNTER_RNG=ON) to use the Philox
+	// counter-based generator. Its substreams are keyed by the work item
+	// (star, or table row) instead of the thread, making the output
+	// independent of the number of threads and kernel configuration.
+	#ifndef COUNTER_RNG
+	#define COUNTER_RNG 0
+	#endif
+
+	#if COUNTER_RNG
+	typedef prngs::gpu::philox gpu_prng_impl;
+	typedef prngs::cpu::philox cpu_prng_impl;
+	#else
 	typedef prngs::gpu::mwc gpu_prng_impl;
 	typedef prngs::cpu::mwc cpu_prng_impl;
+	#endif
 
 	//
 	// Maintains a multi-threaded random number generator instance
@@ -330,6 +426,10 @@ typedef rng_t &gpu_rng_t;
 	// to GPU as needed. It is auto-initialized on first call, using the
 	// seed provided by seeder rng, and freed on exit from the application.
 	//
+	// With COUNTER_RNG, there's no state to persist; instead, every
+	// instance gets a new key from the seeder (so that different modules,
+	// all seeking to substreams by row index, don't draw the same numbers).
+	//
 	// Usage:
 	//	gpu_rng_t bla(seeder)
 	//	bla.uniform(); ....
@@ -358,6 +458,13 @@ typedef rng_t &gpu_rng_t;
 			(gpu_prng_impl&)*this = gpuRNG.get(seeder);
 		}
 		gpu_rng_t() {}
+
+		// An instance with its own streams, seeded from seeder, for users
+		// running concurrently with the users of the persistent instance
+		// (see skygenBatchQueue). Must be released with free_private(),
+		// with the same device active.
+		static gpu_rng_t create_private(rng_t &seeder);
+		static void free_private(gpu_rng_t &rng);
 	};
 #endif
 
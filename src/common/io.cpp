@@ -23,6 +23,18 @@
 #include <boost/iostreams/filter/bzip2.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/iostreams/device/file.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <zlib.h>
+#include <bzlib.h>
+
+#include <fstream>
+#include <cstdlib>
+#include <algorithm>
+#include <deque>
+#include <vector>
 
 #include <astro/system/log.h>
 #include <astro/system/fs.h>
@@ -30,6 +42,7 @@
 #include <astro/useall.h>
 
 #include "io.h"
+#include "gpu.h"
 
 // 'normalize' a keyword by turning it lower case and removing any non-alphanumeric characters
 std::string normalizeKeyword(const std::string &s)
@@ -57,13 +70,295 @@ const std::string &datadir()
 	return dd;
 }
 
+//
+// Block-parallel gzip/bzip2 compressor (a la pigz and pbzip2). The data
+// is cut into blocks, which are compressed independently on a pool of
+// threads into separate gzip members (bzip2 streams), and written out
+// in order. A concatenation of members is itself a valid gzip (bzip2)
+// file, readable by gunzip (bunzip2) and flex_input.
+//
+class parallel_compressor
+{
+public:
+	typedef char char_type;
+	struct category : public boost::iostreams::sink_tag, public boost::iostreams::closable_tag {};
+
+	enum format_t { GZIP, BZIP2 };
+
+	parallel_compressor(const std::string &fn, format_t format, int nthreads);
+	std::streamsize write(const char *s, std::streamsize n);
+	void close();
+	std::string error() const;	// the first error that occurred (empty if none)
+
+protected:
+	struct impl;
+	boost::shared_ptr<impl> d;	// shared, as boost::iostreams copies devices around
+};
+
+struct parallel_compressor::impl
+{
+	struct block
+	{
+		std::vector<char> in, out;
+		bool done;
+	};
+
+	std::ofstream file;
+	format_t format;
+	size_t blocksize;		// uncompressed bytes per block
+	size_t maxblocks;		// maximum number of blocks in flight
+	size_t nblocks;			// number of blocks submitted so far
+
+	boost::mutex mx;
+	boost::condition_variable cv;	// signaled when a block is submitted or compressed, or on close
+	boost::thread_group workers;
+	std::deque<boost::shared_ptr<block> > blocks;	// blocks in flight, in output order
+	size_t next;			// index (in blocks) of the first block not yet taken by a worker
+	bool stopping;
+	std::string error;		// the first compression or write error. Once set, further output is discarded.
+
+	boost::shared_ptr<block> cur;	// block being filled
+	bool closed;
+
+	impl(const std::string &fn, format_t format_, int nthreads)
+		: file(fn.c_str(), std::ios::binary), format(format_), nblocks(0), next(0), stopping(false), closed(false)
+	{
+		if(!file) { THROW(EFile, "Failed to open '" + fn + "' for output."); }
+
+		// bzip2 compresses in 900k blocks at the default (highest) level,
+		// so larger blocks wouldn't help it
+		blocksize = format == BZIP2 ? 900*1000 : 1 << 20;
+		maxblocks = 2*nthreads;
+		FOR(0, nthreads)
+		{
+			workers.create_thread(boost::bind(&impl::worker, this));
+		}
+	}
+
+	~impl()
+	{
+		{
+			boost::mutex::scoped_lock lock(mx);
+			stopping = true;
+			cv.notify_all();
+		}
+		workers.join_all();
+	}
+
+	// compress b->in into a self-contained gzip member or bzip2 stream
+	static std::string compress(block &b, format_t format)
+	{
+		if(format == GZIP)
+		{
+			z_stream z;
+			memset(&z, 0, sizeof(z));
+			if(deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) { return "deflateInit2 failed"; }
+
+			b.out.resize(deflateBound(&z, b.in.size()));
+			z.next_in = b.in.empty() ? NULL : (Bytef *)&b.in[0];
+			z.avail_in = b.in.size();
+			z.next_out = (Bytef *)&b.out[0];
+			z.avail_out = b.out.size();
+			int ret = deflate(&z, Z_FINISH);
+			b.out.resize(z.total_out);
+			deflateEnd(&z);
+
+			if(ret != Z_STREAM_END) { return "deflate failed"; }
+		}
+		else
+		{
+			char empty = 0;
+			unsigned int len = b.in.size() + b.in.size() / 100 + 600;
+			b.out.resize(len);
+			int ret = BZ2_bzBuffToBuffCompress(&b.out[0], &len, b.in.empty() ? &empty : &b.in[0], b.in.size(), 9, 0, 0);
+			if(ret != BZ_OK) { return "BZ2_bzBuffToBuffCompress failed"; }
+			b.out.resize(len);
+		}
+		return "";
+	}
+
+	void worker()
+	{
+		boost::mutex::scoped_lock lock(mx);
+		while(true)
+		{
+			while(next == blocks.size() && !stopping) { cv.wait(lock); }
+			if(next == blocks.size()) { return; }
+
+			boost::shared_ptr<block> b = blocks[next++];
+			lock.unlock();
+			std::string err = compress(*b, format);
+			std::vector<char>().swap(b->in);
+			lock.lock();
+
+			if(!err.empty() && error.empty()) { error = err; }
+			b->done = true;
+			cv.notify_all();
+		}
+	}
+
+	// write out the compressed blocks at the head of the queue, waiting
+	// for more to be compressed until fewer than n remain in flight.
+	// Must be called with mx locked. Doesn't throw (it runs from
+	// close(), which the stream buffer calls while being destroyed);
+	// errors are recorded in 'error', and reported by flex_output::close().
+	void flush(boost::mutex::scoped_lock &lock, size_t n)
+	{
+		while(!blocks.empty())
+		{
+			if(!blocks.front()->done)
+			{
+				if(blocks.size() < n) { break; }
+				cv.wait(lock);
+				continue;
+			}
+
+			boost::shared_ptr<block> b = blocks.front();
+			blocks.pop_front();
+			next--;
+			if(!error.empty()) { continue; }
+
+			lock.unlock();
+			if(!b->out.empty()) { file.write(&b->out[0], b->out.size()); }
+			lock.lock();
+			if(!file && error.empty()) { error = "write failed"; }
+		}
+	}
+
+	// hand the current block over to the workers
+	void submit()
+	{
+		boost::mutex::scoped_lock lock(mx);
+		flush(lock, maxblocks);
+
+		cur->done = false;
+		blocks.push_back(cur);
+		nblocks++;
+		cur.reset();
+		cv.notify_all();
+	}
+
+	std::streamsize write(const char *s, std::streamsize n)
+	{
+		if(failed()) { return n; }	// reported by close()
+
+		std::streamsize left = n;
+		while(left)
+		{
+			if(!cur)
+			{
+				cur.reset(new block);
+				cur->in.reserve(blocksize);
+			}
+
+			size_t len = std::min((size_t)left, blocksize - cur->in.size());
+			cur->in.insert(cur->in.end(), s, s + len);
+			s += len; left -= len;
+
+			if(cur->in.size() == blocksize) { submit(); }
+		}
+		return n;
+	}
+
+	void close()
+	{
+		if(closed) { return; }
+		closed = true;
+
+		// the output must consist of at least one member, even if empty
+		if(cur || nblocks == 0)
+		{
+			if(!cur) { cur.reset(new block); }
+			submit();
+		}
+
+		boost::mutex::scoped_lock lock(mx);
+		flush(lock, 1);
+		file.close();
+		if(!file && error.empty()) { error = "close failed"; }
+	}
+
+	bool failed()
+	{
+		boost::mutex::scoped_lock lock(mx);
+		return !error.empty();
+	}
+};
+
+parallel_compressor::parallel_compressor(const std::string &fn, format_t format, int nthreads)
+	: d(new impl(fn, format, nthreads))
+{
+}
+
+std::streamsize parallel_compressor::write(const char *s, std::streamsize n)
+{
+	return d->write(s, n);
+}
+
+void parallel_compressor::close()
+{
+	d->close();
+}
+
+std::string parallel_compressor::error() const
+{
+	boost::mutex::scoped_lock lock(d->mx);
+	return d->error;
+}
+
+void flex_output::close()
+{
+	if(stream == NULL || closed) { return; }
+	closed = true;
+
+	stream->flush();
+	bool ok = !stream->fail();
+	std::string err;
+	if(sbout)
+	{
+		sbout->reset();		// closes the compressor, writing out the remaining blocks
+		err = compressor->error();
+	}
+	else if(std::ofstream *f = dynamic_cast<std::ofstream *>(stream))
+	{
+		f->close();
+		ok = ok && !f->fail();
+	}
+
+	if(!err.empty()) { THROW(EIOException, "Error writing compressed output to '" + fn + "': " + err + "."); }
+	if(!ok) { THROW(EIOException, "Error writing output to '" + fn + "'."); }
+}
+
+//
+// The number of threads compressing each gzip/bzip2 output. They run
+// alongside the CPU kernel pool (and the threads of any other compressed
+// outputs), so by default use half of the pool's size. Set the
+// COMPRESS_THREADS environment variable to override.
+//
+static int compressor_threads()
+{
+	const char *thrStr = getenv("COMPRESS_THREADS");
+	int nthreads = thrStr ? atoi(thrStr) : cpu_kernel_pool::nthreads() / 2;
+	return std::max(nthreads, 1);
+}
+
 flex_output::~flex_output()
 {
+	try
+	{
+		close();
+	}
+	catch(EAny &e)
+	{
+		e.print();
+	}
+
 	if(stream != &std::cout)
 	{
 		delete stream;
 	}
 	delete sbout;
+	delete compressor;
 }
 
 std::ostream *flex_output::open(const std::string &fn)
@@ -72,19 +367,25 @@ std::ostream *flex_output::open(const std::string &fn)
 	
 	using namespace boost::iostreams;
 
-	stream = NULL; sbout = NULL;
+	this->fn = fn;
+	stream = NULL; sbout = NULL; compressor = NULL;
+	closed = false;
 
 	if(fn.size() > 4 && fn.rfind(".bz2") == fn.size()-4)
 	{
-		sbout = new filtering_streambuf<output>(bzip2_compressor() | file_sink(fn));
+		int nthreads = compressor_threads();
+		compressor = new parallel_compressor(fn, parallel_compressor::BZIP2, nthreads);
+		sbout = new filtering_streambuf<output>(*compressor);
 		stream = new std::ostream(sbout);
-		MLOG(verb2) << "Outputing bzip2 compressed data to " << fn << ".";
+		MLOG(verb2) << "Outputing bzip2 compressed data to " << fn << " (" << nthreads << " compression threads).";
 	}
 	else if(fn.size() > 3 && fn.rfind(".gz") == fn.size()-3)
 	{
-		sbout = new filtering_streambuf<output>(gzip_compressor() | file_sink(fn));
+		int nthreads = compressor_threads();
+		compressor = new parallel_compressor(fn, parallel_compressor::GZIP, nthreads);
+		sbout = new filtering_streambuf<output>(*compressor);
 		stream = new std::ostream(sbout);
-		MLOG(verb2) << "Outputing gzip compressed data to " << fn << ".";
+		MLOG(verb2) << "Outputing gzip compressed data to " << fn << " (" << nthreads << " compression threads).";
 	}
 	else if(fn == "-")
 	{
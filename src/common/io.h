@@ -27,18 +27,24 @@
 std::string normalizeKeyword(const std::string &s); // 'normalize' a keyword by turning it lower case and removing any non-alphanumeric characters
 const std::string &datadir(); // return the path to built-in datafiles (TODO: move it to someplace where it belongs)
 
+class parallel_compressor;
+
 class flex_output
 {
 protected:
+	std::string fn;
 	std::ostream *stream;
 	boost::iostreams::filtering_streambuf<boost::iostreams::output> *sbout;
+	parallel_compressor *compressor;	// the device at the end of sbout (if compressing); keeps its error state
+	bool closed;
 
 public:
-	flex_output(const std::string &fn = "") { open(fn); }
-	~flex_output();
+	flex_output(const std::string &fn = "") : stream(NULL), sbout(NULL), compressor(NULL), closed(false) { open(fn); }
+	~flex_output();	// closes the output if close() wasn't called, logging (not throwing) any errors
 
 	std::ostream *open(const std::string &fn);
 	std::ostream &out() { return *this->stream; }
+	void close();	// flush and close the output, throwing EIOException if anything failed to be written
 };
 
 class flex_input
@@ -557,12 +557,291 @@ std::ostream& otable::serialize_header(std::ostream &out)
 	return out;
 }
 
+//
+// Fast path of serialize_body(). The rows are formatted in blocks, one
+// column field at a time, and assembled into lines afterwards. Fields
+// with formats of the form %[ +]W[.P]f (float and double columns) or
+// %[ +]Wd (int columns) are converted without snprintf, with exact
+// (round-half-even) rounding of the binary value, so the output is
+// byte-identical to what snprintf would produce. Other formats (and
+// values out of range of the fast conversion) go through snprintf.
+//
+struct text_field
+{
+	enum { GENERIC, FIXED, INTEGER };
+
+	const char *base;		// element 0 of row 0
+	size_t es, pitch;		// element size, and distance between the fields of an array column (bytes)
+	char type;			// 'f', 'd' or 'i' (float, double, int)
+	std::string fmt;		// printf format string
+
+	int kind;			// GENERIC, FIXED or INTEGER
+	char sign;			// prefix for non-negative numbers (0 if none)
+	int width, prec;		// minimum field width and precision
+
+	std::vector<char> buf;		// formatted values of the current block
+	std::vector<uint32_t> end;	// end offsets of values in buf
+
+	// parse the format string, and set up the conversion
+	void set_format(const std::string &f)
+	{
+		fmt = f;
+		kind = GENERIC;
+		sign = 0; width = 0; prec = 6;
+
+		const char *c = f.c_str();
+		if(*c++ != '%') { return; }
+		if(*c == ' ' || *c == '+') { sign = *c++; }
+		if(*c == '0') { return; }	// zero padding
+		while(isdigit(*c)) { width = width*10 + (*c++ - '0'); }
+		bool hasprec = *c == '.';
+		if(hasprec)
+		{
+			c++;
+			prec = 0;
+			while(isdigit(*c)) { prec = prec*10 + (*c++ - '0'); }
+		}
+		if(width > 64 || prec > 9) { return; }
+
+		if(c[0] == 'f' && c[1] == 0 && type != 'i') { kind = FIXED; }
+		if(c[0] == 'd' && c[1] == 0 && type == 'i' && !hasprec) { kind = INTEGER; }
+	}
+
+	// write the digits of v ending at end, return the first one
+	static char *put_uint(char *end, uint64_t v)
+	{
+		do { *--end = '0' + v % 10; v /= 10; } while(v);
+		return end;
+	}
+
+	// right-align [b, e) in a field of the requested width
+	size_t put_padded(char *dest, const char *b, const char *e) const
+	{
+		size_t len = e - b, pad = width > (int)len ? width - len : 0;
+		memset(dest, ' ', pad);
+		memcpy(dest + pad, b, len);
+		return pad + len;
+	}
+
+	// %[ +]W.Pf conversion of v into dest. Returns 0 if v is out of range.
+	size_t put_fixed(char *dest, double v) const
+	{
+		static const uint64_t pow10[] = { 1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL };
+		const uint64_t p10 = pow10[prec];
+
+		// v == m * 2^e exactly
+		uint64_t bits;
+		memcpy(&bits, &v, sizeof(bits));
+		bool neg = bits >> 63;
+		int ex = (bits >> 52) & 0x7ff;
+		uint64_t m = bits & ((1ULL << 52) - 1);
+		if(ex == 0x7ff) { return 0; }		// inf, nan
+		if(ex) { m |= 1ULL << 52; } else { ex = 1; }
+		int e = ex - 1075;
+
+		// q = round(|v| * 10^prec), exactly, in 64 bits
+		if(fabs(v) >= 1e18 / p10) { return 0; }
+		uint64_t q;
+		if(m == 0)
+		{
+			q = 0;
+		}
+		else
+		{
+			// strip trailing zeros, so that (widened) floats need no more than 64 bits below
+			int tz = __builtin_ctzll(m);
+			m >>= tz; e += tz;
+
+			if(e >= 0)
+			{
+				q = (m * p10) << e;
+			}
+			else if(-e >= 100)
+			{
+				q = 0;
+			}
+			else if(m < (1ULL << 32) && -e < 64)
+			{
+				int s = -e;
+				uint64_t n = m * p10;
+				uint64_t r = n & ((1ULL << s) - 1), half = 1ULL << (s-1);
+				q = n >> s;
+				if(r > half || (r == half && (q & 1))) { q++; }
+			}
+			else
+			{
+				int s = -e;
+				unsigned __int128 n = (unsigned __int128)m * p10;
+				unsigned __int128 r = n & (((unsigned __int128)1 << s) - 1), half = (unsigned __int128)1 << (s-1);
+				q = (uint64_t)(n >> s);
+				if(r > half || (r == half && (q & 1))) { q++; }
+			}
+		}
+
+		char tmp[32], *e1 = tmp + sizeof(tmp), *b = e1;
+		if(prec)
+		{
+			char *fe = b;
+			b = put_uint(b, q % p10);
+			while(fe - b < prec) { *--b = '0'; }
+			*--b = '.';
+		}
+		b = put_uint(b, q / p10);
+		if(neg) { *--b = '-'; } else if(sign) { *--b = sign; }
+
+		return put_padded(dest, b, e1);
+	}
+
+	// %[ +]Wd conversion of v into dest
+	size_t put_int(char *dest, int v) const
+	{
+		char tmp[16], *e1 = tmp + sizeof(tmp), *b;
+		int64_t vv = v;
+		b = put_uint(e1, vv < 0 ? -vv : vv);
+		if(vv < 0) { *--b = '-'; } else if(sign) { *--b = sign; }
+		return put_padded(dest, b, e1);
+	}
+
+	template<typename T>
+	size_t put_generic(size_t at, T v)
+	{
+		int len = snprintf(&buf[at], buf.size() - at, fmt.c_str(), v);
+		if(len >= (int)(buf.size() - at))
+		{
+			buf.resize(at + len + 1);
+			snprintf(&buf[at], buf.size() - at, fmt.c_str(), v);
+		}
+		return len;
+	}
+
+	size_t put(char *dest, float v) const  { return kind == FIXED ? put_fixed(dest, v) : 0; }
+	size_t put(char *dest, double v) const { return kind == FIXED ? put_fixed(dest, v) : 0; }
+	size_t put(char *dest, int v) const    { return kind == INTEGER ? put_int(dest, v) : 0; }
+
+	template<typename T>
+	void format(const std::vector<uint32_t> &rows)
+	{
+		static const size_t MAXFAST = 128;	// enough for any value converted by put_fixed/put_int
+
+		size_t at = 0;
+		FOR(0, rows.size())
+		{
+			if(buf.size() < at + MAXFAST) { buf.resize(2*buf.size() + MAXFAST); }
+
+			T v = *(const T *)(base + es*rows[i]);
+			size_t len = put(&buf[at], v);
+			if(!len) { len = put_generic(at, v); }
+
+			at += len;
+			end[i] = at;
+		}
+	}
+
+	// format the values of this field in the given rows
+	void format(const std::vector<uint32_t> &rows)
+	{
+		end.resize(rows.size());
+		switch(type)
+		{
+			case 'f': format<float>(rows); break;
+			case 'd': format<double>(rows); break;
+			case 'i': format<int>(rows); break;
+		}
+	}
+};
+
+// set up the fields of columns cols for serialize_body_fast(). Returns
+// false if the fast path can't handle some of them.
+static bool get_text_fields(std::vector<text_field> &fields, const std::vector<const otable::columndef*> &cols)
+{
+	fields.clear();
+	FOREACHj(c, cols)
+	{
+		const otable::columndef &col = **c;
+		const std::string &fmt = col.getFormatString();
+		const std::string &tn = col.type()->typeName;
+		if(fmt.empty()) { return false; }	// formatted with iostreams
+
+		char type;
+		if(tn == "float")       { type = 'f'; }
+		else if(tn == "double") { type = 'd'; }
+		else if(tn == "int")    { type = 'i'; }
+		else { return false; }
+
+		const char *base = const_cast<otable::columndef &>(col).ptr.get();
+		FOR(0, col.ptr.width())
+		{
+			fields.push_back(text_field());
+			text_field &f = fields.back();
+			f.base = base + i*col.ptr.pitch();
+			f.es = col.type()->elementSize;
+			f.type = type;
+			f.set_format(fmt);
+		}
+	}
+	return !fields.empty();
+}
+
+// serialize rows [from, to) of the table with fields fields
+static size_t serialize_body_fast(std::ostream& out, std::vector<text_field> &fields, size_t from, size_t to, const otable::mask_functor &mask)
+{
+	static const size_t BLOCK = 4096;	// rows per block
+
+	std::vector<uint32_t> rows;
+	std::vector<char> text;
+	size_t cnt = 0;
+	for(size_t begin = from; begin < to; begin += BLOCK)
+	{
+		// select the rows to output
+		size_t end = std::min(to, begin + BLOCK);
+		rows.clear();
+		FORj(row, begin, end)
+		{
+			if(mask.shouldOutput(row)) { rows.push_back(row); }
+		}
+		if(rows.empty()) { continue; }
+		cnt += rows.size();
+
+		// format column by column
+		size_t len = 0;
+		FOREACH(fields)
+		{
+			i->format(rows);
+			len += i->end.back() + rows.size();	// values + separators/newlines
+		}
+
+		// assemble the lines
+		text.resize(len);
+		char *at = &text[0];
+		FORj(k, 0, rows.size())
+		{
+			FOREACH(fields)
+			{
+				uint32_t b = k ? i->end[k-1] : 0;
+				uint32_t e = i->end[k];
+				if(i != fields.begin()) { *at++ = ' '; }
+				memcpy(at, &i->buf[b], e - b);
+				at += e - b;
+			}
+			*at++ = '\n';
+		}
+		out.write(&text[0], at - &text[0]);
+	}
+	return cnt;
+}
+
 // serialization/unserialization routines
 size_t otable::serialize_body(std::ostream& out, size_t from, size_t to, const mask_functor &mask) const
 {
 	ASSERT(from >= 0);
 	if(to > size()) { to = size(); }
 
+	std::vector<text_field> fields;
+	if(get_text_fields(fields, outColumns))
+	{
+		return serialize_body_fast(out, fields, from, to, mask);
+	}
+
 	size_t cnt = 0;
 	FORj(row, from, to)
 	{
@@ -653,6 +932,343 @@ std::istream& otable::unserialize_body(std::istream& in)
 	return in;
 };
 
+//
+// Block-parsing unserialize_body(). The numbers are parsed without
+// iostreams or the locale. Values with few enough significant digits to
+// be converted exactly with a single floating point multiplication or
+// division (the usual case for galfast output) are converted directly;
+// others are handed over to strtod/strtof. Either way, the results are
+// the correctly rounded values, identical to what operator>> returns.
+//
+struct text_infield
+{
+	char *base;		// element 0 of row 0
+	size_t es;		// element size
+	char type;		// 'f', 'd', 'i' or 'c' (float, double, int, char)
+};
+
+static inline bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; }
+static inline bool is_digit(char c) { return (unsigned)(c - '0') < 10; }
+
+// Parse a real number at p. Returns the first character past it, or NULL
+// on error.
+template<typename T>
+static const char *parse_real(const char *p, const char *e, T &v)
+{
+	// exact powers of ten, and the limits of the fast path (see Clinger, 1990)
+	static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+					1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+	const bool isfloat = sizeof(T) == sizeof(float);
+	const uint64_t maxmant = isfloat ? (1ULL << 24) : (1ULL << 53);
+	const int maxexp = isfloat ? 10 : 22;
+
+	const char *b = p;
+	bool neg = false;
+	if(p != e && (*p == '-' || *p == '+')) { neg = *p == '-'; p++; }
+
+	uint64_t mant = 0;
+	int exp10 = 0, ndigits = 0;
+	bool exact = true;
+	for(; p != e && is_digit(*p); p++, ndigits++)
+	{
+		if(mant < maxmant) { mant = mant*10 + (*p - '0'); } else { exact = false; }
+	}
+	if(p != e && *p == '.')
+	{
+		for(p++; p != e && is_digit(*p); p++, ndigits++)
+		{
+			if(mant < maxmant) { mant = mant*10 + (*p - '0'); exp10--; } else { exact = false; }
+		}
+	}
+	if(ndigits == 0) { return NULL; }
+	if(p != e && (*p == 'e' || *p == 'E'))
+	{
+		const char *q = p+1;
+		bool eneg = false;
+		if(q != e && (*q == '-' || *q == '+')) { eneg = *q == '-'; q++; }
+		if(q == e || !is_digit(*q)) { return NULL; }
+		int x = 0;
+		for(; q != e && is_digit(*q); q++) { if(x < 10000) { x = x*10 + (*q - '0'); } }
+		exp10 += eneg ? -x : x;
+		p = q;
+	}
+
+	if(exact && mant <= maxmant && exp10 >= -maxexp && exp10 <= maxexp)
+	{
+		if(isfloat)
+		{
+			// all of mant, 10^exp10 and the result are exact or correctly rounded in single precision
+			float x = (float)mant;
+			x = exp10 < 0 ? x / (float)pow10[-exp10] : x * (float)pow10[exp10];
+			v = neg ? -x : x;
+		}
+		else
+		{
+			double x = (double)mant;
+			x = exp10 < 0 ? x / pow10[-exp10] : x * pow10[exp10];
+			v = neg ? -x : x;
+		}
+		return p;
+	}
+
+	// slow path
+	char tmp[128];
+	std::string s;
+	const char *str = tmp;
+	if(p - b < (int)sizeof(tmp)) { memcpy(tmp, b, p - b); tmp[p - b] = 0; }
+	else { s.assign(b, p); str = s.c_str(); }
+	v = isfloat ? strtof(str, NULL) : strtod(str, NULL);
+	return p;
+}
+
+static const char *parse_int(const char *p, const char *e, int &v)
+{
+	bool neg = false;
+	if(p != e && (*p == '-' || *p == '+')) { neg = *p == '-'; p++; }
+	if(p == e || !is_digit(*p)) { return NULL; }
+
+	int64_t x = 0;
+	for(; p != e && is_digit(*p); p++)
+	{
+		x = x*10 + (*p - '0');
+		if(x > (int64_t)INT_MAX + 1) { return NULL; }
+	}
+	if(neg) { x = -x; }
+	if(x > INT_MAX) { return NULL; }
+	v = (int)x;
+	return p;
+}
+
+// Parses lines of text into the rows of a table, on the CPU thread pool
+struct parse_lines
+{
+	const std::vector<text_infield> &fields;
+	const std::vector<std::pair<const char *, const char *> > &lines;	// [begin, end) of each line
+	size_t row0;					// table row of line 0
+	std::vector<int> &ok;				// whether line k parsed without errors
+
+	parse_lines(const std::vector<text_infield> &fields_, const std::vector<std::pair<const char *, const char *> > &lines_, size_t row0_, std::vector<int> &ok_)
+		: fields(fields_), lines(lines_), row0(row0_), ok(ok_) {}
+
+	bool parse(const char *p, const char *e, size_t row) const
+	{
+		FOREACH(fields)
+		{
+			while(p != e && (is_blank(*p) || *p == '\n')) { p++; }
+			if(p == e) { return false; }
+
+			char *at = i->base + i->es*row;
+			switch(i->type)
+			{
+				case 'f': p = parse_real(p, e, *(float *)at); break;
+				case 'd': p = parse_real(p, e, *(double *)at); break;
+				case 'i': p = parse_int(p, e, *(int *)at); break;
+				case 'c': *at = *p++; break;
+			}
+			if(p == NULL) { return false; }
+		}
+
+		// nothing but whitespace may follow
+		while(p != e && (is_blank(*p) || *p == '\n')) { p++; }
+		return p == e;
+	}
+
+	void operator()(uint32_t begin, uint32_t end) const
+	{
+		for(uint32_t k = begin; k != end; k++)
+		{
+			ok[k] = parse(lines[k].first, lines[k].second, row0 + k);
+		}
+	}
+};
+
+bool otable::unserialize_body(std::istream& in, text_buffer &buf)
+{
+	static const size_t BLOCK = 16 << 20;	// bytes to read at a time
+
+	std::vector<columndef*> inColumns;
+	getColumnsForInput(inColumns);
+
+	std::vector<text_infield> fields;
+	FOREACH(inColumns)
+	{
+		const std::string &tn = (*i)->type()->typeName;
+		char type;
+		if(tn == "float")       { type = 'f'; }
+		else if(tn == "double") { type = 'd'; }
+		else if(tn == "int")    { type = 'i'; }
+		else if(tn == "char")   { type = 'c'; }
+		else { THROW(EAny, "Don't know how to parse columns of type " + tn); }
+
+		char *base = (*i)->ptr.get();
+		FORj(k, 0, (*i)->ptr.width())
+		{
+			text_infield f = { base + k*(*i)->ptr.pitch(), (*i)->type()->elementSize, type };
+			fields.push_back(f);
+		}
+	}
+
+	std::vector<std::pair<const char *, const char *> > lines;
+	std::vector<int> ok;
+	if(buf.data.empty()) { buf.data.resize(BLOCK); }
+	nrows = 0;
+	while(nrows < capacity())
+	{
+		// find the complete lines in the buffer (skipping the blank ones
+		// and comments), up to the number that fits in the table
+		lines.clear();
+		const char *p = &buf.data[0] + buf.begin, *e = &buf.data[0] + buf.end;
+		while(p != e && lines.size() != capacity() - nrows)
+		{
+			const char *nl = (const char *)memchr(p, '\n', e - p);
+			if(nl == NULL && in) { break; }		// incomplete line; more to come
+			nl = nl ? nl + 1 : e;
+
+			const char *c = p;
+			while(c != nl && (is_blank(*c) || *c == '\n')) { c++; }
+			if(c != nl && *c != '#') { lines.push_back(std::make_pair(p, nl)); }
+			p = nl;
+		}
+
+		if(!lines.empty())
+		{
+			// parse them
+			size_t nlines = lines.size();
+			ok.assign(nlines, 0);
+			cpu_kernel_pool::run(nlines, parse_lines(fields, lines, nrows, ok));
+
+			FOR(0, nlines)
+			{
+				if(!ok[i]) { THROW(EAny, "Error parsing row " + str(buf.rowsRead + i) + " of the input."); }
+			}
+
+			buf.begin = p - &buf.data[0];
+			buf.rowsRead += nlines;
+			nrows += nlines;
+			continue;
+		}
+		buf.begin = p - &buf.data[0];
+		if(!in) { break; }
+
+		// read more
+		if(buf.begin != 0)
+		{
+			memmove(&buf.data[0], &buf.data[0] + buf.begin, buf.end - buf.begin);
+			buf.end -= buf.begin;
+			buf.begin = 0;
+		}
+		if(buf.data.size() < buf.end + BLOCK) { buf.data.resize(buf.end + BLOCK); }
+		in.read(&buf.data[0] + buf.end, BLOCK);
+		buf.end += in.gcount();
+
+		if(in.bad()) { THROW(EAny, "Error after reading " + str(buf.rowsRead) + " rows."); }
+	}
+
+	return in || buf.begin != buf.end;
+}
+
+// gather rows of a single field into a contiguous array
+template<typename T>
+static void gather_rows(char *dst, const char *src, const std::vector<size_t> &rows)
+{
+	T *out = (T *)dst;
+	const T *in = (const T *)src;
+	FOREACH(rows) { *out++ = in[*i]; }
+}
+
+size_t otable::serialize_body_binary(std::ostream& out, size_t from, size_t to, const mask_functor &mask) const
+{
+	ASSERT(from >= 0);
+	if(to > size()) { to = size(); }
+	if(from > to) { from = to; }
+
+	std::vector<size_t> rows;
+	rows.reserve(to - from);
+	FORj(row, from, to)
+	{
+		if(mask.shouldOutput(row)) { rows.push_back(row); }
+	}
+	bool contiguous = rows.size() == to - from;	// nothing masked out; write straight from the columns
+
+	uint64_t n = rows.size();
+	out.write((const char *)&n, sizeof(n));
+
+	std::vector<char> buf;
+	FOREACH(outColumns)
+	{
+		const column<char> &c = (*i)->ptr;
+		const size_t es = (*i)->type()->elementSize;
+		const char *base = c.get();
+		FORj(k, 0, c.width())
+		{
+			const char *src = base + k*c.pitch();
+			if(contiguous)
+			{
+				out.write(src + from*es, n*es);
+				continue;
+			}
+
+			buf.resize(n*es + 1);
+			switch(es)
+			{
+				case 1: gather_rows<uint8_t>(&buf[0], src, rows); break;
+				case 2: gather_rows<uint16_t>(&buf[0], src, rows); break;
+				case 4: gather_rows<uint32_t>(&buf[0], src, rows); break;
+				case 8: gather_rows<uint64_t>(&buf[0], src, rows); break;
+				default:
+				{
+					char *dst = &buf[0];
+					FOREACHj(r, rows) { memcpy(dst, src + *r*es, es); dst += es; }
+				}
+			}
+			out.write(&buf[0], n*es);
+		}
+	}
+
+	return n;
+}
+
+bool otable::unserialize_body_binary(binary_buffer &buf)
+{
+	std::vector<columndef*> inColumns;
+	getColumnsForInput(inColumns);
+
+	nrows = 0;
+	while(nrows < capacity() && buf.begin != buf.end)
+	{
+		uint64_t n;
+		if((size_t)(buf.end - buf.begin) < sizeof(n)) { THROW(EAny, "Truncated input after " + str(buf.rowsRead) + " rows."); }
+		memcpy(&n, buf.begin, sizeof(n));
+		const char *p = buf.begin + sizeof(n);
+
+		size_t m = std::min<size_t>(n - buf.chunkRow, capacity() - nrows);
+		FOREACH(inColumns)
+		{
+			column<char> &c = (*i)->ptr;
+			const size_t es = (*i)->type()->elementSize;
+			char *base = c.get();
+			FORj(k, 0, c.width())
+			{
+				if((size_t)(buf.end - p) < n*es) { THROW(EAny, "Truncated input after " + str(buf.rowsRead) + " rows."); }
+				memcpy(base + k*c.pitch() + nrows*es, p + buf.chunkRow*es, m*es);
+				p += n*es;
+			}
+		}
+
+		nrows += m;
+		buf.rowsRead += m;
+		buf.chunkRow += m;
+		if(buf.chunkRow == n)
+		{
+			// advance to the next chunk
+			buf.begin = p;
+			buf.chunkRow = 0;
+		}
+	}
+
+	return buf.begin != buf.end;
+}
+
 size_t otable::set_output(const std::string &colname, bool output)
 {
 	std::vector<std::string>::iterator it = find(colOutput.begin(), colOutput.end(), colname);
@@ -754,6 +1370,58 @@ void otable::init(const std::string &galfast_version)
 	}
 }
 
+void otable::copy_structure(const otable &t)
+{
+	galfast_version = t.galfast_version;
+	nrows_capacity = t.nrows_capacity;
+	nrows = 0;
+	colInput = t.colInput;
+	colOutput = t.colOutput;
+	outColumns.clear();
+
+	// column classes (aliases point to the same class)
+	std::map<const columnclass *, boost::shared_ptr<columnclass> > newclass;
+	cclasses.clear();
+	FOREACH(t.cclasses)
+	{
+		boost::shared_ptr<columnclass> &c = newclass[i->second.get()];
+		if(!c)
+		{
+			const columnclass &o = *i->second;
+			c.reset(new columnclass(*this));
+			c->className = o.className;
+			c->formatString = o.formatString;
+			c->typeProxy = o.typeProxy;
+			c->m_properties = o.m_properties;
+		}
+		cclasses[i->first] = c;
+	}
+
+	// columns (aliases point to the same column)
+	std::map<const columndef *, boost::shared_ptr<columndef> > newcol;
+	columns.clear();
+	FOREACH(t.columns)
+	{
+		boost::shared_ptr<columndef> &c = newcol[i->second.get()];
+		if(!c)
+		{
+			const columndef &o = *i->second;
+			c.reset(new columndef(*this));
+			c->columnName = o.columnName;
+			c->columnClass = newclass[o.columnClass].get();
+			c->typeProxy = o.typeProxy;
+			c->formatString = o.formatString;
+			c->m_hidden = o.m_hidden;
+			c->fieldNames = o.fieldNames;
+			c->m_properties = o.m_properties;
+
+			c->ptr.resize(0, o.ptr.width(), o.ptr.elementSize());
+			if(o.capacity()) { c->alloc(o.capacity()); }
+		}
+		columns[i->first] = c;
+	}
+}
+
 bool otable::using_column(const std::string &name) const
 {
 	if(!columns.count(name)) return false;
@@ -430,6 +430,11 @@ public:
 		init(galfast_version_);
 	}
 
+	// Make this an empty table with the same column classes, columns (with
+	// their aliases and properties) and capacity as table t. The columns
+	// in use by t are allocated anew.
+	void copy_structure(const otable &t);
+
 	struct mask_functor { virtual bool shouldOutput(int row) const = 0; };
 	struct default_mask_functor : public mask_functor { virtual bool shouldOutput(int row) const { return true; } };
 
@@ -438,6 +443,46 @@ public:
 	std::istream& unserialize_header(std::istream &in, std::set<std::string> *columns = NULL);
 	size_t serialize_body(std::ostream& out, size_t from = 0, size_t to = -1, const mask_functor &mask = default_mask_functor()) const;
 	std::istream& unserialize_body(std::istream& in);
+
+	// Buffered input for the block-parsing unserialize_body() below
+	struct text_buffer
+	{
+		std::vector<char> data;		// text read from the stream, but not yet parsed
+		size_t begin, end;		// valid bytes in data
+		size_t rowsRead;		// rows parsed so far (for error messages)
+		text_buffer() : begin(0), end(0), rowsRead(0) {}
+	};
+
+	// Fast alternative to unserialize_body(std::istream&), for input
+	// with one row per line. Reads the stream in large blocks, and
+	// parses the lines in parallel on the CPU thread pool. The text read
+	// past the last row that fit into the table stays in buf, which must
+	// be passed to the subsequent calls. Returns false once both the
+	// stream and buf are exhausted.
+	bool unserialize_body(std::istream& in, text_buffer &buf);
+
+	// Native binary (columnar) serialization. serialize_body_binary()
+	// writes rows [from, to) that pass the mask as a single chunk: the
+	// number of rows (uint64_t), followed by one contiguous array per
+	// field of each column, in serialize_header() order.
+	size_t serialize_body_binary(std::ostream& out, size_t from = 0, size_t to = -1, const mask_functor &mask = default_mask_functor()) const;
+
+	// Chunks written by serialize_body_binary(), typically in a
+	// memory-mapped file
+	struct binary_buffer
+	{
+		const char *begin, *end;	// chunks not yet (fully) read
+		size_t chunkRow;		// rows of the chunk at begin that were already read
+		size_t rowsRead;		// rows read so far (for error messages)
+		binary_buffer(const char *b = NULL, const char *e = NULL) : begin(b), end(e), chunkRow(0), rowsRead(0) {}
+	};
+
+	// Copies up to capacity() rows out of buf, one memcpy per field (and
+	// chunk), into the columns listed by unserialize_header(). Chunks
+	// that don't fit into the table are continued on the next call.
+	// Returns false once buf is exhausted.
+	bool unserialize_body_binary(binary_buffer &buf);
+
 	size_t set_output(const std::string &colname, bool output);
 	size_t set_output_all(bool output = true);
 };
@@ -40,6 +40,7 @@ using namespace std;
 extern "C" void resample_texture(const std::string &outfn, const std::string &texfn, float2 crange[3], int npix[3], bool deproject, Radians l0, Radians b0);
 void generate_catalog(int seed, size_t maxstars, size_t nstars, const std::set<Config::filespec> &modules, const std::string &input, const std::string &output, bool dryrun);
 void intersectFootprintWithPencilBeam(Radians l0, Radians b0, Radians r, const std::vector<Config::filespec> &modules);
+int run_test(const std::string &name);	// defined in tests.cpp
 
 int main(int argc, char **argv)
 {
@@ -86,6 +87,7 @@ try
 		"Run a utility. Can be one of:\n"
 		"  cudaquery - \tquery available cuda devices\n"
 		" resample3d - \tresample a 3D FITS file, store output to text table\n"
+		"       test - \trun a self-test or benchmark\n"
 //		"   footplot - \tmake a PostScript plot of the footprints\n"
 	);
 	sopts["util"]->stop_after_final_arg = true;
@@ -126,6 +128,10 @@ try
 	uopts["footbeam"]->argument("footprints").bind(modules).gobble().desc("Footprint configuration file(s), or a module=config file.");
 	uopts["footbeam"]->option("o").addname("output").bind(output).param_required().desc("Output polygon file");
 
+	std::string test_name;
+	uopts["test"].reset(new Options(argv0 + " util test", progdesc + " Run a self-test or benchmark.", version, Authorship::majuric));
+	uopts["test"]->argument("name").bind(test_name).desc("Name of the test to run (see tests.cpp).");
+
 #if 0 // TODO: Implement this
 	std::vector<std::string> footprint_confs;
 	std::string outputps = "foot.ps";
@@ -175,6 +181,10 @@ try
 		resample_texture(output, input, crange, npix, deproject, rad(l0), rad(b0));
 		return 0;
 	}
+	if(cmd == "util test")
+	{
+		return run_test(test_name);
+	}
 	if(cmd == "util footbeam")
 	{
 		// check if a config module was given
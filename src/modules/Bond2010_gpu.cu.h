@@ -162,7 +162,7 @@ namespace Bond2010
 	__device__ __constant__ Bond2010::os_Bond2010_data os_Bond2010_par;
 
 	KERNEL(
-		ks, 3*4,
+		ks, gpu_rng_t::state_bytes(),
 		os_Bond2010_kernel(
 			otable_ks ks, gpu_rng_t rng, 
 			cint_t::gpu_t comp,
@@ -180,6 +180,7 @@ namespace Bond2010
 		for(int row=ks.row_begin(); row < ks.row_end(); row++)
 		{
 			if(hidden(row)) { continue; }
+			rng.seek(row);
 
 			// fetch prerequisites
 			const int cmp = comp(row);
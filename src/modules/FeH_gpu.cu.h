@@ -41,7 +41,7 @@ struct os_FeH_data
 #if (__CUDACC__ || BUILD_FOR_CPU)
 
 KERNEL(
-	ks, 3*4,
+	ks, gpu_rng_t::state_bytes(),
 	os_FeH_kernel(
 		otable_ks ks, os_FeH_data par, gpu_rng_t rng, 
 		cint_t::gpu_t comp,
@@ -57,6 +57,7 @@ KERNEL(
 	for(uint32_t row = ks.row_begin(); row < ks.row_end(); row++)
 	{
 		if(hidden(row)) { continue; }
+		rng.seek(row);
 
 		int cmp = comp(row);
 		if(par.comp_thin.isset(cmp) || par.comp_thick.isset(cmp))
@@ -27,7 +27,7 @@
 #if (__CUDACC__ || BUILD_FOR_CPU)
 
 KERNEL(
-	ks, 3*4,
+	ks, gpu_rng_t::state_bytes(),
 	os_GaussianFeH_kernel(
 		otable_ks ks, bit_map applyToComponents, float mean, float sigma, gpu_rng_t rng,
 		cint_t::gpu_t comp, cint_t::gpu_t hidden,
@@ -42,6 +42,7 @@ KERNEL(
 	for(uint32_t row = ks.row_begin(); row < ks.row_end(); row++)
 	{
 		if(hidden(row)) { continue; }
+		rng.seek(row);
 
 		int cmp = comp(row);
 		if(!applyToComponents.isset(cmp)) { continue; }
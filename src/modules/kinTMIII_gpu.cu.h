@@ -169,7 +169,7 @@ namespace kinTMIII
 	__device__ __constant__ kinTMIII::os_kinTMIII_data os_kinTMIII_par;
 
 	KERNEL(
-		ks, 3*4,
+		ks, gpu_rng_t::state_bytes(),
 		os_kinTMIII_kernel(
 			otable_ks ks, gpu_rng_t rng, 
 			cint_t::gpu_t comp, cint_t::gpu_t hidden,
@@ -209,6 +209,7 @@ namespace kinTMIII
 		for(int row=ks.row_begin(); row < ks.row_end(); row++)
 		{
 			if(hidden(row)) { continue; }
+			rng.seek(row);
 
 			// fetch prerequisites
 			const int cmp = comp(row);
@@ -27,6 +27,8 @@
 
 	#include "gpu.h"
 	#include <astro/constants.h>
+	#include <cmath>
+	#include <algorithm>
 
 // 	#ifdef __CUDACC__
 // 		// distance to the Galactic center
@@ -147,4 +149,132 @@
 		return v;
 	}
 
+	//
+	// Batched approximations of exp10f() and log10f() for the CPU
+	// versions of kernels, computing four values at a time with SSE.
+	//
+	//   exp10_batch: 10^x = 2^k e^r, with k = round(x log2(10)) and
+	//     |r| <= ln(2)/2. e^r is a degree 7 Taylor polynomial. The
+	//     relative error is below 1.5e-7 (about 1.3 ulp) for
+	//     -37.5 <= x <= 38.2. Arguments outside that range are clamped to it.
+	//   log10_batch: x = 2^e m, with sqrt(1/2) <= m < sqrt(2), and
+	//     ln(m) = 2 atanh((m-1)/(m+1)), summed to the 9th power. The
+	//     absolute error is below 1e-7 * max(1, |log10(x)|), for
+	//     normalized x > 0.
+	//
+	// Converting a magnitude to luminosity and back, the round trip
+	// error is below 3e-7 mag for -5 < M < 30.
+	//
+#if !__CUDACC__
+	namespace batch_math
+	{
+		static const float log2_10   = 3.32192809488736234787f;
+		static const float log10_2hi = 0.301025390625f;			// log10(2), split so that k*log10_2hi is exact
+		static const float log10_2lo = 4.6050389811952137e-06f;
+		static const float ln10      = 2.30258509299404568402f;
+		static const float log10_e   = 0.43429448190325182765f;
+		static const float sqrt2     = 1.41421356237309504880f;
+		static const float exp10_min = -37.5f, exp10_max = 38.2f;
+
+		// e^r for |r| <= ln(2)/2
+		inline float exp_poly(float r)
+		{
+			return 1.f + r*(1.f + r*(1.f/2 + r*(1.f/6 + r*(1.f/24 + r*(1.f/120 + r*(1.f/720 + r*(1.f/5040)))))));
+		}
+
+		inline float exp10(float x)
+		{
+			x = std::max(exp10_min, std::min(exp10_max, x));
+			float k = (float)lrintf(x * log2_10);
+			float r = ((x - k*log10_2hi) - k*log10_2lo) * ln10;
+			union { uint32_t u; float f; } p2k;
+			p2k.u = (uint32_t)((int)k + 127) << 23;
+			return exp_poly(r) * p2k.f;
+		}
+
+		// ln(m) for sqrt(1/2) <= m < sqrt(2)
+		inline float log_poly(float m)
+		{
+			float s = (m - 1.f) / (m + 1.f), s2 = s*s;
+			return 2.f*s*(1.f + s2*(1.f/3 + s2*(1.f/5 + s2*(1.f/7 + s2*(1.f/9)))));
+		}
+
+		inline float log10(float x)
+		{
+			union { uint32_t u; float f; } v;
+			v.f = x;
+			int e = (int)(v.u >> 23) - 127;
+			v.u = (v.u & 0x007FFFFF) | 0x3F800000;	// mantissa, in [1, 2)
+			float m = v.f;
+			if(m >= sqrt2) { m *= 0.5f; e++; }
+			float fe = (float)e;
+			return fe*log10_2hi + (fe*log10_2lo + log_poly(m)*log10_e);
+		}
+	}
+
+	inline void exp10_batch(float *y, const float *x, int n)
+	{
+		using namespace batch_math;
+		int i = 0;
+#if CUX_SSE
+		for(; i + 4 <= n; i += 4)
+		{
+			__m128 v = _mm_loadu_ps(x + i);
+			v = _mm_max_ps(_mm_set1_ps(exp10_min), _mm_min_ps(_mm_set1_ps(exp10_max), v));
+			__m128i ki = _mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(log2_10)));
+			__m128 k = _mm_cvtepi32_ps(ki);
+			__m128 r = _mm_sub_ps(_mm_sub_ps(v, _mm_mul_ps(k, _mm_set1_ps(log10_2hi))), _mm_mul_ps(k, _mm_set1_ps(log10_2lo)));
+			r = _mm_mul_ps(r, _mm_set1_ps(ln10));
+
+			__m128 p = _mm_set1_ps(1.f/5040);
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.f/720));
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.f/120));
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.f/24));
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.f/6));
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.f/2));
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.f));
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.f));
+
+			__m128 p2k = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(ki, _mm_set1_epi32(127)), 23));
+			_mm_storeu_ps(y + i, _mm_mul_ps(p, p2k));
+		}
+#endif
+		for(; i < n; i++) { y[i] = batch_math::exp10(x[i]); }
+	}
+
+	inline void log10_batch(float *y, const float *x, int n)
+	{
+		using namespace batch_math;
+		int i = 0;
+#if CUX_SSE
+		for(; i + 4 <= n; i += 4)
+		{
+			__m128i v = _mm_castps_si128(_mm_loadu_ps(x + i));
+			__m128i e = _mm_sub_epi32(_mm_srli_epi32(v, 23), _mm_set1_epi32(127));
+			__m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(v, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000)));
+
+			// m >= sqrt(2) -> m/2, e+1
+			__m128 big = _mm_cmpge_ps(m, _mm_set1_ps(sqrt2));
+			m = _mm_mul_ps(m, _mm_or_ps(_mm_and_ps(big, _mm_set1_ps(0.5f)), _mm_andnot_ps(big, _mm_set1_ps(1.f))));
+			e = _mm_sub_epi32(e, _mm_castps_si128(big));	// big is all ones (-1) where true
+			__m128 fe = _mm_cvtepi32_ps(e);
+
+			__m128 one = _mm_set1_ps(1.f);
+			__m128 s = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+			__m128 s2 = _mm_mul_ps(s, s);
+			__m128 p = _mm_set1_ps(1.f/9);
+			p = _mm_add_ps(_mm_mul_ps(p, s2), _mm_set1_ps(1.f/7));
+			p = _mm_add_ps(_mm_mul_ps(p, s2), _mm_set1_ps(1.f/5));
+			p = _mm_add_ps(_mm_mul_ps(p, s2), _mm_set1_ps(1.f/3));
+			p = _mm_add_ps(_mm_mul_ps(p, s2), one);
+			__m128 lnm = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(2.f), s), p);
+
+			__m128 lo = _mm_add_ps(_mm_mul_ps(fe, _mm_set1_ps(log10_2lo)), _mm_mul_ps(lnm, _mm_set1_ps(log10_e)));
+			_mm_storeu_ps(y + i, _mm_add_ps(_mm_mul_ps(fe, _mm_set1_ps(log10_2hi)), lo));
+		}
+#endif
+		for(; i < n; i++) { y[i] = batch_math::log10(x[i]); }
+	}
+#endif
+
 #endif
@@ -22,17 +22,54 @@
 #define photometricErrors_gpu_cu_h__
 
 //
-// Module data passed to device kernel
+// Device kernel implementation
 //
 
-// -- none for now (this is a CPU module; TODO: port this module to GPU)
+#if !__CUDACC__ && !BUILD_FOR_CPU
 
-//
-// Device kernel implementation
-//
-#if (__CUDACC__ || BUILD_FOR_CPU)
+	DECLARE_KERNEL(os_photometricErrors_kernel(otable_ks ks, gpu_rng_t rng, uint32_t stream, uint32_t bandMask, int nbands, cfloat_t::gpu_t magTrue, cfloat_t::gpu_t magObs, cint_t::gpu_t hidden));
+
+	// Error curves of a bandset: sigma(mag, band). The curve of band b
+	// is in row b (sampled exactly at y = b).
+	DECLARE_TEXTURE(photoErrSigma, float, 2, cudaReadModeElementType);
+
+#else
+
+	DEFINE_TEXTURE(photoErrSigma, float, 2, cudaReadModeElementType, false, cudaFilterModeLinear, cudaAddressModeClamp);
+
+	KERNEL(
+		ks, gpu_rng_t::state_bytes(),
+		os_photometricErrors_kernel(otable_ks ks, gpu_rng_t rng, uint32_t stream, uint32_t bandMask, int nbands, cfloat_t::gpu_t magTrue, cfloat_t::gpu_t magObs, cint_t::gpu_t hidden),
+		os_photometricErrors_kernel,
+		(ks, rng, stream, bandMask, nbands, magTrue, magObs, hidden)
+	)
+	{
+		/*
+			Input:	magTrue -- true magnitudes
+			Output:	magObs -- magnitudes with gaussian errors mixed in, for
+				bands whose bit is set in bandMask
+		*/
+		rng.load(threadID());
+		for(uint32_t row = ks.row_begin(); row < ks.row_end(); row++)
+		{
+			if(hidden(row)) { continue; }
+			rng.seek(row, stream);
+
+			// the deviates are drawn in pairs (see gpu_rng_t::gaussian2)
+			float z[2];
+			int nz = 0;
+			for(int b = 0; b < nbands; b++)
+			{
+				if(!(bandMask & (1U << b))) { continue; }
+				if(nz == 0) { rng.gaussian2(z[0], z[1]); nz = 2; }
 
-// -- no kernel yet (this is a CPU module; TODO: port this module to GPU)
+				float mag = magTrue(row, b);
+				float sigma = TEX2D(photoErrSigma, mag, b);
+				magObs(row, b) = mag + sigma * z[--nz];
+			}
+		}
+		rng.store(threadID());
+	}
 
 #endif // (__CUDACC__ || BUILD_FOR_CPU)
 
@@ -21,7 +21,7 @@
 #include "galfast_config.h"
 
 #include "../pipeline.h"
-#include "FeH_gpu.cu.h"
+#include "photometricErrors_gpu.cu.h"
 
 #include "spline.h"
 #include "analysis.h"
@@ -39,18 +39,20 @@ protected:
 	{
 		std::string trueBandset;
 		std::string obsBandset;
-		int bandIdx;
-		const spline *sgma;	// spline giving gaussian sigma of errors given true magnitude
+		uint32_t bandMask;		// bands of trueBandset with error curves (bit i set for band i)
+		int nbands;			// number of bands in trueBandset
+		cuxTexture<float, 2> sigma;	// gaussian sigma of errors given true magnitude, for each band (see photoErrSigma)
 
-		errdef(const std::string &obsBandset_, const std::string &trueBandset_, int bandIdx_, const spline &bandErrors)
-			: obsBandset(obsBandset_), trueBandset(trueBandset_), bandIdx(bandIdx_), sgma(&bandErrors) {}
-		float sigma(float mag) { return (*sgma)(mag); }
+		errdef(const std::string &obsBandset_, const std::string &trueBandset_, int nbands_)
+			: obsBandset(obsBandset_), trueBandset(trueBandset_), bandMask(0), nbands(nbands_) {}
 	};
 
 protected:
 	std::map<std::string, std::map<std::string, spline> > availableErrors;
 	std::vector<errdef> columnsToTransform;
+	float dmag;			// magnitude sampling interval of the error curve textures
 
+	void tabulateErrorCurves(errdef &ed, const std::vector<const spline *> &curves);
 	void addErrorCurve(const std::string &bandset, const std::string &band, const std::string &file);
 	void addErrorCurve(const std::string &bandset, const std::string &band, const std::vector<double> &mag, const std::vector<double> &sigma);
 
@@ -63,7 +65,7 @@ public:
 	//virtual int priority() { return PRIORITY_INSTRUMENT; }	// ensure this stage has the least priority
 	virtual double ordering() const { return ord_detector; }
 
-	os_photometricErrors() : osink()
+	os_photometricErrors() : osink(), dmag(0.01f)
 	{
 	}
 };
@@ -111,25 +113,57 @@ extern "C" opipeline_stage *create_module_modelphotoerrors() { return new os_mod
 
 size_t os_photometricErrors::process(otable &in, size_t begin, size_t end, rng_t &rng)
 {
-	// mix-in gaussian error, with sigma drawn from preloaded splines
+	// mix-in gaussian error, with sigma drawn from pretabulated error curves
 	cint_t &hidden = in.col<int>("hidden");
 	FOREACH(columnsToTransform)
 	{
-		cfloat_t::host_t magObs  = in.col<float>(i->obsBandset);
-		cfloat_t::host_t magTrue = in.col<float>(i->trueBandset);
-		int bandIdx = i->bandIdx;
+		cfloat_t &magObs  = in.col<float>(i->obsBandset);
+		cfloat_t &magTrue = in.col<float>(i->trueBandset);
+		uint32_t stream = 1 + (i - columnsToTransform.begin());	// keep the RNG substreams of bandsets apart
 
-		for(size_t row=begin; row < end; row++)
-		{
-			if(hidden(row)) { continue; }
-			float mag = magTrue(row, bandIdx);
-			magObs(row, bandIdx) = mag + rng.gaussian(i->sigma(mag));
-		}
+		cuxTextureBinder tb(::photoErrSigma, i->sigma);
+		CALL_KERNEL(os_photometricErrors_kernel, otable_ks(begin, end), rng, stream, i->bandMask, i->nbands, magTrue, magObs, hidden);
 	}
 
 	return nextlink->process(in, begin, end, rng);
 }
 
+//
+// Tabulate the error curves of a bandset (one per band, NULL if the band
+// has none) into a texture with a common magnitude grid. The grid spans
+// all curves; each curve is held constant beyond its own endpoints.
+//
+void os_photometricErrors::tabulateErrorCurves(errdef &ed, const std::vector<const spline *> &curves)
+{
+	double m0 = 0, m1 = 0;
+	bool first = true;
+	FOREACH(curves)
+	{
+		if(!*i) { continue; }
+		const spline &s = **i;
+		double x0 = s.xv[0], x1 = s.xv[s.xv.size()-1];
+		if(first || x0 < m0) { m0 = x0; }
+		if(first || x1 > m1) { m1 = x1; }
+		first = false;
+	}
+
+	int nmag = (int)((m1 - m0) / dmag) + 2;
+	ed.sigma = cuxTexture<float, 2>(nmag, curves.size(), make_float2(m0, 1./dmag), make_float2(0, 1));
+	FORj(b, 0, curves.size())
+	{
+		const spline *s = curves[b];
+		FOR(0, nmag)
+		{
+			if(!s) { ed.sigma(i, b) = 0.f; continue; }
+
+			double m = m0 + i*dmag;
+			m = std::max(m, s->xv[0]);
+			m = std::min(m, s->xv[s->xv.size()-1]);
+			ed.sigma(i, b) = (*s)(m);
+		}
+	}
+}
+
 bool os_photometricErrors::runtime_init(otable &t)
 {
 	// Search the configuration for all photometric tags that are defined.
@@ -159,6 +193,8 @@ bool os_photometricErrors::runtime_init(otable &t)
 
 		std::set<std::string> bands;
 		cdef.getFieldNames(bands);
+		errdef ed(obsBandset, trueBandset, cdef.width());
+		std::vector<const spline *> curves(cdef.width(), (const spline *)NULL);
 		FOREACH(bands)
 		{
 			if(!errors.count(*i)) { continue; }			// don't have errors for this band
@@ -178,12 +214,23 @@ bool os_photometricErrors::runtime_init(otable &t)
 			}
 
 			int bandIdx = cdef.getFieldIndex(*i);
-			columnsToTransform.push_back(errdef(obsBandset, trueBandset, bandIdx, bandErrors));
+			if(bandIdx >= 32)
+			{
+				THROW(EAny, "Photometry errors module can handle at most 32 bands per photometric system (" + trueBandset + " has more).");
+			}
+			ed.bandMask |= 1U << bandIdx;
+			curves[bandIdx] = &bandErrors;
 
 			MLOG(verb2) << "Adding photometric errors to " << trueBandset << "." << *i << " (output in " << obsBandset << "." << *i << ")";
 			if(!ss.str().empty()) { ss << ", "; }
 			ss << "obs" << *i;
 		}
+
+		if(ed.bandMask)
+		{
+			tabulateErrorCurves(ed, curves);
+			columnsToTransform.push_back(ed);
+		}
 	}
 	MLOG(verb1) << "Photometric errors: Adding errors to {" << ss.str() << "}   ## " << instanceName();
 	return true;
@@ -222,6 +269,10 @@ bool os_photometricErrors::construct(const Config &cfg, otable &t, opipeline &pi
 	//
 	// Expected banderrs.txt format:
 	//   <mag>   <sigma(mag)>
+	//
+	// The curves are tabulated to a grid with 'dmag' spacing (default: 0.01).
+
+	cfg.get(dmag, "dmag", 0.01f);
 
 	// convenience -- 'SDSSugriz.file = internal' slurps up anything with
 	// SDSSugriz.*.photoerr.txt from data directory
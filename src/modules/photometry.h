@@ -27,6 +27,7 @@
 struct ALIGN(16) os_photometry_data
 {
 	uint32_t ncolors, bidx;	// number of colors, bootstrap band index
+	uint32_t batched;	// run the batched CPU kernel (ignored on the GPU)
 
 	static const int N_REDDENING = 17; // This number is set by the number of textures out of which the colors are sampled (4x4=16, currently)
 	float reddening[N_REDDENING];	// reddening coefficients for the loaded bands (NOTE: hardcoded maximum of 17 bands (16 colors))
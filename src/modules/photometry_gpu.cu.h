@@ -84,6 +84,154 @@ unsigned int __brev(unsigned int a)
 }
 #endif
 
+// Convert the per-color flags to per-band. After this
+// bit ncolors-n is set if mag[n] was obtained by extrapolation
+// (where the least significant bit is n=0)
+__device__ inline uint bandFlags(uint flag, const os_photometry_data &lt)
+{
+	bool fl = false;
+	for(int i = lt.bidx-1; i >= 0; i--)
+	{
+		uint mask = 1 << i;
+		fl = fl || (flag & mask);	// set fl=true if i-th flag is set
+		flag |= fl << i;		// set i-th flag to fl
+	}
+	fl = false;
+	for(int i = lt.bidx; i < lt.ncolors; i++)
+	{
+		uint mask = 1 << i;
+		fl = fl || (flag & mask);	// set fl=true if i-th flag is set
+		flag |= fl << i << 1;		// set (i+1)-st flag to fl
+	}
+	flag &= ~(1 << lt.bidx);			// clear bootstrap band's flag (bootstrapped band is, by definition, not extrapolated)
+	flag = __brev(flag);				// reverse the order of the flags
+	flag >>= (8*sizeof(flag) - lt.ncolors - 1);
+	return flag;
+}
+
+#if BUILD_FOR_CPU
+//
+// Batched CPU version of os_photometry_kernel. Processes the stars in
+// blocks of PHOTOMETRY_BATCH, sampling the isochrone textures four stars
+// at a time (cuxTexSampler::sample) and converting between magnitudes
+// and luminosities with exp10_batch/log10_batch. The colors and flags are
+// identical to those of the scalar kernel; the magnitudes agree to within
+// the accuracy of the exp10/log10 approximations (see module_lib.h).
+// Set batched = 1 in the photometry module config to use it (by default,
+// the scalar kernel runs, reproducing the catalogs of earlier versions).
+//
+static const int PHOTOMETRY_BATCH = 64;
+
+void os_photometry_batch(uint32_t begin, uint32_t end, bit_map &applyToComponents, gcfloat_t &Am, gcint_t &flags, gcfloat_t &DM, gcfloat_t &Mr, int nabsmag, gcfloat_t &mags, gcfloat_t &FeH, gcint_t &comp, gcint_t &hidden)
+{
+	typedef cuxTextureReference<float4, 2, cudaReadModeElementType> texref;
+	texref *color[4]  = { &color0, &color1, &color2, &color3 };
+	texref *cflags[4] = { &cflags0, &cflags1, &cflags2, &cflags3 };
+
+	const os_photometry_data &lt = os_photometry_params;
+	const int ncolors = lt.ncolors, ntex = (ncolors + 3) / 4;
+	const int B = PHOTOMETRY_BATCH;
+
+	uint32_t rows[B];		// rows of stars in the block
+	uint flag[B];			// per-color extrapolation flags of each star
+	int act[B];			// stars (indices into rows[]) with the current system component present
+	float fFeH[B], fMr[B];		// ... and their metallicities and absolute magnitudes
+	float4 clr[B], f[B];		// texture samples
+	float c[os_photometry_data::N_REDDENING-1][B];	// colors, [color][star]
+	float x[B], L[B];
+
+	uint32_t row = begin;
+	while(row < end)
+	{
+		// collect the stars to process
+		int n = 0;
+		for(; row < end && n != B; row++)
+		{
+			if(hidden(row)) { continue; }
+			if(!applyToComponents.isset(comp(row))) { continue; }
+
+			rows[n] = row;
+			flag[n] = 0;
+			act[n] = n;
+			n++;
+		}
+
+		// sum up the luminosities of system components (see the scalar kernel)
+		int nact = n;
+		for(int syscomp = 0; syscomp < nabsmag && nact; syscomp++)
+		{
+			// as in the scalar kernel, a star's first absent component ends its system
+			int m = 0;
+			for(int j = 0; j != nact; j++)
+			{
+				int k = act[j];
+				float M = Mr(rows[k], syscomp);
+				if(M >= ABSMAG_NOT_PRESENT) { continue; }
+
+				act[m] = k;
+				fMr[m] = M;
+				fFeH[m] = FeH(rows[k]);
+				m++;
+			}
+			nact = m;
+
+			// get colors of stars with (fFeH, fMr)
+			for(int t = 0; t != ntex; t++)
+			{
+				color[t]->sampler.sample(clr, fFeH, fMr, nact);
+				cflags[t]->sampler.sample(f, fFeH, fMr, nact);
+				for(int i = 4*t; i != 4*t+4 && i != ncolors; i++)
+				{
+					for(int j = 0; j != nact; j++)
+					{
+						c[i][j] = (&clr[j].x)[i - 4*t];
+						flag[act[j]] |= setFlag((&f[j].x)[i - 4*t], i);
+					}
+				}
+			}
+
+			// compute the luminosities in all bands
+			for(int b = 0; b <= ncolors; b++)
+			{
+				for(int j = 0; j != nact; j++)
+				{
+					float M = fMr[j];
+					if(b < (int)lt.bidx) { for(int i=b;       i != lt.bidx; i++) { M += c[i][j]; } }
+					if(b > (int)lt.bidx) { for(int i=lt.bidx; i != b;    i++)    { M -= c[i][j]; } }
+					x[j] = -0.4f*M;
+				}
+				exp10_batch(L, x, nact);
+				for(int j = 0; j != nact; j++)
+				{
+					uint32_t r = rows[act[j]];
+					if(syscomp) { L[j] += mags(r, b); }
+					mags(r, b) = L[j];
+				}
+			}
+		}
+
+		for(int k = 0; k != n; k++)
+		{
+			flags(rows[k]) = bandFlags(flag[k], lt);
+		}
+
+		// convert luminosity to apparent magnitude of the system
+		// taking extinction and reddening into account
+		for(int b = 0; b <= ncolors; b++)
+		{
+			for(int k = 0; k != n; k++) { x[k] = mags(rows[k], b); }
+			log10_batch(L, x, n);
+			for(int k = 0; k != n; k++)
+			{
+				uint32_t r = rows[k];
+				float msys = DM(r) + -2.5f * L[k];
+				mags(r, b) = msys + Am(r) * lt.reddening[b];
+			}
+		}
+	}
+}
+#endif
+
 KERNEL(
 	ks, 0,
 	os_photometry_kernel(otable_ks ks, bit_map applyToComponents, gcfloat_t Am, gcint_t flags, gcfloat_t DM, gcfloat_t Mr, int nabsmag, gcfloat_t mags, gcfloat_t FeH, gcint_t comp, gcint_t hidden),
@@ -91,6 +239,14 @@ KERNEL(
 	(ks, applyToComponents, Am, flags, DM, Mr, nabsmag, mags, FeH, comp, hidden)
 )
 {
+#if BUILD_FOR_CPU
+	if(os_photometry_params.batched)
+	{
+		os_photometry_batch(ks.row_begin(), ks.row_end(), applyToComponents, Am, flags, DM, Mr, nabsmag, mags, FeH, comp, hidden);
+		return;
+	}
+#endif
+
 	os_photometry_data &lt = os_photometry_params;
 	float *c = ks.sharedMemory<float>();
 
@@ -133,26 +289,7 @@ KERNEL(
 			}
 		}
 
-		// convert the per-color flags to per-band. After this
-		// bit ncolors-n is set if mag[n] was obtained by extrapolation
-		// (where the least significant bit is n=0)
-		bool fl = false;
-		for(int i = lt.bidx-1; i >= 0; i--)
-		{
-			uint mask = 1 << i;
-			fl = fl || (flag & mask);	// set fl=true if i-th flag is set
-			flag |= fl << i;		// set i-th flag to fl
-		}
-		fl = false;
-		for(int i = lt.bidx; i < lt.ncolors; i++)
-		{
-			uint mask = 1 << i;
-			fl = fl || (flag & mask);	// set fl=true if i-th flag is set
-			flag |= fl << i << 1;		// set (i+1)-st flag to fl
-		}
-		flag &= ~(1 << lt.bidx);			// clear bootstrap band's flag (bootstrapped band is, by definition, not extrapolated)
-		flag = __brev(flag);				// reverse the order of the flags
-		flag >>= (8*sizeof(flag) - lt.ncolors - 1);
+		flag = bandFlags(flag, lt);
 		flags(row) = flag;
 
 
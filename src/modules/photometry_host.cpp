@@ -26,7 +26,11 @@
 #include "spline.h"
 #include "analysis.h"
 #include "io.h"
+#include "skygen.h"
+#include "binarystream.h"
 #include <fstream>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <astro/system/config.h>
 #include <astro/useall.h>
@@ -67,6 +71,11 @@ protected:
 	typedef boost::shared_ptr<cuxTextureBinder> tbptr;
 	void bind_isochrone(std::list<tbptr> &binders, cuxTextureReferenceInterface &texc, cuxTextureReferenceInterface &texf, int idx);
 
+	void resample_isochrones(std::map<double, std::vector<Mr2col> > &v, double FeH0, double dFeH, int nFeH, double Mr0, double dMr, int nMr, std::vector<double> &fraction_extrapolated);
+	uint64_t isochrones_key(const std::map<double, std::vector<Mr2col> > &v, double dFeH, double dMr);
+	bool load_isochrones(const std::string &fn, uint64_t key, std::vector<double> &fraction_extrapolated);
+	void store_isochrones(const std::string &fn, uint64_t key, const std::vector<double> &fraction_extrapolated);
+
 public:
 	virtual size_t process(otable &in, size_t begin, size_t end, rng_t &rng);
 	virtual bool construct(const Config &cfg, otable &t, opipeline &pipe);
@@ -76,6 +85,7 @@ public:
 	os_photometry() : osink()
 	{
 		FOR(0, N_REDDENING) { reddening[i] = 1.f; }
+		batched = 0;
 
 		req.insert("FeH");
 	}
@@ -142,6 +152,11 @@ bool os_photometry::construct(const Config &cfg, otable &t, opipeline &pipe)
 		if(!(ss >> reddening[i])) { break; }
 	}
 
+	// use the batched CPU kernel (faster, but its magnitudes differ from the scalar kernel's by up to ~1e-5 mag)
+	int batch;
+	cfg.get(batch, "batched", 0);
+	batched = batch != 0;
+
 #if 0
 	// load isochrone texture sampling parameters
 	float FeH0, FeH1, dFeH, Mr0, Mr1, dMr;
@@ -230,11 +245,9 @@ bool os_photometry::construct(const Config &cfg, otable &t, opipeline &pipe)
 	}
 #endif
 
-	// compute the needed texture size, and the texture coordinates
+	// compute the needed texture size (see resample_isochrones() for texture coordinates)
 	int nFeH = (int)((FeH1-FeH0)/dFeH + 1);	// +1 pads it a little, to ensure FeH1 gets covered
 	int nMr  = (int)((Mr1 -Mr0) /dMr  + 1);
-	float2 tcFeH = texcoord_from_range(0, nFeH, FeH0, FeH0 + nFeH*dFeH);
-	float2 tcMr  = texcoord_from_range(0, nMr,   Mr0,  Mr0 +  nMr*dMr);
 
 //	MLOG(verb1) << "Photometry: " << bandset2 << " for components " << applyToComponents << (!internalPhotosys ? " (" + fname + ")" : "") << "   ## " << instanceName();
 	MLOG(verb1) << "Photometry: " << bandset2 << " ("
@@ -250,6 +263,49 @@ bool os_photometry::construct(const Config &cfg, otable &t, opipeline &pipe)
 	MLOG(verb2) << bandset2 << ":    " << absbband << "0, " << absbband << "1, d(" << absbband << ") = " << Mr0 << ", " << Mr1 << ", " << dMr << ".";
 	MLOG(verb2) << bandset2 << ":    FeH0, FeH1, dFeH = " << FeH0 << ", " << FeH1 << ", " << dFeH << ".";
 
+	// resample the isochrones to textures, or load them from the cache
+	// if they've been resampled before with identical inputs
+	std::string cacheDir, cacheFile;
+	cfg.get(cacheDir, "isochroneCache", "");
+	bool cached = false;
+	uint64_t key = 0;
+	std::vector<double> fraction_extrapolated(ncolors, 0.);
+	if(!cacheDir.empty())
+	{
+		mkdir(cacheDir.c_str(), 0777);	// it's OK if it already exists
+		key = isochrones_key(v, dFeH, dMr);
+
+		char hex[17];
+		sprintf(hex, "%016llx", (unsigned long long)key);
+		cacheFile = cacheDir + "/isochrones." + hex + ".bin";
+
+		cached = load_isochrones(cacheFile, key, fraction_extrapolated);
+		if(cached) { MLOG(verb1) << bandset2 << ": Resampled isochrones loaded from cache (" << cacheFile << ")."; }
+	}
+	if(!cached)
+	{
+		resample_isochrones(v, FeH0, dFeH, nFeH, Mr0, dMr, nMr, fraction_extrapolated);
+		if(!cacheFile.empty())
+		{
+			store_isochrones(cacheFile, key, fraction_extrapolated);
+		}
+	}
+
+	MLOG(verb2) << bandset2 << ":    grid size = " << nFeH << " x " << nMr << " (" << isochrones[0].memsize() << " bytes).";
+	MLOG(verb2) << bandset2 << ":    extrapolation fractions = " << fraction_extrapolated;
+
+	return true;
+}
+
+//
+// Resample the color(Mr, FeH) tables in v to isochrone and extrapolation
+// flag textures with nFeH x nMr texels, starting at (FeH0, Mr0).
+//
+void os_photometry::resample_isochrones(std::map<double, std::vector<Mr2col> > &v, double FeH0, double dFeH, int nFeH, double Mr0, double dMr, int nMr, std::vector<double> &fraction_extrapolated)
+{
+	float2 tcFeH = texcoord_from_range(0, nFeH, FeH0, FeH0 + nFeH*dFeH);
+	float2 tcMr  = texcoord_from_range(0, nMr,   Mr0,  Mr0 +  nMr*dMr);
+
 	// construct col(Mr) splines for each FeH line present in the input.
 	// The map s will hold nband splines giving color(Mr) at fixed FeH (FeH is the key).
 	std::map<double, colsplines> s;	// s[FeH] -> (colors)=spline(Mr)
@@ -284,7 +340,6 @@ bool os_photometry::construct(const Config &cfg, otable &t, opipeline &pipe)
 	std::vector<double>  vcol(s.size());			// this will hold the knots of col(FeH) spline
 	std::vector<double> vecol(s.size());			// will be set to 1 if the corresponding color knot was extrapolated, 0 otherwise
 	int compidx = -1;
-	std::vector<double> fraction_extrapolated(ncolors, 0.);	// collecting statistics: how many points in (FeH,Mr) grid had to be extrapolated
 	FORj(ic, 0, ncolors)
 	{
 		//
@@ -342,13 +397,106 @@ bool os_photometry::construct(const Config &cfg, otable &t, opipeline &pipe)
 
 		fraction_extrapolated[ic] /= nFeH*nMr;
 	}
+}
 
-	MLOG(verb2) << bandset2 << ":    grid size = " << nFeH << " x " << nMr << " (" << isochrones[0].memsize() << " bytes).";
-	MLOG(verb2) << bandset2 << ":    extrapolation fractions = " << fraction_extrapolated;
+//
+// Hash of all inputs that resample_isochrones() depends on: the color
+// tables, and the sampling intervals (the texture bounds follow from these)
+//
+uint64_t os_photometry::isochrones_key(const std::map<double, std::vector<Mr2col> > &v, double dFeH, double dMr)
+{
+	skygenHash h;
+	h.add(ncolors);
+	h.add(dFeH); h.add(dMr);
+	FOREACH(v)
+	{
+		h.add(i->first);
+		FOREACHj(j, i->second)
+		{
+			h.add(j->Mr);
+			h.add(j->c, sizeof(j->c[0])*ncolors);
+		}
+	}
+	return h.h;
+}
+
+static const int ISOCHRONE_CACHE_MAGIC = 0x6f734963;	// "cIso"
+static const int ISOCHRONE_CACHE_VERSION = 1;
 
+//
+// Load the isochrone textures from file fn. Returns false if the file
+// doesn't exist or has been computed for a different key.
+//
+bool os_photometry::load_isochrones(const std::string &fn, uint64_t key, std::vector<double> &fraction_extrapolated)
+{
+	std::ifstream f(fn.c_str(), std::ios::binary);
+	if(!f) { return false; }
+	ibinarystream in(f, fn);
+
+	int magic, version, ncolors2, ntex, nFeH, nMr;
+	uint64_t key2;
+	float2 tcFeH, tcMr;
+	in >> magic >> version >> key2 >> ncolors2 >> ntex >> nFeH >> nMr >> tcFeH >> tcMr;
+	if(!f || magic != ISOCHRONE_CACHE_MAGIC || version != ISOCHRONE_CACHE_VERSION || key2 != key ||
+		ncolors2 != (int)ncolors || ntex != (int)(ncolors + 3) / 4)
+	{
+		MLOG(verb1) << "WARNING: Ignoring incompatible isochrone cache file " << fn << ".";
+		return false;
+	}
+
+	in.read((char *)&fraction_extrapolated[0], sizeof(fraction_extrapolated[0])*ncolors);
+	std::vector<cuxTexture<float4, 2> > iso, ef;
+	FOR(0, 2*ntex)
+	{
+		cuxTexture<float4, 2> tex(nFeH, nMr, tcFeH, tcMr);
+		hptr<float4, 3> hp = tex;
+		FORj(m, 0, nMr) { in.read((char *)hp.ptr + m*hp.extent[0], nFeH*sizeof(float4)); }
+
+		(i < ntex ? iso : ef).push_back(tex);
+	}
+
+	if(!f)
+	{
+		MLOG(verb1) << "WARNING: Ignoring truncated isochrone cache file " << fn << ".";
+		return false;
+	}
+	isochrones.swap(iso);
+	eflags.swap(ef);
 	return true;
 }
 
+//
+// Store the isochrone textures to file fn. The file is written under a
+// temporary name and renamed, so concurrent runs never see a partially
+// written cache.
+//
+void os_photometry::store_isochrones(const std::string &fn, uint64_t key, const std::vector<double> &fraction_extrapolated)
+{
+	std::string tmpfn = fn + ".tmp." + str(getpid());
+	{
+		std::ofstream f(tmpfn.c_str(), std::ios::binary);
+		obinarystream out(f, tmpfn);
+
+		int ntex = isochrones.size(), nFeH = isochrones[0].extent(0), nMr = isochrones[0].extent(1);
+		out << ISOCHRONE_CACHE_MAGIC << ISOCHRONE_CACHE_VERSION << key << (int)ncolors << ntex << nFeH << nMr;
+		out << isochrones[0].coords[0] << isochrones[0].coords[1];
+		out.write((const char *)&fraction_extrapolated[0], sizeof(fraction_extrapolated[0])*ncolors);
+		FOR(0, 2*ntex)
+		{
+			hptr<float4, 3> hp = i < ntex ? isochrones[i] : eflags[i - ntex];
+			FORj(m, 0, nMr) { out.write((const char *)hp.ptr + m*hp.extent[0], nFeH*sizeof(float4)); }
+		}
+
+		if(!f)
+		{
+			MLOG(verb1) << "WARNING: Failed to write isochrone cache file " << tmpfn << ".";
+			unlink(tmpfn.c_str());
+			return;
+		}
+	}
+	rename(tmpfn.c_str(), fn.c_str());
+}
+
 // helper for os_photometry::process()
 inline void os_photometry::bind_isochrone(std::list<tbptr> &binders, cuxTextureReferenceInterface &texc, cuxTextureReferenceInterface &texf, int idx)
 {
@@ -78,7 +78,7 @@ namespace multiplesAlgorithms
 	}
 
 	KERNEL(
-		ks, 3*4,
+		ks, gpu_rng_t::state_bytes(),
 		os_unresolvedMultiples_kernel(otable_ks ks, bit_map applyToComponents, gpu_rng_t rng, int nabsmag, cfloat_t::gpu_t M, cfloat_t::gpu_t Msys, cint_t::gpu_t ncomp, cint_t::gpu_t comp, cint_t::gpu_t hidden, multiplesAlgorithms::algo algo),
 		os_unresolvedMultiples_kernel,
 		(ks, applyToComponents, rng, nabsmag, M, Msys, ncomp, comp, hidden, algo)
@@ -93,6 +93,7 @@ namespace multiplesAlgorithms
 		for(uint32_t row = ks.row_begin(); row < ks.row_end(); row++)
 		{
 			if(hidden(row)) { continue; }
+			rng.seek(row);
 
 			int cmp = comp(row);
 			if(!applyToComponents.isset(cmp)) { continue; }
@@ -34,6 +34,8 @@
 #include <astro/useall.h>
 
 #include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <deque>
 
 ///////////////////////////////////////////////////////////////////////
 // Component map implementation
@@ -207,6 +209,7 @@ class os_textout : public osink
 	public:
 		virtual size_t process(otable &in, size_t begin, size_t end, rng_t &rng);
 		virtual bool construct(const Config &cfg, otable &t, opipeline &pipe);
+		virtual void finish() { out.close(); }
 		//virtual int priority() { return PRIORITY_OUTPUT; }	// ensure this stage has the least priority
 		virtual double ordering() const { return ord_output; }
 		virtual const std::string &name() const { static std::string s("textout"); return s; }
@@ -310,16 +313,52 @@ class os_countsMap : public osink
 		{
 			int X, Y, map;
 			beam(int X_ = 0, int Y_ = 0, int map_ = 0) : X(X_), Y(Y_), map(map_) {}
-			bool operator <(const beam &a) const
-			{
-				return X < a.X ||
-					X == a.X && Y < a.Y ||
-					X == a.X && Y == a.Y && map < a.map;
-			}
 		};
-		typedef std::map<beam, std::vector<int> > counts_map_t;
-		counts_map_t countsX;
-		std::vector<int> &get_z_array(counts_map_t &counts, const beam &b) const;
+
+		// Index of the (X, Y, map) cell. Increasing indices are in the
+		// order of increasing X, Y, map (the order of the output).
+		uint64_t cell(const beam &b) const { return ((uint64_t)b.X * n_y + b.Y) * 2 + b.map; }
+		beam cell_beam(uint64_t c) const { return beam((int)(c / 2 / n_y), (int)(c / 2 % n_y), (int)(c % 2)); }
+
+	public:
+		// Flat histogram of counts: an open-addressing (linear probing)
+		// hash table, keyed by cell index. Each cell has n_z*z_width
+		// counts, stored contiguously in 'counts'.
+		struct counts_table
+		{
+			static const uint64_t EMPTY = (uint64_t)-1;
+
+			size_t zsize;			// counts per cell
+			size_t nused;			// cells in use
+			std::vector<uint64_t> keys;	// cell index in each slot (or EMPTY)
+			std::vector<int> counts;	// zsize counts per slot
+
+			counts_table(size_t zsize_ = 0) : zsize(zsize_), nused(0) {}
+
+			int *get(uint64_t cell);		// counts of the cell (zero-initialized, if new)
+			void add(const counts_table &t);	// add the counts of t to this table
+			size_t get_cells(std::vector<std::pair<uint64_t, const int *> > &cells) const;	// cells in use, sorted by index
+
+		protected:
+			size_t find_slot(uint64_t cell) const;	// slot holding the cell, or the empty slot where it goes
+			void grow();
+		};
+
+	protected:
+		counts_table countsX;
+
+		// Per-thread bins. The rows of each batch are split into
+		// shards.size() contiguous ranges, with range k binned into
+		// shards[k] (see mt_binner). Folded into countsX whenever
+		// together they hold more cells than countsX (so the shards
+		// take about as much memory as the map itself at most, or
+		// minShardCells cells), and at the end of the run.
+		static const size_t minShardCells = 1 << 16;
+		std::vector<counts_table> shards;
+		std::vector<long long> shard_total;
+		void fold_shards();
+		void reduce_shards();
+		void cumulate_coadds(int *zbins) const;
 
 		long long m_total;
 		bool m_equalarea;
@@ -328,10 +367,10 @@ class os_countsMap : public osink
 		lambert proj[2];
 
 		void get_columns(otable &t, cdouble_t::host_t &xy, cfloat_t::host_t &z, cint_t::host_t &hidden) const;
-		size_t threaded_process(counts_map_t &counts, long long &total, 
+		size_t threaded_process(counts_table &counts, long long &total, 
 			cdouble_t::host_t xy, cfloat_t::host_t z, cint_t::host_t hidden,
-			size_t from, size_t to, rng_t &rng, int startoffs, int stride) const;
-		friend class mt_binner;
+			size_t from, size_t to) const;
+		friend struct mt_binner;
 
 		void create_dense_output_array();
 	public:
@@ -373,7 +412,7 @@ void os_countsMap::create_dense_output_array()
 	// (requested by ZI so that he can easily add results from
 	// different simulations in SM)
 
-	countsX.clear();
+	countsX = counts_table(n_z*z_width);
 
 	beam b;
 	for(b.X = 0; b.X != n_x; b.X++)
@@ -381,21 +420,80 @@ void os_countsMap::create_dense_output_array()
 		for(b.Y = 0; b.Y != n_y; b.Y++)
 		{
 			// this will implicitly initialize the array to zero
-			get_z_array(countsX, b);
+			countsX.get(cell(b));
 		}
 	}
 }	
 
-std::vector<int> &os_countsMap::get_z_array(counts_map_t &counts, const beam &b) const
+const uint64_t os_countsMap::counts_table::EMPTY;
+
+size_t os_countsMap::counts_table::find_slot(uint64_t cell) const
+{
+	uint64_t h = cell * 0x9E3779B97F4A7C15ULL;
+	const size_t mask = keys.size() - 1;
+	size_t s = (h ^ (h >> 32)) & mask;
+	while(keys[s] != EMPTY && keys[s] != cell) { s = (s + 1) & mask; }
+	return s;
+}
+
+void os_countsMap::counts_table::grow()
+{
+	std::vector<uint64_t> okeys;
+	std::vector<int> ocounts;
+	okeys.swap(keys);
+	ocounts.swap(counts);
+
+	size_t n = okeys.empty() ? 1024 : 2*okeys.size();
+	keys.assign(n, EMPTY);
+	counts.assign(n*zsize + 1, 0);
+	FOR(0, okeys.size())
+	{
+		if(okeys[i] == EMPTY) { continue; }
+
+		size_t s = find_slot(okeys[i]);
+		keys[s] = okeys[i];
+		std::copy(&ocounts[i*zsize], &ocounts[i*zsize] + zsize, &counts[s*zsize]);
+	}
+}
+
+int *os_countsMap::counts_table::get(uint64_t cell)
+{
+	// keep the load factor below 1/2
+	if(2*(nused + 1) > keys.size()) { grow(); }
+
+	size_t s = find_slot(cell);
+	if(keys[s] == EMPTY)
+	{
+		keys[s] = cell;
+		nused++;
+	}
+	return &counts[s*zsize];
+}
+
+void os_countsMap::counts_table::add(const counts_table &t)
 {
-	std::vector<int> &c = counts[b];
-	bool first = c.empty();
-	if(c.empty())
+	ASSERT(t.zsize == zsize);
+	FOR(0, t.keys.size())
 	{
-		c.resize(n_z*z_width);
-		memset(&c[0], 0, sizeof(*&c[0])*c.size());
+		if(t.keys[i] == EMPTY) { continue; }
+
+		int *c = get(t.keys[i]);
+		const int *tc = &t.counts[i*zsize];
+		FORj(k, 0, zsize) { c[k] += tc[k]; }
+	}
+}
+
+size_t os_countsMap::counts_table::get_cells(std::vector<std::pair<uint64_t, const int *> > &cells) const
+{
+	cells.clear();
+	cells.reserve(nused);
+	FOR(0, keys.size())
+	{
+		if(keys[i] == EMPTY) { continue; }
+		cells.push_back(std::make_pair(keys[i], &counts[i*zsize]));
 	}
-	return c;
+	std::sort(cells.begin(), cells.end());
+	return cells.size();
 }
 
 void os_countsMap::get_columns(otable &t, cdouble_t::host_t &xy, cfloat_t::host_t &z, cint_t::host_t &hidden) const
@@ -415,15 +513,18 @@ void os_countsMap::get_columns(otable &t, cdouble_t::host_t &xy, cfloat_t::host_
 	}
 };
 
-size_t os_countsMap::threaded_process(counts_map_t &counts, long long &total, 
+size_t os_countsMap::threaded_process(counts_table &counts, long long &total, 
 	cdouble_t::host_t xy,
 	cfloat_t::host_t z,
 	cint_t::host_t hidden,
-	size_t from, size_t to, rng_t &rng, int startoffs, int stride) const
+	size_t from, size_t to) const
 {
 	// bin
 	size_t nserialized = 0;
-	for(size_t row = from + startoffs; row < to; row += stride)
+	const size_t zsize = counts.zsize;
+	uint64_t lastCell = counts_table::EMPTY;	// stars come in spatially coherent runs; avoid the
+	int *c = NULL;					// lookup if this one's in the same cell as the last one
+	for(size_t row = from; row < to; row++)
 	{
 		if(hidden && hidden(row)) { continue; }
 
@@ -445,14 +546,19 @@ size_t os_countsMap::threaded_process(counts_map_t &counts, long long &total,
 
 		// fetch the correct bin (note there are n_d*d_width elements of the pencil beam,
 		// where d_width is usually the number of bands)
-		std::vector<int> &c = get_z_array(counts, b);
+		uint64_t cl = cell(b);
+		if(cl != lastCell)
+		{
+			c = counts.get(cl);
+			lastCell = cl;
+		}
 
 		// bin
 		for(int i = 0; i != z_mag_width; i++)
 		{
 			int Z = find_bin(z(row, i), z0, dz, n_z);
 			int idx = Z*z_width + i;
-			assert(idx >= 0 && idx < c.size());
+			assert(idx >= 0 && idx < zsize);
 			c[idx]++;
 			total++;
 		}
@@ -472,15 +578,14 @@ size_t os_countsMap::threaded_process(counts_map_t &counts, long long &total,
 				magCut = std::min(magCut, mag);
 			}
 
-			// This object is to be measured in all stacks deeper than magCut
+			// This object is to be measured in all stacks deeper than magCut. Here we
+			// only count it in the magCut bin; the cumulative counts are computed
+			// (by cumulate_coadds()) when the map is written out.
 			int bin = find_bin(magCut, z0, dz, n_z);
 //			std::cerr << bin << " " << z0 << " " << dz << "\n";
-			for(int Z = bin; Z < n_z; Z++)
-			{
-				int idx = Z*z_width + z_mag_width + coadd;
-				assert(idx >= 0 && idx < c.size());
-				c[idx]++;
-			}
+			int idx = bin*z_width + z_mag_width + coadd;
+			assert(idx >= 0 && idx < zsize);
+			c[idx]++;
 
 			// ---
 //			std::cerr << "magCut = " << magCut << "\n";
@@ -497,34 +602,34 @@ size_t os_countsMap::threaded_process(counts_map_t &counts, long long &total,
 	return nserialized;
 }
 
+//
+// Bins the k-th of n contiguous row ranges of a batch into the k-th
+// shard, for each k in [begin, end) (executed on the CPU thread pool).
+//
 struct mt_binner
 {
-	const os_countsMap &ctmap;
-	
-	// will fill out and returns
-	os_countsMap::counts_map_t counts;
-	long long m_total;
-	size_t nserialized;
-
-	// input parameters
-	size_t from, to;
-	rng_t &rng;
-	int start, stride;
+	os_countsMap &ctmap;
 	cdouble_t::host_t xy;
 	cfloat_t::host_t z;
 	cint_t::host_t hidden;
+	size_t from, to;
+	std::vector<size_t> &nserialized;	// rows binned from each range (output)
 
-	mt_binner(const os_countsMap &ctmap_, otable &t_, size_t from_, size_t to_, rng_t &rng_, int start_, int stride_)
-		: ctmap(ctmap_), from(from_), to(to_), rng(rng_), start(start_), stride(stride_)
+	mt_binner(os_countsMap &ctmap_, otable &t, size_t from_, size_t to_, std::vector<size_t> &nserialized_)
+		: ctmap(ctmap_), from(from_), to(to_), nserialized(nserialized_)
 	{
-		m_total = 0;
-		nserialized = 0;
-		ctmap.get_columns(t_, xy, z, hidden);
+		ctmap.get_columns(t, xy, z, hidden);
 	}
 
-	void operator()()
+	void operator()(uint32_t begin, uint32_t end)
 	{
-		nserialized = ctmap.threaded_process(counts, m_total, xy, z, hidden, from, to, rng, start, stride);
+		const size_t n = ctmap.shards.size();
+		FORj(k, begin, end)
+		{
+			size_t r0 = from + (to - from) * k / n;
+			size_t r1 = from + (to - from) * (k + 1) / n;
+			nserialized[k] = ctmap.threaded_process(ctmap.shards[k], ctmap.shard_total[k], xy, z, hidden, r0, r1);
+		}
 	}
 };
 
@@ -532,46 +637,56 @@ size_t os_countsMap::process(otable &t, size_t from, size_t to, rng_t &rng)
 {
 	swatch.start();
 
-#if 1
-	// launch NCORE threads to do the binning
-	typedef boost::shared_ptr<mt_binner> mtbp_t;
-	std::vector<mtbp_t> kernels(boost::thread::hardware_concurrency());
-	boost::thread_group threads;
+	// bin on the CPU thread pool, one contiguous range of rows per shard
+	std::vector<size_t> nbinned(shards.size(), 0);
+	cpu_kernel_pool::run(shards.size(), mt_binner(*this, t, from, to, nbinned));
+
+	size_t nserialized = 0;
+	FOREACH(nbinned) { nserialized += *i; }
 
-	// bin in threads
-	FOR(0, kernels.size())
+	size_t nused = 0;
+	FOREACH(shards) { nused += i->nused; }
+	if(nused > std::max(countsX.nused, (size_t)minShardCells))
 	{
-		kernels[i] = mtbp_t(new mt_binner(*this, t, from, to, rng, i, kernels.size()));
-		threads.create_thread(boost::ref(*kernels[i]));
+		fold_shards();
 	}
-	threads.join_all();
-	
-	// accumulate the results
-	int nserialized = 0;
-	FOREACHj(kp, kernels)
+
+	swatch.stop();
+
+	return nserialized;
+}
+
+void os_countsMap::cumulate_coadds(int *zbins) const
+{
+	// turn the differential coadd counts into cumulative ones (the
+	// number of objects detected in each coadd to a given depth)
+	FORj(coadd, 0, coadd_offsets.size())
 	{
-		mt_binner &k = **kp;
-		FOREACH(k.counts)
+		int *c = zbins + z_mag_width + coadd;
+		for(int Z = 1; Z < n_z; Z++)
 		{
-			std::vector<int> &c = get_z_array(countsX, i->first);
-			FORj(j, 0, c.size())
-			{
-				c[j] += i->second[j];
-			}
+			c[Z*z_width] += c[(Z-1)*z_width];
 		}
-		m_total += k.m_total;
-		nserialized += k.nserialized;
 	}
-#else
-	cdouble_t::host_t xy;
-	cfloat_t::host_t z;
-	cint_t::host_t hidden;
-	get_columns(t, xy, z, hidden);
-	int nserialized = threaded_process(countsX, m_total, xy, z, hidden, from, to, rng, 0, 1);
-#endif
-	swatch.stop();
+}
 
-	return nserialized;
+void os_countsMap::fold_shards()
+{
+	FOR(0, shards.size())
+	{
+		countsX.add(shards[i]);
+		m_total += shard_total[i];
+
+		shards[i] = counts_table(n_z*z_width);
+		shard_total[i] = 0;
+	}
+}
+
+void os_countsMap::reduce_shards()
+{
+	fold_shards();
+	shards.clear();
+	shard_total.clear();
 }
 
 bool os_countsMap::runtime_init(otable &t)
@@ -580,6 +695,9 @@ bool os_countsMap::runtime_init(otable &t)
 
 	z_mag_width = t.col<float>(z_column).width();
 	z_width = z_mag_width + coadd_offsets.size();
+	countsX = counts_table(n_z*z_width);
+	shards.assign(cpu_kernel_pool::nthreads(), counts_table(n_z*z_width));
+	shard_total.assign(shards.size(), 0);
 
 	if(dense_output)
 		create_dense_output_array();
@@ -683,6 +801,8 @@ bool os_countsMap::construct(const Config &cfg, otable &t, opipeline &pipe)
 
 os_countsMap::~os_countsMap()
 {
+	reduce_shards();
+
 	// header
 	if(m_equalarea)
 	{
@@ -712,18 +832,23 @@ os_countsMap::~os_countsMap()
 
 	// write out the (sparse) binned array into the text output file
 	long long total = 0;
-	FOREACHj(XY, countsX)
+	std::vector<std::pair<uint64_t, const int *> > cells;
+	countsX.get_cells(cells);
+	std::vector<int> zbins;
+	FOREACHj(XY, cells)
 	{
-		double x = x0 + dx * XY->first.X;
-		double y = y0 + dy * XY->first.Y;
-		int map = XY->first.map;
-		std::vector<int> &zbins = XY->second;
+		beam b = cell_beam(XY->first);
+		double x = x0 + dx * b.X;
+		double y = y0 + dy * b.Y;
+		int map = b.map;
+		zbins.assign(XY->second, XY->second + countsX.zsize);
+		cumulate_coadds(&zbins[0]);
 		double lon, lat;
 		if(m_equalarea)
 		{
 			proj[map].deproject(lon, lat, x, y);
 		}
-		for(int i = 0; i != zbins.size(); i += z_width)
+		for(int i = 0; i != countsX.zsize; i += z_width)
 		{
 			bool hasDatum = false;
 			for(int k = 0; k != z_width; k++)
@@ -764,132 +889,69 @@ os_countsMap::~os_countsMap()
 #include "fitsio2.h"
 
 // in/out ends of the chain
+//
+// FITS output. The visible rows of each batch are packed into per-column
+// buffers (in FITS row-major order) on the pipeline thread, and handed
+// to a background writer thread that appends them to the binary table
+// with one fits_write_col() per column. At most maxQueued packed batches
+// are kept in flight, so output overlaps the generation of the next
+// batch without the memory use growing unbounded.
+//
 class os_fitsout : public osink
 {
 	public:
 		struct coldef
 		{
-			char *data;
 			int width;
 			int elementSize;
-			size_t pitch;
+			int dtype;		// cfitsio datatype code
+		};
+
+		struct batch
+		{
+			long nrows;				// rows in this batch
+			std::vector<std::vector<char> > data;	// packed column data
 		};
 
 	protected:
 		fitsfile *fptr;       /* pointer to the FITS file; defined in fitsio.h */
-		std::vector<iteratorCol> data;
 		std::vector<coldef> columns;
 
 		bool headerWritten;
 		std::string header_def;
-		ticker tick;
+
+		// writer thread state
+		static const size_t maxQueued = 2;
+		boost::thread writer;
+		boost::mutex mx;
+		boost::condition_variable cv;
+		std::deque<boost::shared_ptr<batch> > queue;
+		bool closing;
+		thread_error error;	// exception thrown by the writer thread (rethrown by process() or finish())
+		long nwritten;		// rows written to the file so far
 
 		void createOutputTable(otable &t);
+		void pack(batch &b, otable &t, const std::vector<size_t> &rows);
+		void write(const batch &b);
+		void run_writer();
+		void stop_writer();
+		void close();
 
 	public:
 		virtual size_t process(otable &in, size_t begin, size_t end, rng_t &rng);
 		virtual bool construct(const Config &cfg, otable &t, opipeline &pipe);
+		virtual void finish() { close(); }
 		//virtual int priority() { return PRIORITY_OUTPUT; }	// ensure this stage has the least priority
 		virtual double ordering() const { return ord_output; }
 		virtual const std::string &name() const { static std::string s("fitsout"); return s; }
 		virtual const std::string &type() const { static std::string s("output"); return s; }
 
-		os_fitsout() : osink(), headerWritten(false), tick(-1), fptr(NULL)
+		os_fitsout() : osink(), headerWritten(false), fptr(NULL), closing(false), nwritten(0)
 		{
 		}
 		~os_fitsout();
 };
 
-struct write_fits_rows_state
-{
-	cint_t::host_t hidden;
-	os_fitsout::coldef *columns;
-	int row, to, rowswritten;
-
-	write_fits_rows_state(os_fitsout::coldef *columns_, int from_, int to_)
-	{
-		hidden.reset();
-		rowswritten = 0;
-
-		columns = columns_;
-		row = from_;
-		to = to_;
-	}
-};
-
-int write_fits_rows(long totaln, long offset, long firstn, long nvalues, int narrays, iteratorCol *data,  void *userPointer)
-{
-	write_fits_rows_state &st = *(write_fits_rows_state *)userPointer;
-	os_fitsout::coldef *columns = st.columns;
-	firstn--;		// adjust to 0-based convention
-	firstn -= offset;	// refer to the first row of the otable we're dumping
-
-	// for each column...
-	int orow = st.row;
-	FOR(0, narrays)
-	{
-		os_fitsout::coldef &c = columns[i];
-		char *f = (char *)fits_iter_get_array(data+i);
-		ASSERT(c.width == data[i].repeat);
-
-		// tell cfitsio we have no NULLs
-		memset(f, 0, c.elementSize);
-		f += c.elementSize;
-
-		// for each row...
-		orow = st.row;
-		FORj(row, 0, nvalues)
-		{
-			if(st.hidden)
-			{
-				while(orow != st.to && st.hidden(orow)) { orow++; }	// find next non-hidden row
-			}
-			if(orow == st.to) { break; }				// have we reached the end of the table?
-
-			char *from = c.data + c.elementSize * orow;	// 0th element in this row
-			char *to = f + c.width*c.elementSize*row;
-			// for each vector element in row...
-			FORj(elem, 0, c.width)
-			{
-				char *elemto = to + c.elementSize*elem;
-				char *elemfrom = from + c.pitch*elem;
-				memcpy(
-					elemto,
-					elemfrom,
-					c.elementSize
-				);
-#if 0
-				memset(
-					elemto,
-					'A'+i,
-					c.elementSize
-				);
-				elemto[0] = '0'+(row%10);
-#endif
-#if 0
-				switch(data[i].datatype)
-				{
-					case TFLOAT:
-						std::cerr << *(float*)elemfrom << " ";
-						break;
-					case TDOUBLE:
-						std::cerr << *(double*)elemfrom << " ";
-						break;
-					case TINT:
-						std::cerr << *(int*)elemfrom << " ";
-						break;
-				}
-#endif
-			}
-
-			if(i == 0) { st.rowswritten++; }
-			orow++;
-		}
-	}
-	st.row = orow;
-	return 0;
-}
-
 void os_fitsout::createOutputTable(otable &t)
 {
 	if(headerWritten) { return; }
@@ -907,11 +969,20 @@ void os_fitsout::createOutputTable(otable &t)
 
 	// create the output table
 	char *ttype[tfields], *tform[tfields];
-	data.resize(tfields);
+	columns.resize(tfields);
 	FOR(0, tfields)
 	{
-		coldef c;
-		(const_cast<otable::columndef *>(cols[i]))->rawdataptr(c.elementSize, c.width, c.pitch);
+		coldef &c = columns[i];
+		c.width = cols[i]->ptr.width();
+		c.elementSize = cols[i]->type()->elementSize;
+		switch(cols[i]->type()->fits_tform())
+		{
+			case 'A': c.dtype = TSTRING; break;
+			case 'J': c.dtype = TINT; break;
+			case 'E': c.dtype = TFLOAT; break;
+			case 'D': c.dtype = TDOUBLE; break;
+			default: ASSERT(0);
+		}
 
 		ttype[i] = strdup(cols[i]->getPrimaryName().c_str());
 		asprintf(&tform[i], "%d%c", c.width, cols[i]->type()->fits_tform());
@@ -929,67 +1000,174 @@ void os_fitsout::createOutputTable(otable &t)
 		free(tform[i]);
 	}
 
-	// construct array for cfitsio/Iterator routines
-	columns.resize(tfields);
-	FOR(0, tfields)
+	headerWritten = true;
+}
+
+// gather the given rows of a (vector) column, in FITS (row-major) order
+template<typename T>
+static void pack_fits_column(char *dst, const char *src, size_t pitch, int width, const std::vector<size_t> &rows)
+{
+	T *out = (T *)dst;
+	FOR(0, width)
 	{
-		int dtype;
-		switch(cols[i]->type()->fits_tform())
+		const T *in = (const T *)(src + pitch*i);
+		T *o = out + i;
+		FOREACHj(r, rows) { *o = in[*r]; o += width; }
+	}
+}
+
+void os_fitsout::pack(batch &b, otable &t, const std::vector<size_t> &rows)
+{
+	std::vector<const otable::columndef *> cols;
+	t.getSortedColumnsForOutput(cols);
+	ASSERT(cols.size() == columns.size());
+
+	const size_t n = rows.size();
+	b.nrows = n;
+	b.data.resize(columns.size());
+	FOR(0, columns.size())
+	{
+		const coldef &c = columns[i];
+		const char *src = cols[i]->ptr.get();
+		const size_t pitch = cols[i]->ptr.pitch();
+		std::vector<char> &buf = b.data[i];
+
+		if(c.dtype == TSTRING)
+		{
+			// cfitsio wants an array of NUL-terminated strings
+			buf.assign(n*(c.width+1) + 1, 0);
+			FORj(j, 0, n)
+			{
+				FORj(k, 0, c.width) { buf[j*(c.width+1) + k] = src[pitch*k + rows[j]]; }
+			}
+			continue;
+		}
+
+		buf.resize(n*c.width*c.elementSize + 1);
+		switch(c.elementSize)
 		{
-			case 'A': dtype = TSTRING; break;
-			case 'J': dtype = TINT; break;
-			case 'E': dtype = TFLOAT; break;
-			case 'D': dtype = TDOUBLE; break;
+			case 4: pack_fits_column<uint32_t>(&buf[0], src, pitch, c.width, rows); break;
+			case 8: pack_fits_column<uint64_t>(&buf[0], src, pitch, c.width, rows); break;
 			default: ASSERT(0);
 		}
+	}
+}
+
+void os_fitsout::write(const batch &b)
+{
+	if(b.nrows == 0) { return; }
+
+	// size the table for the whole batch, then write it out one column at a time
+	int status = 0;
+	fits_insert_rows(fptr, nwritten, b.nrows, &status);
+	FOR(0, columns.size())
+	{
+		if(status) { break; }
 
-		fits_iter_set_by_num(&data[i], fptr, i+1, dtype,  OutputCol);
+		const coldef &c = columns[i];
+		char *data = const_cast<char *>(&b.data[i][0]);
+		if(c.dtype == TSTRING)
+		{
+			std::vector<char *> strings(b.nrows);
+			FORj(j, 0, b.nrows) { strings[j] = data + j*(c.width+1); }
+			fits_write_col(fptr, TSTRING, i+1, nwritten+1, 1, b.nrows, &strings[0], &status);
+		}
+		else
+		{
+			fits_write_col(fptr, c.dtype, i+1, nwritten+1, 1, b.nrows*c.width, data, &status);
+		}
+	}
+	if(status)
+	{
+		char msg[FLEN_STATUS];
+		fits_get_errstatus(status, msg);
+		THROW(EIOException, "Error writing FITS output: " + std::string(msg));
 	}
 
-	headerWritten = true;
+	nwritten += b.nrows;
 }
 
-size_t os_fitsout::process(otable &t, size_t from, size_t to, rng_t &rng)
+void os_fitsout::run_writer()
 {
-	ticker tick("Writing output", (int)ceil((to-from)/50.));
+	while(true)
+	{
+		boost::shared_ptr<batch> b;
+		{
+			boost::mutex::scoped_lock lock(mx);
+			while(queue.empty() && !closing) { cv.wait(lock); }
+			if(queue.empty()) { return; }
+			b = queue.front();
+		}
 
-	transformComponentIds(t, from, to);
-	createOutputTable(t);
+		thread_error err;
+		try
+		{
+			write(*b);
+		}
+		catch(...)
+		{
+			err.capture();
+		}
 
-	// Get data pointers from output the table
-	std::vector<const otable::columndef *> cols;
-	t.getSortedColumnsForOutput(cols);
-	FOR(0, columns.size())
+		boost::mutex::scoped_lock lock(mx);
+		queue.pop_front();
+		cv.notify_all();
+		if(!err.empty()) { error = err; queue.clear(); return; }
+	}
+}
+
+void os_fitsout::stop_writer()
+{
 	{
-		coldef &c = columns[i];
-		c.data = (char*)(const_cast<otable::columndef *>(cols[i]))->rawdataptr(c.elementSize, c.width, c.pitch);
+		boost::mutex::scoped_lock lock(mx);
+		closing = true;
+		cv.notify_all();
 	}
+	writer.join();
+}
 
+size_t os_fitsout::process(otable &t, size_t from, size_t to, rng_t &rng)
+{
 	swatch.start();
 
-	// append the (maximum) number of rows we're going to write
-	int status = 0;
-	long nrows;
-	fits_get_num_rows(fptr, &nrows, &status);		ASSERT(status == 0) { fits_report_error(stderr, status); }
-	fits_insert_rows(fptr, nrows, to-from, &status);	ASSERT(status == 0) { fits_report_error(stderr, status); }
+	transformComponentIds(t, from, to);
+	createOutputTable(t);
 
-	// call cfitsio Iterator
-	write_fits_rows_state st(&columns[0], from, to);
+	// collect the rows to write
+	std::vector<size_t> rows;
+	rows.reserve(to - from);
 	if(t.using_column("hidden"))
 	{
-		st.hidden = t.col<int>("hidden");
+		cint_t::host_t hidden = t.col<int>("hidden");
+		FORj(row, from, to) { if(!hidden(row)) { rows.push_back(row); } }
+	}
+	else
+	{
+		FORj(row, from, to) { rows.push_back(row); }
 	}
-	fits_iterate_data(columns.size(), &data[0], nrows, 0, write_fits_rows, &st, &status);	ASSERT(status == 0) { fits_report_error(stderr, status); }
 
-	// truncate any extra rows
-	fits_delete_rows(fptr, nrows + st.rowswritten + 1, to-from-st.rowswritten, &status);	ASSERT(status == 0) { fits_report_error(stderr, status); }
+	boost::shared_ptr<batch> b(new batch);
+	pack(*b, t, rows);
+
+	// hand the batch off to the writer thread, waiting for
+	// space in the queue if necessary
+	{
+		boost::mutex::scoped_lock lock(mx);
+		if(!writer.joinable())
+		{
+			writer = boost::thread(boost::bind(&os_fitsout::run_writer, this));
+		}
+		while(queue.size() >= maxQueued && error.empty()) { cv.wait(lock); }
+		error.rethrow();
+
+		queue.push_back(b);
+		cv.notify_all();
+	}
 
 	swatch.stop();
 	//static bool firstTime = true; if(firstTime) { swatch.reset(); kernelRunSwatch.reset(); firstTime = false; }
 
-	if(status != 0) { fits_report_error(stderr, status); }
-
-	return st.rowswritten;
+	return rows.size();
 }
 
 bool os_fitsout::construct(const Config &cfg, otable &t, opipeline &pipe)
@@ -1000,37 +1178,74 @@ bool os_fitsout::construct(const Config &cfg, otable &t, opipeline &pipe)
 	unlink(fn);
 	fits_create_file(&fptr, fn, &status);   /* create new file */
 	MLOG(verb1) << "Output file: " << fn << " (FITS)\n";
-	if(status) { abort(); }
+	if(status)
+	{
+		char msg[FLEN_STATUS];
+		fits_get_errstatus(status, msg);
+		THROW(EIOException, "Error creating FITS output file '" + std::string(fn) + "': " + msg);
+	}
 
 	return true;
 }
 
+// Flush the queued batches, write out the header table and close the file.
+// Throws if the writer thread, or any of the writes here, failed.
+void os_fitsout::close()
+{
+	if(writer.joinable()) { stop_writer(); }
+	error.rethrow();
+
+	if(!fptr) { return; }
+
+	int status = 0;
+	if(!header_def.empty())
+	{
+		int len = header_def.size();
+
+		// create an additional extension with a single column exactly wide enough to store
+		// our header
+		const char *ttype = "HEADER";
+		char *tform;
+		asprintf(&tform, "%dA", len);
+		fits_create_tbl(fptr, BINARY_TBL, 0, 1, (char**)&ttype, &tform, NULL, "METADATA", &status);
+		free(tform);
+
+		// write header
+		fits_insert_rows(fptr, 0, 1, &status);
+		const char *hstr = header_def.c_str();
+		fits_write_col(fptr, TSTRING, 1, 1, 1, 1, &hstr, &status);
+	}
+
+	// close the file even if writing the header failed (cfitsio
+	// routines do nothing if status != 0, so use a separate one)
+	int cstatus = 0;
+	fits_close_file(fptr, &cstatus);
+	fptr = NULL;
+
+	if(!status) { status = cstatus; }
+	if(status)
+	{
+		char msg[FLEN_STATUS];
+		fits_get_errstatus(status, msg);
+		THROW(EIOException, "Error writing FITS output: " + std::string(msg));
+	}
+}
+
 os_fitsout::~os_fitsout()
 {
-	if(fptr)
+	// normally, finish() has already closed the file. If we got here
+	// because the run failed, close it now but don't throw.
+	try
 	{
-		int status = 0;
-		if(!header_def.empty())
-		{
-			int len = header_def.size();
-
-			// create an additional extension with a single column exactly wide enough to store
-			// our header
-			const char *ttype = "HEADER";
-			char *tform;
-			asprintf(&tform, "%dA", len);
-			fits_create_tbl(fptr, BINARY_TBL, 0, 1, (char**)&ttype, &tform, NULL, "METADATA", &status);
-			ASSERT(status == 0) { fits_report_error(stderr, status); }
-			free(tform);
-
-			// write header
-			fits_insert_rows(fptr, 0, 1, &status);
-			ASSERT(status == 0) { fits_report_error(stderr, status); }
-			const char *hstr = header_def.c_str();
-			fits_write_col(fptr, TSTRING, 1, 1, 1, 1, &hstr, &status);
-			ASSERT(status == 0) { fits_report_error(stderr, status); }
-		}
-		fits_close_file(fptr, &status);
+		close();
+	}
+	catch(EAny &e)
+	{
+		e.print();
+	}
+	catch(...)
+	{
+		std::cerr << "Unknown error while closing FITS output.\n";
 	}
 }
 
@@ -1072,21 +1287,250 @@ bool os_textin::construct(const Config &cfg, otable &t, opipeline &pipe)
 size_t os_textin::run(otable &t, rng_t &rng)
 {
 	size_t total = 0;
+	otable::text_buffer buf;
+	bool more;
 	do {
 		swatch.start();
 		t.clear();
-		t.unserialize_body(in.in());
+		more = t.unserialize_body(in.in(), buf);
 		swatch.stop();
 		if(t.size() > 0)
 		{
 			//static bool firstTime = true; if(firstTime) { swatch.reset(); kernelRunSwatch.reset(); firstTime = false; }
 			total += nextlink->process(t, 0, t.size(), rng);
 		}
-	} while(in.in());
+	} while(more);
+
+	return total;
+}
+
+/////////////////////////////
+
+//
+// Native binary catalog format, written by binout and read by binin.
+//
+// Layout (native byte order):
+//	char[8]		magic (BINCAT_MAGIC)
+//	uint32_t	byte order mark (0x01020304)
+//	uint32_t	format version (BINCAT_VERSION)
+//	uint64_t	length of the header text
+//	char[]		header text: the textout header (column definitions
+//			with their types, formats, aliases and properties),
+//			followed by a '# components ...' line listing the
+//			compIDs of sequential component indices 0, 1, 2, ...
+//	...		chunks, as written by otable::serialize_body_binary()
+//
+// The 'comp' column is stored as sequential component indices, and
+// remapped through the stored compIDs when read back in.
+//
+static const char BINCAT_MAGIC[8] = { 'G', 'F', 'B', 'I', 'N', 'C', 'A', 'T' };
+static const uint32_t BINCAT_BOM = 0x01020304;
+static const uint32_t BINCAT_VERSION = 1;
+
+class os_binout : public osink
+{
+	protected:
+		std::ofstream out;
+		std::string fn;
+
+		bool headerWritten;
+
+		void writeHeader(otable &t);
+
+	public:
+		virtual size_t process(otable &in, size_t begin, size_t end, rng_t &rng);
+		virtual bool construct(const Config &cfg, otable &t, opipeline &pipe);
+		virtual double ordering() const { return ord_output; }
+		virtual const std::string &name() const { static std::string s("binout"); return s; }
+		virtual const std::string &type() const { static std::string s("output"); return s; }
+
+		os_binout() : osink(), headerWritten(false)
+		{
+		}
+};
+
+void os_binout::writeHeader(otable &t)
+{
+	std::ostringstream hdr;
+	hdr << "# ";
+	t.serialize_header(hdr);
+	hdr << "\n";
+	if(t.using_column("comp"))
+	{
+		hdr << "# components";
+		FOR(0, componentMap.size()) { hdr << " " << componentMap.compID(i); }
+		hdr << "\n";
+	}
+	std::string h = hdr.str();
+
+	uint64_t len = h.size();
+	out.write(BINCAT_MAGIC, sizeof(BINCAT_MAGIC));
+	out.write((const char *)&BINCAT_BOM, sizeof(BINCAT_BOM));
+	out.write((const char *)&BINCAT_VERSION, sizeof(BINCAT_VERSION));
+	out.write((const char *)&len, sizeof(len));
+	out.write(h.c_str(), len);
+
+	headerWritten = true;
+}
+
+size_t os_binout::process(otable &t, size_t from, size_t to, rng_t &rng)
+{
+	swatch.start();
+
+	if(!headerWritten) { writeHeader(t); }
+
+	size_t nserialized = 0;
+	if(t.using_column("hidden"))
+	{
+		ticker tick(-1);
+		cint_t::host_t hidden = t.col<int>("hidden");
+		nserialized = t.serialize_body_binary(out, from, to, mask_output(hidden, tick));
+	}
+	else
+	{
+		nserialized = t.serialize_body_binary(out, from, to);
+	}
+
+	if(!out) { THROW(EIOException, "Error writing to '" + fn + "'"); }
+
+	swatch.stop();
+
+	return nserialized;
+}
+
+bool os_binout::construct(const Config &cfg, otable &t, opipeline &pipe)
+{
+	fn = cfg.count("filename") ? cfg["filename"] : "sky.obs.bin";
+	out.open(fn.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if(!out) { THROW(EFile, "Failed to open '" + fn + "' for output."); }
+	MLOG(verb1) << "Output file: " << fn << " (binary)\n";
+
+	return true;
+}
+
+/////////////////////////////
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+class os_binin : public osource
+{
+	protected:
+		std::string fn;
+		char *map;			// the memory-mapped input file
+		size_t mapLength;
+
+		std::string header;		// header text
+		otable::binary_buffer buf;	// chunks not yet read
+		std::vector<int> comp2seq;	// file's sequential component index -> componentMap seqIdx
+
+	public:
+		virtual bool construct(const Config &cfg, otable &t, opipeline &pipe);
+		virtual bool runtime_init(otable &t);
+		virtual size_t run(otable &t, rng_t &rng);
+		virtual const std::string &name() const { static std::string s("binin"); return s; }
+		virtual const std::string &type() const { static std::string s("input"); return s; }
+
+		os_binin() : map(NULL), mapLength(0) {}
+		~os_binin();
+};
+
+bool os_binin::construct(const Config &cfg, otable &t, opipeline &pipe)
+{
+	fn = cfg.count("filename") ? cfg["filename"] : "sky.cat.bin";
+
+	int fd = open(fn.c_str(), O_RDONLY);
+	if(fd == -1) { THROW(EFile, "Failed to open '" + fn + "' for input."); }
+	struct stat st;
+	if(fstat(fd, &st) != 0) { close(fd); THROW(EFile, "Failed to stat '" + fn + "'."); }
+	mapLength = st.st_size;
+
+	const size_t prefix = sizeof(BINCAT_MAGIC) + 2*sizeof(uint32_t) + sizeof(uint64_t);
+	if(mapLength < prefix) { close(fd); THROW(EFile, "'" + fn + "' is not a galfast binary catalog."); }
+
+	map = (char *)mmap(NULL, mapLength, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) { map = NULL; THROW(EFile, "Failed to memory-map '" + fn + "'."); }
+	madvise(map, mapLength, MADV_SEQUENTIAL);
+
+	// check the prefix
+	uint32_t bom, version;
+	uint64_t len;
+	const char *p = map;
+	if(memcmp(p, BINCAT_MAGIC, sizeof(BINCAT_MAGIC)) != 0) { THROW(EFile, "'" + fn + "' is not a galfast binary catalog."); }
+	p += sizeof(BINCAT_MAGIC);
+	memcpy(&bom, p, sizeof(bom));		p += sizeof(bom);
+	memcpy(&version, p, sizeof(version));	p += sizeof(version);
+	memcpy(&len, p, sizeof(len));		p += sizeof(len);
+	if(bom != BINCAT_BOM) { THROW(EFile, "'" + fn + "' was written on a machine with different byte order."); }
+	if(version != BINCAT_VERSION) { THROW(EFile, "'" + fn + "' is of unsupported format version " + str(version) + "."); }
+	if(len > mapLength - prefix) { THROW(EFile, "Truncated header in '" + fn + "'."); }
+
+	header.assign(p, len);
+	buf = otable::binary_buffer(p + len, map + mapLength);
+
+	// register the components stored in the file
+	std::istringstream hdr(header);
+	std::string line;
+	while(getline(hdr, line))
+	{
+		std::istringstream ss(line);
+		std::string hash, kw;
+		if(!(ss >> hash >> kw) || hash != "#" || kw != "components") { continue; }
+
+		uint32_t compID;
+		while(ss >> compID) { comp2seq.push_back(componentMap.seqIdx(compID)); }
+	}
+	MLOG(verb1) << "Input file: " << fn << " (binary)\n";
+
+	return true;
+}
+
+bool os_binin::runtime_init(otable &t)
+{
+	// this unserializes the header and fills the prov vector with columns this module will provide
+	std::istringstream hdr(header);
+	t.unserialize_header(hdr, &prov);
+	if(prov.count("comp") && comp2seq.empty()) { THROW(EFile, "No component map in '" + fn + "'."); }
+
+	return osource::runtime_init(t);
+}
+
+size_t os_binin::run(otable &t, rng_t &rng)
+{
+	size_t total = 0;
+	bool more;
+	do {
+		swatch.start();
+		t.clear();
+		more = t.unserialize_body_binary(buf);
+		if(prov.count("comp"))
+		{
+			// file's component indices -> ours
+			cint_t::host_t comp = t.col<int>("comp");
+			FOR(0, t.size())
+			{
+				int cmp = comp(i);
+				if(cmp < 0 || cmp >= comp2seq.size()) { THROW(EFile, "Invalid component index " + str(cmp) + " in '" + fn + "'."); }
+				comp(i) = comp2seq[cmp];
+			}
+		}
+		swatch.stop();
+		if(t.size() > 0)
+		{
+			total += nextlink->process(t, 0, t.size(), rng);
+		}
+	} while(more);
 
 	return total;
 }
 
+os_binin::~os_binin()
+{
+	if(map) { munmap(map, mapLength); }
+}
+
 #include <dlfcn.h>
 
 typedef opipeline_stage *(*moduleFactory_t)();
@@ -1100,6 +1544,8 @@ boost::shared_ptr<opipeline_stage> opipeline_stage::create(const std::string &na
 //	else if(name == "skygen") { s.reset(new os_skygen); }
 	else if(name == "textout") { s.reset(new os_textout); }
 	else if(name == "fitsout") { s.reset(new os_fitsout); }
+	else if(name == "binin") { s.reset(new os_binin); }
+	else if(name == "binout") { s.reset(new os_binout); }
 //	else if(name == "modelPhotoErrors") { s.reset(new os_modelPhotoErrors); }
 //	else if(name == "unresolvedMultiples") { s.reset(new os_unresolvedMultiples); }
 //	else if(name == "FeH") { s.reset(new os_FeH); }
@@ -1215,6 +1661,10 @@ size_t opipeline::run(otable &t, rng_t &rng)
 	}
 
 	int ret = source->run(t, rng);
+	FOREACH(pipeline)
+	{
+		(*i)->finish();
+	}
 
 	MLOG(verb2) << "Module runtimes:";
 	FOREACH(pipeline)
@@ -1235,6 +1685,31 @@ bool opipeline::has_module_of_type(const std::string &type) const
 	return false;
 }
 
+void thread_error::capture()
+{
+	// libpeyton's exceptions aren't thrown through boost::throw_exception,
+	// so boost::current_exception() can't clone them (unless it's backed by
+	// std::exception_ptr). Copy the ones we know about explicitly.
+	try
+	{
+		throw;
+	}
+	catch(EFile &e)			{ ex = boost::copy_exception(e); }
+	catch(EIOException &e)		{ ex = boost::copy_exception(e); }
+	catch(ENotImplemented &e)	{ ex = boost::copy_exception(e); }
+	catch(EAny &e)			{ ex = boost::copy_exception(e); }
+	catch(...)			{ ex = boost::current_exception(); }
+}
+
+void thread_error::rethrow()
+{
+	if(!ex) { return; }
+
+	boost::exception_ptr e = ex;
+	ex = boost::exception_ptr();
+	boost::rethrow_exception(e);
+}
+
 bool opipeline::create_and_add(
 	Config &modcfg, otable &t,
 	size_t maxstars, size_t nstars,
@@ -25,6 +25,7 @@
 #include "compmgr.h"
 
 #include <list>
+#include <boost/exception_ptr.hpp>
 
 namespace peyton { namespace system { class Config; }};
 
@@ -63,6 +64,7 @@ class opipeline_stage
 		virtual bool construct(const peyton::system::Config &cfg, otable &t, opipeline &pipe) = 0;
 		virtual bool runtime_init(otable &t);
 		virtual size_t run(otable &t, rng_t &rng) = 0;
+		virtual void finish() {}	// called once the source has run to completion; throw to fail the run (e.g., on output errors)
 		virtual ~opipeline_stage() {};
 
 // 		static const int PRIORITY_INPUT      = -10000;
@@ -151,4 +153,21 @@ class osource : public opipeline_stage
 		osource() : opipeline_stage() {}
 };
 
+//
+// An exception caught on a helper thread (e.g., the skygen pipeline
+// thread), kept to be rethrown on the thread that waits for its work.
+// Catch with catch(...) and call capture() from the handler; rethrow()
+// throws it again with its original type.
+//
+class thread_error
+{
+	protected:
+		boost::exception_ptr ex;
+
+	public:
+		void capture();		// store the exception being handled (call from a catch block)
+		void rethrow();		// if an exception was stored, clear it and rethrow it
+		bool empty() const { return !ex; }
+};
+
 #endif // pipeline_h__
@@ -28,6 +28,7 @@
 #include "modules/fixedFeH_gpu.cu.h"
 #include "modules/unresolvedMultiples_gpu.cu.h"
 #include "modules/photometry_gpu.cu.h"
+#include "modules/photometricErrors_gpu.cu.h"
 #include "modules/kinTMIII_gpu.cu.h"
 #include "modules/Bond2010_gpu.cu.h"
 #include "modules/vel2pm_gpu.cu.h"
@@ -38,6 +38,7 @@ struct ALIGN(16) J08 : public modelConcept
 	{
 		float rho;
 	};
+	static const bool separable = true;	// rho(s, M) == s.rho * LF(M) (see modelConcept)
 	float rho0, l, h, z0, f, lt, ht, fh, q, n;
 	float r_cut2;
 
@@ -72,6 +72,13 @@ void LCBulge::postrun(host_state_t &hstate, bool draw)
 	LCBulgeLF.unbind();
 }
 
+void LCBulge::hash_state(host_state_t &hstate, skygenHash &h) const
+{
+	h.add(ba); h.add(ca); h.add(n); h.add(l);
+	h.add(T); h.add(rot);
+	h.add(hstate.lf);
+}
+
 bool LCBulge::hint_absmag(host_state_t &hstate, float &M0, float &M1) const
 {
 	return absmag_adjust_from_lf(hstate.lf, M0, M1);
@@ -41,6 +41,7 @@ public:
 	{
 		float rho;
 	};
+	static const bool separable = true;	// rho(s, M) == s.rho * LF(M) (see modelConcept)
 
 public:
 	// Exponential ellipsoid parameters for
@@ -63,6 +64,7 @@ public:
 	void prerun(host_state_t &hstate, bool draw);
 	void postrun(host_state_t &hstate, bool draw);
 	bool hint_absmag(host_state_t &hstate, float &M0, float &M1) const;
+	void hash_state(host_state_t &hstate, skygenHash &h) const;
 
 public:
 	__host__ __device__ float rho(float x, float y, float z) const
@@ -93,6 +95,8 @@ public:
 	}
 };
 
+template<> struct fusedModelType<LCBulge> { static const int id = FUSED_LCBULGE; };
+
 MODEL_IMPLEMENTATION(LCBulge);
 
 #endif // #ifndef LCBulge_h__
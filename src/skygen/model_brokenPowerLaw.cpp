@@ -29,6 +29,17 @@
 #include <astro/useall.h>
 #include <fstream>
 
+void brokenPowerLaw::hash_state(host_state_t &hstate, skygenHash &h) const
+{
+	powerLawEllipsoid::hash_state(hstate, h);
+
+	// only the first nbreaks+1 power laws are in use
+	h.add(nbreaks);
+	h.add(nArr, sizeof(*nArr)*(nbreaks+1));
+	h.add(fArr, sizeof(*fArr)*(nbreaks+1));
+	h.add(rbreakSq, sizeof(*rbreakSq)*nbreaks);
+}
+
 void brokenPowerLaw::load(host_state_t &hstate, const peyton::system::Config &cfg)
 {
 	// turn off density truncation
@@ -45,6 +45,7 @@ public:
 
 public:
 	void load(host_state_t &hstate, const peyton::system::Config &cfg);
+	void hash_state(host_state_t &hstate, skygenHash &h) const;
 
 public:
 	__host__ __device__ float rho(float x, float y, float z) const
@@ -88,6 +89,8 @@ public:
 	}
 };
 
+template<> struct fusedModelType<brokenPowerLaw> { static const int id = FUSED_BROKENPOWERLAW; };
+
 MODEL_IMPLEMENTATION(brokenPowerLaw);
 
 #endif // #ifndef brokenPowerLaw_h__
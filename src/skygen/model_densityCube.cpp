@@ -44,6 +44,13 @@ void densityCube::postrun(host_state_t &hstate, bool draw)
 	densityCubeTex.unbind();
 }
 
+void densityCube::hash_state(host_state_t &hstate, skygenHash &h) const
+{
+	h.add(f); h.add(Rg);
+	h.add(hstate.lf);
+	h.add(hstate.den);
+}
+
 int get_delta(double &delta, double &xmin, double &xmax, const std::vector<double> &x)
 {
 	std::vector<double> tmp(x);
@@ -53,10 +53,12 @@ public:
 	{
 		float rho;	// sampled density, before multiplying by LF
 	};
+	static const bool separable = true;	// rho(s, M) == s.rho * LF(M) (see modelConcept)
 	void load(host_state_t &hstate, const peyton::system::Config &cfg);
 	void prerun(host_state_t &hstate, bool draw);
 	void postrun(host_state_t &hstate, bool draw);
 	bool hint_absmag(host_state_t &hstate, float &M0, float &M1) const;
+	void hash_state(host_state_t &hstate, skygenHash &h) const;
 
 public:
 	__device__ void setpos(state &s, float x, float y, float z) const
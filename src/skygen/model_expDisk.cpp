@@ -38,6 +38,13 @@ void expDisk::postrun(host_state_t &hstate, bool draw)
 	expDiskLF.unbind();
 }
 
+void expDisk::hash_state(host_state_t &hstate, skygenHash &h) const
+{
+	h.add(f); h.add(l); h.add(this->h); h.add(r_cut2);
+	h.add(M); h.add(T);
+	h.add(hstate.lf);
+}
+
 void expDisk::load(host_state_t &hstate, const peyton::system::Config &cfg)
 {
 	// density distribution parameters
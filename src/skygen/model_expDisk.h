@@ -62,10 +62,12 @@ public:
 	{
 		float rho;
 	};
+	static const bool separable = true;	// rho(s, M) == s.rho * LF(M) (see modelConcept)
 	void load(host_state_t &hstate, const peyton::system::Config &cfg);
 	void prerun(host_state_t &hstate, bool draw);
 	void postrun(host_state_t &hstate, bool draw);
 	bool hint_absmag(host_state_t &hstate, float &M0, float &M1) const;
+	void hash_state(host_state_t &hstate, skygenHash &h) const;
 
 public:
 	__device__ float rho(float x, float y, float z) const
@@ -121,6 +123,8 @@ public:
 	}
 };
 
+template<> struct fusedModelType<expDisk> { static const int id = FUSED_EXPDISK; };
+
 MODEL_IMPLEMENTATION(expDisk);
 
 #endif // #ifndef expDisk_h__
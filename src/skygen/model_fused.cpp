@@ -0,0 +1,157 @@
+/***************************************************************************
+ *   Copyright (C) 2004 by Mario Juric                                     *
+ *   mjuric@astro.Princeton.EDU                                            *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include "galfast_config.h"
+
+#include "model_fused.h"
+#include "skyconfig_impl.h"
+#include "model_lib.h"
+
+#include <astro/system/config.h>
+#include <astro/useall.h>
+
+template<> bool skygenHost<fusedModel>::fusable(fusablePart &part) const { return false; }
+
+void fusedModel::prerun(host_state_t &hstate, bool draw)
+{
+	// bind the luminosity function texture to texture reference
+	fusedLF.bind(hstate.lf);
+}
+
+void fusedModel::postrun(host_state_t &hstate, bool draw)
+{
+	// unbind LF texture reference
+	fusedLF.unbind();
+}
+
+// hash the parameters of part k, as if it were an unfused model of type Part
+template<typename Part>
+static void hash_part(const fusedModel &m, int k, const fusablePart &part, skygenHash &h)
+{
+	typename Part::host_state_t hs;
+	hs.lf = part.lf;
+	((const Part *)m.params[k])->hash_state(hs, h);
+}
+
+void fusedModel::hash_state(host_state_t &hstate, skygenHash &h) const
+{
+	h.add(nparts);
+	for(int k = 0; k != nparts; k++)
+	{
+		const fusablePart &part = hstate.parts[k];
+		h.add(type[k]);
+		switch(type[k])
+		{
+			case FUSED_EXPDISK:		hash_part<expDisk>(*this, k, part, h); break;
+			case FUSED_POWERLAWELLIPSOID:	hash_part<powerLawEllipsoid>(*this, k, part, h); break;
+			case FUSED_BROKENPOWERLAW:	hash_part<brokenPowerLaw>(*this, k, part, h); break;
+			case FUSED_LCBULGE:		hash_part<LCBulge>(*this, k, part, h); break;
+		}
+	}
+	h.add(hstate.lf);
+}
+
+void fusedModel::load(host_state_t &hstate, const peyton::system::Config &cfg)
+{
+	// nothing to load; the parts are set up with add()
+}
+
+void fusedModel::add(host_state_t &hstate, const fusablePart &part)
+{
+	ASSERT(nparts < FUSED_MAXPARTS);
+	ASSERT(part.size <= sizeof(params[nparts]));
+
+	if(nparts == 0) { comp = part.comp; }
+
+	type[nparts] = part.type;
+	comps[nparts] = part.comp;
+	memcpy(params[nparts], part.model, part.size);
+	hstate.parts.push_back(part);
+	hstate.parts.back().model = params[nparts];	// the original may go away
+	nparts++;
+}
+
+bool fusedModel::hint_absmag(host_state_t &hstate, float &M0, float &M1) const
+{
+	// the union of absolute magnitude ranges of all parts
+	float X0 = hstate.parts[0].M0, X1 = hstate.parts[0].M1;
+	FOREACH(hstate.parts)
+	{
+		X0 = std::min(X0, i->M0);
+		X1 = std::max(X1, i->M1);
+	}
+
+	bool ret = false;
+	if(X0 > M0) { ret = true; M0 = X0; }
+	if(X1 < M1) { ret = true; M1 = X1; }
+	return ret;
+}
+
+//
+// skygenHost<> for fusedModel, that knows how to set up the model from
+// its parts.
+//
+class skygenFused : public skygenHost<fusedModel>
+{
+public:
+	bool init(const std::vector<fusablePart> &parts, const skygenParams &sc, const pencilBeam *pixels)
+	{
+		model.nparts = 0;
+		FOREACH(parts) { model.add(model_host_state, *i); }
+
+		peyton::system::Config cfg;
+		skygenHost<fusedModel>::init(cfg, sc, pixels);
+
+		// Sample the LFs of all parts at the centers of absolute magnitude
+		// bins, where the kernel evaluates them. Clear the bins outside of
+		// each part's absmag range, as it wouldn't have been generated there
+		// on its own.
+		int nM = this->nM;
+		std::vector<float> M(nM);
+		FOR(0, nM) { M[i] = this->M1 - (nM-1-i)*this->dM; }
+
+		cuxTexture<float, 2> lf(nM, model.nparts, make_float2(M[0], 1.f/this->dM), make_float2(0.f, 1.f));
+		FORj(k, 0, model.nparts)
+		{
+			fusablePart &part = model_host_state.parts[k];
+			cuxTexSampler<float, 1> lfk(part.lf, true);
+			lfk.sample(&lf(0, k), &M[0], nM);
+
+			FOR(0, nM)
+			{
+				if(M[i] < part.M0 || M[i] > part.M1) { lf(i, k) = 0.f; }
+			}
+		}
+		model_host_state.lf = lf;
+
+		std::ostringstream ss;
+		FOREACH(parts) { ss << " " << componentMap.compID(i->comp); }
+		MLOG(verb1) << "Components" << ss.str() << " : fused into a single pass.";
+
+		return true;
+	}
+};
+
+skygenInterface *create_fused_model(const std::vector<fusablePart> &parts, const skygenParams &sc, const pencilBeam *pixels)
+{
+	skygenFused *fused = new skygenFused();
+	fused->init(parts, sc, pixels);
+	return fused;
+}
@@ -0,0 +1,159 @@
+/***************************************************************************
+ *   Copyright (C) 2004 by Mario Juric                                     *
+ *   mjuric@astro.Princeton.EDU                                            *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef fusedModel_h__
+#define fusedModel_h__
+
+#include "skygen.h"
+
+#include "model_expDisk.h"
+#include "model_powerLawEllipsoid.h"
+#include "model_brokenPowerLaw.h"
+#include "model_LCBulge.h"
+
+#include <vector>
+
+// luminosity functions of all parts, one row per part (see fusedModel::host_state_t)
+DEFINE_TEXTURE(fusedLF, float, 2, cudaReadModeElementType, false, cudaFilterModeLinear, cudaAddressModeClamp);
+
+//
+// A composite of several LF-separable models (the "parts"), generated in a
+// single pass through (pixel, m, M) space. The density is the sum of the
+// densities of the parts, and the component of each drawn star is chosen
+// with probability proportional to the density of each part.
+//
+// Each part is stored as a bytewise copy of the original model, and its
+// density computed by calling the original model's setpos(). The LFs of
+// all parts are resampled to the absolute magnitude bin centers, and
+// stored in a single 2D texture.
+//
+// Constructed by create_fused_model() (in model_fused.cpp), from models
+// that specialize fusedModelType<>.
+//
+struct ALIGN(16) fusedModel : public modelConcept
+{
+public:
+	struct ALIGN(16) host_state_t
+	{
+		cuxTexture<float, 2> lf;			// LF of part k is in row k, sampled at absmag bin centers
+		std::vector<fusablePart> parts;			// parts, as exported by skygenInterface::fusable()
+	};
+
+public:
+	int nparts;					// number of parts
+	int type[FUSED_MAXPARTS];			// fusedModelType<>::id of each part
+	int comps[FUSED_MAXPARTS];			// component ID of each part
+	float4 params[FUSED_MAXPARTS][FUSED_MAXPARTSIZE/16];	// bytewise copies of the parts
+
+public:
+	struct state
+	{
+		float rho[FUSED_MAXPARTS];		// densities of the parts, before multiplying by LF
+	};
+	static const bool separable = true;	// each part is a separable term (see modelConcept)
+	void load(host_state_t &hstate, const peyton::system::Config &cfg);
+	void prerun(host_state_t &hstate, bool draw);
+	void postrun(host_state_t &hstate, bool draw);
+	bool hint_absmag(host_state_t &hstate, float &M0, float &M1) const;
+	void hash_state(host_state_t &hstate, skygenHash &h) const;
+
+	void add(host_state_t &hstate, const fusablePart &part);
+
+public:
+	template<typename Part>
+	__device__ float density(int k, float x, float y, float z) const
+	{
+		typename Part::state s;
+		((const Part *)params[k])->setpos(s, x, y, z);
+		return s.rho;
+	}
+
+	__device__ void setpos(state &s, float x, float y, float z) const
+	{
+		for(int k = 0; k != nparts; k++)
+		{
+			switch(type[k])
+			{
+				case FUSED_EXPDISK:		s.rho[k] = density<expDisk>(k, x, y, z); break;
+				case FUSED_POWERLAWELLIPSOID:	s.rho[k] = density<powerLawEllipsoid>(k, x, y, z); break;
+				case FUSED_BROKENPOWERLAW:	s.rho[k] = density<brokenPowerLaw>(k, x, y, z); break;
+				case FUSED_LCBULGE:		s.rho[k] = density<LCBulge>(k, x, y, z); break;
+				default:			s.rho[k] = 0.f;
+			}
+		}
+	}
+
+	__device__ float rho(state &s, float M, int k) const
+	{
+		float phi = TEX2D(fusedLF, M, k);
+		return phi * s.rho[k];
+	}
+
+	__host__ __device__ int nlf() const { return nparts; }
+
+	void sample_lf(host_state_t &hstate, int k, float *phi, const float *M, int n) const
+	{
+		std::vector<float> K(n, k);
+		cuxTexSampler<float, 2>(hstate.lf, true).sample(phi, M, &K[0], n);
+	}
+
+	__device__ float den(state &s, int k) const
+	{
+		return s.rho[k];
+	}
+
+	__device__ float rho(state &s, float M) const
+	{
+		float rho = 0.f;
+		for(int k = 0; k != nparts; k++)
+		{
+			rho += this->rho(s, M, k);
+		}
+		return rho;
+	}
+
+	template<typename R>
+	__device__ int component(state &s, float M, const R &rng) const
+	{
+		float u = rng.uniform() * rho(s, M);
+
+		// find the part into whose density u falls, skipping
+		// over parts that don't contribute (in case roundoff
+		// takes us past the last one)
+		int k, last = 0;
+		for(k = 0; k != nparts; k++)
+		{
+			float rhok = rho(s, M, k);
+			if(rhok == 0.f) { continue; }
+
+			last = k;
+			u -= rhok;
+			if(u < 0.f) { break; }
+		}
+		return comps[last];
+	}
+};
+
+// fusedModel can't itself be fused any further (defined in model_fused.cpp)
+template<> bool skygenHost<fusedModel>::fusable(fusablePart &part) const;
+
+MODEL_IMPLEMENTATION(fusedModel);
+
+#endif // #ifndef fusedModel_h__
@@ -39,6 +39,13 @@ void powerLawEllipsoid::postrun(host_state_t &hstate, bool draw)
 	powerLawEllipsoidLF.unbind();
 }
 
+void powerLawEllipsoid::hash_state(host_state_t &hstate, skygenHash &h) const
+{
+	h.add(T); h.add(f); h.add(n); h.add(ba); h.add(ca);
+	h.add(rminSq); h.add(rmaxSq); h.add(rot);
+	h.add(hstate.lf);
+}
+
 void powerLawEllipsoid::load_geometry(host_state_t &hstate, const peyton::system::Config &cfg)
 {
 #if 0
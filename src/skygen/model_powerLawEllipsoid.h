@@ -51,10 +51,12 @@ public:
 	{
 		float rho;
 	};
+	static const bool separable = true;	// rho(s, M) == s.rho * LF(M) (see modelConcept)
 	void load(host_state_t &hstate, const peyton::system::Config &cfg);
 	void prerun(host_state_t &hstate, bool draw);
 	void postrun(host_state_t &hstate, bool draw);
 	bool hint_absmag(host_state_t &hstate, float &M0, float &M1) const;
+	void hash_state(host_state_t &hstate, skygenHash &h) const;
 
 public:
 	__host__ __device__ float rho(float x, float y, float z) const
@@ -105,6 +107,8 @@ public:
 	}
 };
 
+template<> struct fusedModelType<powerLawEllipsoid> { static const int id = FUSED_POWERLAWELLIPSOID; };
+
 MODEL_IMPLEMENTATION(powerLawEllipsoid);
 
 #endif // #ifndef powerLawEllipsoid_h__
@@ -30,6 +30,10 @@
 #include <iomanip>
 
 #include <dlfcn.h>
+#include <sys/stat.h>
+#include <deque>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 
 #include <astro/io/format.h>
 #include <astro/system/config.h>
@@ -48,8 +52,27 @@ protected:
 		peyton::math::lambert 	proj;	// projection
 		partitioned_skymap 	*sky;	// skymap of the hemisphere polygon
 
-		hemisphere() : sky(NULL) {}
+		// Flat index of skymap pixels, for lookups in process(). A cell
+		// is CELL_NONE if there's no skymap pixel for it, CELL_INSIDE
+		// if it's entirely within the footprint, or an index into
+		// partial[] if stars in it need a point-in-polygon test.
+		enum { CELL_NONE = -1, CELL_INSIDE = -2 };
+		int NX, NY;				// dimensions of the index (cells [0,NX) x [0,NY) of the skymap)
+		std::vector<int> cells;			// cell classification, X-major (X*NY + Y)
+		std::vector<const gpc_polygon *> partial;	// footprint polygons of partially covered cells
+
+		hemisphere() : sky(NULL), NX(0), NY(0) {}
 		~hemisphere() { delete sky; }
+
+		void build_index();
+		int cell(double x, double y) const
+		{
+			// NOTE: must truncate the same way as partitioned_skymap::in()
+			int X = (int)((x - sky->x0) / sky->dx);
+			int Y = (int)((y - sky->y0) / sky->dx);
+			if(X < 0 || X >= NX || Y < 0 || Y >= NY) { return CELL_NONE; }
+			return cells[X*NY + Y];
+		}
 	private:
 		// disallow copy, copy constructable
 		hemisphere &operator=(const hemisphere&);
@@ -57,6 +80,9 @@ protected:
 	};
 
 	hemisphere hemispheres[2];	// pixelized northern and southern sky
+	bool gridIndex;			// look up pixels in the flat index, and skip the polygon test in fully covered ones
+
+	void clip_exact(otable &in, size_t begin, size_t end);
 
 public:
 	struct pixel
@@ -78,12 +104,12 @@ public:
 	virtual double ordering() const { return ord_clipper; }
 
 	// constructs the clipper object from north/south hemispheres in projection proj
-	void construct_from_hemispheres(float dx, const peyton::math::lambert &nproj, const std::pair<gpc_polygon, gpc_polygon> &sky);
+	void construct_from_hemispheres(float dx, const peyton::math::lambert &nproj, const std::pair<gpc_polygon, gpc_polygon> &sky, bool gridIndex = true);
 
 	int getPixelCenters(std::vector<os_clipper::pixel> &pix) const;			// returns the centers of all pixels
 	int getProjections(std::vector<std::pair<double, double> > &ppoles) const;	// returns the poles of all used projections
 
-	os_clipper() : osink()
+	os_clipper() : osink(), gridIndex(true)
 	{
 		req.insert("projIdx");
 		req.insert("projXY");
@@ -102,11 +128,16 @@ protected:
 	std::vector<boost::shared_ptr<skygenInterface> > kernels;
 	size_t maxstars;	// maximum number of stars to generate
 	bool dryrun;		// whether to stop after computing the expected number of stars
+	bool fuse;		// whether to generate all fusable models in a single pass (see model_fused.h)
+	bool pruneCells;	// whether to skip the (m, M) cells that can't contain observable stars (see skygenHost<T>::bound_cells)
+	bool clipIndex;		// whether the footprint clipper uses its pixel index (see os_clipper::hemisphere::build_index)
+	int pipelineDepth;	// number of output tables in flight (>1 to overlap generation with the pipeline, see skygenBatchQueue)
 	float nstars;		// the mean number of stars to generate (if nstars=0, the number will be determined by the model)
 	cuxTexture<float, 3>	ext_north, ext_south;	// north/south extinction maps
 	cuxTexture<float, 3>	ext_beam; // maps of minimum extinction for each pixel (coords are x==pixelIndex/2048, y=pixelIndex%2048, y==DM)
 
 	std::string denMapPrefix;	// HACK: dump the starcount density of each component into a file named denMapPrefix.$comp.txt
+	std::string countsCacheDir;	// directory where the expected starcounts are cached between runs (empty for no caching)
 
 public:
 	virtual bool construct(const peyton::system::Config &cfg, otable &t, opipeline &pipe);
@@ -118,6 +149,7 @@ protected:
 	skygenInterface *create_kernel_for_model(const std::string &model);
 	void load_footprints(skygenParams &sc, std::vector<pencilBeam> &skypixels, const std::string &footprints, float dx, opipeline &pipe);
 	int load_models(skygenParams &sc, const std::string &model_cfg_list, const std::vector<pencilBeam> &skypixels);
+	void fuse_models(const skygenParams &sc, const std::vector<pencilBeam> &skypixels);
 	void load_skyPixelizationConfig(float &dx, skygenParams &sc, const Config &cfg);
 	void load_extinction_maps(std::vector<pencilBeam> &skypixels, const skygenParams &sc, const std::string &econf);
 };
@@ -251,7 +283,7 @@ void os_skygen::load_footprints(skygenParams &sc, std::vector<pencilBeam> &skypi
 	// setup clipper for the footprint
 	boost::shared_ptr<opipeline_stage> clipper_s(opipeline_stage::create("clipper"));	// clipper for this footprint
 	os_clipper &clipper = *static_cast<os_clipper*>(clipper_s.get());
-	clipper.construct_from_hemispheres(dx, proj, sky);
+	clipper.construct_from_hemispheres(dx, proj, sky, clipIndex);
 	pipe.add(clipper_s);
 
 	gpc_free_polygon(&sky.first);
@@ -396,6 +428,43 @@ int os_skygen::load_models(skygenParams &sc, const std::string &model_cfg_list,
 
 	// sort kernels in component ID order
 	sort(kernels.begin(), kernels.end(), aux_kernel_sorter());
+
+	// fuse the models that support it into a single kernel
+	if(fuse)
+	{
+		fuse_models(sc, skypixels);
+	}
+}
+
+skygenInterface *create_fused_model(const std::vector<fusablePart> &parts, const skygenParams &sc, const pencilBeam *pixels);
+
+//
+// Replace all kernels whose models can be evaluated together by a single
+// kernel that generates them in one pass (see model_fused.h).
+//
+void os_skygen::fuse_models(const skygenParams &sc, const std::vector<pencilBeam> &skypixels)
+{
+	std::vector<fusablePart> parts;
+	std::vector<boost::shared_ptr<skygenInterface> > rest;
+	FOREACH(kernels)
+	{
+		fusablePart part;
+		if(parts.size() < FUSED_MAXPARTS && (*i)->fusable(part))
+		{
+			parts.push_back(part);
+		}
+		else
+		{
+			rest.push_back(*i);
+		}
+	}
+	if(parts.size() < 2) { return; }
+
+	boost::shared_ptr<skygenInterface> kernel(create_fused_model(parts, sc, &skypixels[0]));
+	rest.push_back(kernel);
+
+	kernels.swap(rest);
+	sort(kernels.begin(), kernels.end(), aux_kernel_sorter());
 }
 
 void skygenParams::reset_absmag(float M0_, float M1_, float dM_)
@@ -423,6 +492,7 @@ void os_skygen::load_skyPixelizationConfig(float &dx, skygenParams &sc, const Co
 	assert(sc.dM == sc.dm);
 	cfg.get(sc.dmin, "dmin", 0.f);
 	cfg.get(sc.dmax, "dmax", 0.f);
+	cfg.get(sc.collapseCounts, "collapseCounts", true);	// integrate separable models one distance bin at a time
 
 	sc.reset_absmag(sc.M0, sc.M1, sc.dM);
 	sc.nm = (int)round((sc.m1 - sc.m0) / sc.dm);
@@ -815,12 +885,35 @@ void os_skygen::load_extinction_maps(std::vector<pencilBeam> &skypixels, const s
 
 bool os_skygen::construct(const Config &cfg, otable &t, opipeline &pipe)
 {
+	// pruning the cells changes the catalog drawn for a given seed, unless the RNG is counter-based
+#if COUNTER_RNG
+	const bool pruneDefault = true;
+#else
+	const bool pruneDefault = false;
+#endif
+
 	cfg.get(maxstars, "maxstars", (size_t)100*1000*1000);	// maximum number of stars skygen is allowed to generate (0 for unlimited)
 	cfg.get(nstars, "nstars", 0.f);				// mean number of stars skygen should generate (0 to leave it to the model to determine this)
 	cfg.get(dryrun, "dryrun", false);			// mean number of stars skygen should generate (0 to leave it to the model to determine this)
+	cfg.get(fuse, "fuse", false);				// generate all models that support it in a single pass
+	cfg.get(pruneCells, "pruneCells", pruneDefault);		// skip the cells beyond the flux and distance limits before computing their density
+	cfg.get(clipIndex, "clipIndex", true);			// classify the footprint pixels, and test only the stars in partially covered ones
+	cfg.get(pipelineDepth, "pipelineDepth", 1);		// number of output tables in flight (1 to alternate generation and the pipeline)
+	if(pipelineDepth < 1) { pipelineDepth = 1; }
+
+	// directory where the results of the first (integration) pass are cached
+	cfg.get(countsCacheDir, "countsCache", "");
+	if(!countsCacheDir.empty())
+	{
+		mkdir(countsCacheDir.c_str(), 0777);	// it's OK if it already exists
+	}
 
 	// output file for sky densities
 	cfg.get(denMapPrefix, "skyCountsMapPrefix", "");
+	if(!denMapPrefix.empty())
+	{
+		fuse = false;	// the density maps are per-component
+	}
 
 	// load sky pixelization and prepare the table for output
 	skygenParams sc;
@@ -837,6 +930,12 @@ bool os_skygen::construct(const Config &cfg, otable &t, opipeline &pipe)
 	// load the models
 	load_models(sc, cfg.get("model"), skypixels);
 
+	// restrict the models to the cells that can contain observable stars, given the minimum extinction in each beam
+	if(pruneCells)
+	{
+		FOREACH(kernels) { (*i)->bound_cells(ext_beam); }
+	}
+
 	// prepare the table for output
 	t.use_column("lb");
 	t.use_column("projIdx");
@@ -872,12 +971,37 @@ size_t os_skygen::run(otable &in, rng_t &rng)
 	cuxTextureBinder tb_south(::ext_south, ext_south);
 	cuxTextureBinder tb_binned(::ext_beam, ext_beam);
 
+	// The extinction maps are the only inputs to the integration that are
+	// shared by all models. Each model hashes its own inputs.
+	countsCache cache;
+	cache.dir = countsCacheDir;
+	cache.key = 0;
+	if(!cache.dir.empty())
+	{
+		skygenHash h;
+		h.add(ext_north);
+		h.add(ext_south);
+		h.add(ext_beam);
+		cache.key = h.h;
+	}
+
+	// The pipeline can run on a separate host thread only if it doesn't
+	// use the GPU (the CUDA context belongs to this thread). If it runs
+	// there, the models get RNG streams of their own, as the pipeline
+	// modules draw from the shared ones concurrently.
+	int depth = pipelineDepth;
+	if(depth > 1 && gpuExecutionEnabled("pipeline"))
+	{
+		MLOG(verb1) << "Overlapping generation with the pipeline is supported only in CPU mode. Disabling.";
+		depth = 1;
+	}
+
 	double nstarsExpected = 0;
 	FOREACH(kernels)
 	{
 		float runtime;
-		(*i)->initRNG(rng);
-		nstarsExpected += (*i)->integrateCounts(runtime, denMapPrefix.c_str());
+		(*i)->initRNG(rng, depth == 1);
+		nstarsExpected += (*i)->integrateCounts(runtime, denMapPrefix.c_str(), cache);
 	}
 
 	//
@@ -919,14 +1043,22 @@ size_t os_skygen::run(otable &in, rng_t &rng)
 	swatch.stop();
 
 	size_t starsGenerated = 0;
+	stopwatch drawTime;
+	drawTime.start();
+	skygenBatchQueue out(in, nextlink, rng, depth);
 	FOREACH(kernels)
 	{
 		float runtime;
-		starsGenerated += (*i)->drawSources(in, nextlink, runtime);
+		starsGenerated += (*i)->drawSources(out, runtime);
 		swatch.addTime(runtime);
 	}
+	drawTime.stop();
 
 	MLOG(verb1) << "Total : " << starsGenerated << " stars written out.\n";
+	if(drawTime.getTime() > 0)
+	{
+		MLOG(verb1) << "Throughput : " << starsGenerated / drawTime.getTime() << " stars/s generated and processed (pipelineDepth = " << depth << ").";
+	}
 
 	return starsGenerated;
 }
@@ -946,8 +1078,10 @@ bool os_clipper::construct(const Config &cfg, otable &t, opipeline &pipe)
 
 // Construct a pixelization of the sky given footprint polygons projected
 // to north and south Galactic hempsiphere
-void os_clipper::construct_from_hemispheres(float dx, const peyton::math::lambert &proj, const std::pair<gpc_polygon, gpc_polygon> &sky)
+void os_clipper::construct_from_hemispheres(float dx, const peyton::math::lambert &proj, const std::pair<gpc_polygon, gpc_polygon> &sky, bool gridIndex_)
 {
+	gridIndex = gridIndex_;
+
 	// set the north hemisphere projection to input map projection
 	hemispheres[0].proj = proj;
 	hemispheres[1].proj = peyton::math::lambert(modulo(proj.l0 + ctn::pi, ctn::twopi), -proj.phi1);
@@ -955,11 +1089,49 @@ void os_clipper::construct_from_hemispheres(float dx, const peyton::math::lamber
 	// construct north/south skymaps
 	hemispheres[0].sky = make_skymap(dx, sky.first);
 	hemispheres[1].sky = make_skymap(dx, sky.second);
+	hemispheres[0].build_index();
+	hemispheres[1].build_index();
 
 	DLOG(verb1) << "Sky pixels in the north: " << hemispheres[0].sky->skymap.size();
 	DLOG(verb1) << "Sky pixels in the south: " << hemispheres[1].sky->skymap.size();
 }
 
+// Build the flat index of skymap pixels, classifying each as fully or
+// partially covered by the footprint.
+void os_clipper::hemisphere::build_index()
+{
+	NX = NY = 0;
+	FOREACH(sky->skymap)
+	{
+		ASSERT(i->first.first >= 0 && i->first.second >= 0);
+		NX = std::max(NX, i->first.first + 1);
+		NY = std::max(NY, i->first.second + 1);
+	}
+
+	cells.assign((size_t)NX*NY, (int)CELL_NONE);
+	partial.clear();
+	FOREACH(sky->skymap)
+	{
+		// A single (non-hole) contour covering the whole area of the
+		// pixel it was clipped to must be the pixel itself
+		const partitioned_skymap::pixel_t &pix = i->second;
+		bool inside = pix.poly.num_contours == 1 && !pix.poly.hole[0] && pix.coveredArea >= pix.pixelArea*(1. - 1e-9);
+
+		int &c = cells[(size_t)i->first.first*NY + i->first.second];
+		if(inside)
+		{
+			c = CELL_INSIDE;
+		}
+		else
+		{
+			c = partial.size();
+			partial.push_back(&pix.poly);
+		}
+	}
+
+	DLOG(verb1) << "Sky pixels fully within the footprint: " << sky->skymap.size() - partial.size() << " of " << sky->skymap.size();
+}
+
 // returns the poles of all used projections
 int os_clipper::getProjections(std::vector<std::pair<double, double> > &ppoles) const
 {
@@ -994,55 +1166,407 @@ int os_clipper::getPixelCenters(std::vector<os_clipper::pixel> &pix) const
 	return pix.size();
 }
 
+// Point-in-polygon tests of stars in partially covered pixels, executed
+// on the CPU thread pool by os_clipper::process()
+struct clip_partial
+{
+	const std::vector<std::pair<uint32_t, const gpc_polygon *> > &todo;	// (row, polygon) pairs
+	cfloat_t::host_t projXY;
+	cint_t::host_t hidden;
+
+	clip_partial(const std::vector<std::pair<uint32_t, const gpc_polygon *> > &todo_, otable &in)
+		: todo(todo_), projXY(in.col<float>("projXY")), hidden(in.col<int>("hidden")) {}
+
+	void operator()(uint32_t begin, uint32_t end) const
+	{
+		for(uint32_t i = begin; i != end; i++)
+		{
+			uint32_t row = todo[i].first;
+			gpc_vertex vtmp = { projXY(row, 0), projXY(row, 1) };
+			if(!in_polygon(vtmp, *todo[i].second)) { hidden(row) = 1; }
+		}
+	}
+};
+
+// Reference implementation of process(), used if gridIndex is false:
+// looks up the skymap pixel of each star, and tests every star that has
+// one against the pixel's footprint polygon.
+void os_clipper::clip_exact(otable &in, size_t begin, size_t end)
+{
+	cint_t::host_t pIdx     = in.col<int>("projIdx");
+	cfloat_t::host_t projXY = in.col<float>("projXY");
+	cint_t::host_t	hidden  = in.col<int>("hidden");
+
+	for(size_t row=begin; row < end; row++)
+	{
+		if(hidden(row)) { continue; }
+
+		Radians x = projXY(row, 0), y = projXY(row, 1);
+		partitioned_skymap *skymap = hemispheres[pIdx(row)].sky;
+		std::pair<int, int> XY;
+		XY.first = (int)((x - skymap->x0) / skymap->dx);
+		XY.second = (int)((y - skymap->y0) / skymap->dx);
+
+		typeof(skymap->skymap.begin()) it = skymap->skymap.find(XY);
+		if(it == skymap->skymap.end()) { continue; }
+
+		gpc_vertex vtmp = { x, y };
+		if(!in_polygon(vtmp, it->second.poly)) { hidden(row) = 1; }
+	}
+}
+
 // ::process() override -- set hidden=1 for every row that is outside
 // the exact input sky footprint
 size_t os_clipper::process(otable &in, size_t begin, size_t end, rng_t &rng)
 {
 	swatch.start();
+	if(!gridIndex)
+	{
+		clip_exact(in, begin, end);
+		swatch.stop();
+		return nextlink->process(in, begin, end, rng);
+	}
 #if 1
 	// fetch prerequisites
 	cint_t::host_t pIdx     = in.col<int>("projIdx");
 	cfloat_t::host_t projXY = in.col<float>("projXY");
 	cint_t::host_t	hidden  = in.col<int>("hidden");
 
+	// Classify the stars by the pixel they fall into. Only those in
+	// pixels partially covered by the footprint need the (expensive)
+	// point-in-polygon test, done in parallel below.
+	std::vector<std::pair<uint32_t, const gpc_polygon *> > todo;
+
 	// debugging statistics
 	int nstars[2] = { 0, 0 };
 	for(size_t row=begin; row < end; row++)
 	{
 		if(hidden(row)) { continue; }
 
-		// clip everything outside the footprint polygon
 		int projIdx = pIdx(row);
 		nstars[projIdx]++;
 
-		Radians x, y;
- 		x = projXY(row, 0);
- 		y = projXY(row, 1);
-
-		partitioned_skymap *skymap = hemispheres[projIdx].sky;
-		std::pair<int, int> XY;
-		XY.first = (int)((x - skymap->x0) / skymap->dx);
-		XY.second = (int)((y - skymap->y0) / skymap->dx);
-
-		typeof(skymap->skymap.begin()) it = skymap->skymap.find(XY);
-		if(it == skymap->skymap.end()) { continue; }
-
-		// check that the star is inside survey footprint, reject if it's not
-		gpc_polygon &poly = it->second.poly;
-		gpc_vertex vtmp = { x, y };
+		const hemisphere &h = hemispheres[projIdx];
+		int c = h.cell(projXY(row, 0), projXY(row, 1));
+		if(c < 0) { continue; }	// CELL_INSIDE, or CELL_NONE (not covered by the skymap at all)
 
-		bool infoot = in_polygon(vtmp, poly);
-		if(!infoot) { hidden(row) = 1; }
+		todo.push_back(std::make_pair((uint32_t)row, h.partial[c]));
 	}
 
+	// clip everything outside the footprint polygon
+	cpu_kernel_pool::run(todo.size(), clip_partial(todo, in));
+
 	DLOG(verb1) << "nstars north: " << nstars[0];
 	DLOG(verb1) << "nstars south: " << nstars[1];
+	DLOG(verb1) << "nstars tested against the footprint polygon: " << todo.size();
 #endif
 	swatch.stop();
 
 	return nextlink->process(in, begin, end, rng);
 }
 
+//
+// Sorting of generated stars (used by skygenHost<T>::drawSources())
+//
+
+// aux. class for sorting the rows.
+struct star_comp
+{
+	cdouble_t::host_t	lb;
+	cint_t::host_t		projIdx;
+	cfloat_t::host_t	XYZ, projXY;
+	cint_t::host_t		comp;
+	cfloat_t::host_t	M, Am, AmInf;
+	cfloat_t::host_t	DM;
+	cint_t::host_t		hidden;
+
+	star_comp(otable &in)
+	{
+		lb      = in.col<double>("lb");
+		projIdx = in.col<int>("projIdx");
+		projXY  = in.col<float>("projXY");
+		XYZ     = in.col<float>("XYZ");
+		comp    = in.col<int>("comp");
+		M       = in.col<float>("absmag");
+		Am      = in.col<float>("Am");
+		AmInf   = in.col<float>("AmInf");
+		DM      = in.col<float>("DM");
+		hidden  = in.col<int>("hidden");
+	}
+
+	bool operator()(const uint32_t a, const uint32_t b) const	// less semantics
+	{
+		return	hidden(a)<  hidden(b)   ||      hidden(a)== hidden(b) && (	// need to sort by hidden first, as other fields may not even be set if hidden is
+			lb(a, 0) <  lb(b, 0)	||	lb(a, 0) == lb(b, 0) && (
+			lb(a, 1) <  lb(b, 1)	||	lb(a, 1) == lb(b, 1) && (
+			DM(a)    <  DM(b)	||	DM(a)    == DM(b) && (
+			M(a)     <  M(b)	||	M(a)     == M(b)  && (
+			Am(a)    <  Am(b)
+			)))));
+	}
+};
+
+// map a double to an unsigned integer with the same ordering
+static inline uint64_t sortable_bits(double x)
+{
+	uint64_t u;
+	memcpy(&u, &x, sizeof(u));
+	return (u >> 63) ? ~u : u | (1ULL << 63);
+}
+
+// LSD radix sort of (key, idx) pairs, by key, in 16-bit digits. Stable.
+// Passes over digits that are the same for all keys are skipped.
+static void radix_sort(std::vector<uint64_t> &key, std::vector<uint32_t> &idx)
+{
+	const int RADIX = 16, NBUCKETS = 1 << RADIX, NPASSES = 64 / RADIX;
+	size_t n = key.size();
+
+	std::vector<size_t> hist(NPASSES*NBUCKETS, 0);
+	FOR(0, n)
+	{
+		uint64_t k = key[i];
+		FORj(p, 0, NPASSES) { hist[p*NBUCKETS + ((k >> (p*RADIX)) & (NBUCKETS-1))]++; }
+	}
+
+	std::vector<uint64_t> key2(n);
+	std::vector<uint32_t> idx2(n);
+	FORj(p, 0, NPASSES)
+	{
+		size_t *h = &hist[p*NBUCKETS];
+		if(h[(key[0] >> (p*RADIX)) & (NBUCKETS-1)] == n) { continue; }
+
+		// histogram -> bucket offsets
+		size_t sum = 0;
+		FOR(0, NBUCKETS) { size_t c = h[i]; h[i] = sum; sum += c; }
+
+		FOR(0, n)
+		{
+			size_t at = h[(key[i] >> (p*RADIX)) & (NBUCKETS-1)]++;
+			key2[at] = key[i];
+			idx2[at] = idx[i];
+		}
+		key.swap(key2);
+		idx.swap(idx2);
+	}
+}
+
+// reorder the first perm.size() rows of a column so that row i becomes row perm[i]
+template<typename T>
+static void gather(const hptr<T, 2> &col, int width, const std::vector<uint32_t> &perm, std::vector<char> &buf)
+{
+	size_t n = perm.size();
+	buf.resize(n*sizeof(T));
+	T *tmp = (T *)&buf[0];
+
+	FORj(k, 0, width)
+	{
+		FOR(0, n) { tmp[i] = col(perm[i], k); }
+		memcpy(&col(0, k), tmp, n*sizeof(T));
+	}
+}
+
+//
+// Sort the stars in the table by (l, b, DM, M, Am), and truncate it to
+// the stars that aren't hidden. Returns the new size of the table.
+//
+// The stars are radix-sorted on l only (ties, if any, are broken with a
+// full comparison), and each column is then permuted in a single pass.
+//
+size_t sort_stars(otable &in)
+{
+	star_comp sc(in);
+	size_t n = in.size();
+
+	// sort keys of visible stars (hidden ones are dropped)
+	std::vector<uint64_t> key;
+	std::vector<uint32_t> idx;
+	key.reserve(n);
+	idx.reserve(n);
+	FOR(0, n)
+	{
+		if(sc.hidden(i)) { continue; }
+
+		key.push_back(sortable_bits(sc.lb(i, 0)));
+		idx.push_back(i);
+	}
+	size_t nvisible = idx.size();
+	if(nvisible)
+	{
+		radix_sort(key, idx);
+	}
+
+	// break the ties in l
+	for(size_t i = 0, j; i < nvisible; i = j)
+	{
+		for(j = i+1; j < nvisible && key[j] == key[i]; j++);
+		if(j - i > 1)
+		{
+			std::sort(idx.begin() + i, idx.begin() + j, sc);
+		}
+	}
+	std::vector<uint64_t>().swap(key);
+
+	// permute the columns
+	std::vector<char> buf;
+	gather(sc.lb, 2, idx, buf);
+	gather(sc.projIdx, 1, idx, buf);
+	gather(sc.projXY, 2, idx, buf);
+	gather(sc.Am, 1, idx, buf);
+	gather(sc.AmInf, 1, idx, buf);
+	gather(sc.XYZ, 3, idx, buf);
+	gather(sc.comp, 1, idx, buf);
+	gather(sc.M, 1, idx, buf);
+	gather(sc.DM, 1, idx, buf);
+	FOR(0, nvisible) { sc.hidden(i) = 0; }
+
+	in.set_size(nvisible);
+	return nvisible;
+}
+
+//
+// skygenBatchQueue -- hands the generated batches over to the pipeline
+//
+struct skygenBatchQueue::impl
+{
+	osink *nextlink;
+	rng_t &rng;
+
+	std::vector<boost::shared_ptr<otable> > owned;	// tables allocated in addition to the pipeline's
+	std::deque<otable *> empty, full;		// tables available for generation, and waiting for (or in) processing
+
+	boost::mutex mx;
+	boost::condition_variable cv;
+	boost::thread worker;
+	bool stopping;
+
+	size_t stored;					// stars stored by the pipeline since the last drain()
+	thread_error error;				// exception thrown by the pipeline (rethrown by the next acquire(), submit() or drain())
+	bool failed;					// the pipeline threw; don't process any more tables
+
+	impl(otable &t, osink *nextlink_, rng_t &rng_, int depth)
+		: nextlink(nextlink_), rng(rng_), stopping(false), stored(0), failed(false)
+	{
+		empty.push_back(&t);
+		FOR(1, depth)
+		{
+			owned.push_back(boost::shared_ptr<otable>(new otable(t.capacity(), "")));
+			owned.back()->copy_structure(t);
+			empty.push_back(owned.back().get());
+		}
+
+		if(depth > 1)
+		{
+			worker = boost::thread(boost::bind(&impl::run, this));
+			MLOG(verb2) << "Overlapping generation with the pipeline (" << depth << " tables in flight).";
+		}
+	}
+
+	~impl()
+	{
+		{
+			boost::mutex::scoped_lock lock(mx);
+			stopping = true;
+			cv.notify_all();
+		}
+		if(worker.joinable()) { worker.join(); }
+	}
+
+	// process table t in the pipeline (called without mx locked)
+	void process(otable &t)
+	{
+		if(t.size() == 0 || failed) { return; }
+
+		thread_error err;
+		try
+		{
+			stored += nextlink->process(t, 0, t.size(), rng);
+		}
+		catch(...)
+		{
+			err.capture();
+		}
+
+		if(!err.empty())
+		{
+			boost::mutex::scoped_lock lock(mx);
+			error = err;
+			failed = true;
+		}
+	}
+
+	// the pipeline thread
+	void run()
+	{
+		activeDevice dev(-1);	// this thread never uses the GPU
+
+		boost::mutex::scoped_lock lock(mx);
+		while(true)
+		{
+			while(full.empty() && !stopping) { cv.wait(lock); }
+			if(full.empty()) { return; }
+
+			otable *t = full.front();
+			lock.unlock();
+			process(*t);
+			lock.lock();
+
+			full.pop_front();
+			empty.push_back(t);
+			cv.notify_all();
+		}
+	}
+};
+
+skygenBatchQueue::skygenBatchQueue(otable &t, osink *nextlink, rng_t &rng, int depth)
+{
+	q = new impl(t, nextlink, rng, depth);
+}
+
+skygenBatchQueue::~skygenBatchQueue()
+{
+	delete q;
+}
+
+otable &skygenBatchQueue::acquire()
+{
+	boost::mutex::scoped_lock lock(q->mx);
+	while(q->empty.empty() && q->error.empty()) { q->cv.wait(lock); }
+	q->error.rethrow();	// don't generate stars the pipeline won't take
+
+	otable *t = q->empty.front();
+	q->empty.pop_front();
+	t->clear();
+	return *t;
+}
+
+void skygenBatchQueue::submit(otable &t)
+{
+	if(!q->worker.joinable())
+	{
+		// no pipeline thread; process right away
+		q->empty.push_back(&t);
+		if(t.size()) { q->stored += q->nextlink->process(t, 0, t.size(), q->rng); }
+		return;
+	}
+
+	boost::mutex::scoped_lock lock(q->mx);
+	q->error.rethrow();
+	q->full.push_back(&t);
+	q->cv.notify_all();
+}
+
+size_t skygenBatchQueue::drain()
+{
+	boost::mutex::scoped_lock lock(q->mx);
+	while(!q->full.empty()) { q->cv.wait(lock); }
+
+	q->error.rethrow();
+
+	size_t stored = q->stored;
+	q->stored = 0;
+	return stored;
+}
+
 #include "../gpulog/gpulog.h"
 #include "../gpulog/lprintf.h"
 extern gpulog::host_log hlog;
@@ -23,50 +23,20 @@
 #include "../pipeline.h"
 #include "analysis.h"
 
+#include "binarystream.h"
+
 #include <iomanip>
-#include <ext/numeric>	// for iota
+#include <fstream>
+#include <limits>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits/has_trivial_copy.hpp>
+#include <boost/type_traits/has_trivial_destructor.hpp>
+#include <unistd.h>
 
 #include <astro/useall.h>
 
 /***********************************************************************/
 
-// aux. class for sorting the rows. Used in skygenHost<T>::drawSources().
-struct star_comp
-{
-	cdouble_t::host_t	lb;
-	cint_t::host_t		projIdx;
-	cfloat_t::host_t	XYZ, projXY;
-	cint_t::host_t		comp;
-	cfloat_t::host_t	M, Am, AmInf;
-	cfloat_t::host_t	DM;
-	cint_t::host_t		hidden;
-
-	star_comp(otable &in)
-	{
-		lb      = in.col<double>("lb");
-		projIdx = in.col<int>("projIdx");
-		projXY  = in.col<float>("projXY");
-		XYZ     = in.col<float>("XYZ");
-		comp    = in.col<int>("comp");
-		M       = in.col<float>("absmag");
-		Am      = in.col<float>("Am");
-		AmInf   = in.col<float>("AmInf");
-		DM      = in.col<float>("DM");
-		hidden  = in.col<int>("hidden");
-	}
-
-	bool operator()(const size_t a, const size_t b) const	// less semantics
-	{
-		return	hidden(a)<  hidden(b)   ||      hidden(a)== hidden(b) && (	// need to sort by hidden first, as other fields may not even be set if hidden is
-			lb(a, 0) <  lb(b, 0)	||	lb(a, 0) == lb(b, 0) && (
-			lb(a, 1) <  lb(b, 1)	||	lb(a, 1) == lb(b, 1) && (
-			DM(a)    <  DM(b)	||	DM(a)    == DM(b) && (
-			M(a)     <  M(b)	||	M(a)     == M(b)  && (
-			Am(a)    <  Am(b)
-			)))));
-	}
-};
-
 template<typename T>
 skygenHost<T>::skygenHost()
 {
@@ -75,6 +45,7 @@ skygenHost<T>::skygenHost()
 	cpu_maxCount = NULL;
 	cpu_state = NULL;
 	rng = NULL;
+	privateRNG = false;
 	cpurng = NULL;
 
 	this->pixels = 0;
@@ -83,6 +54,7 @@ skygenHost<T>::skygenHost()
 	this->countsCovered = 0;
 	this->rhoHistograms = 0;
 	this->maxCount = 0;
+	this->lfSum = 0;
 
 	this->norm = 1.f;
 	this->ks.constructor();
@@ -95,12 +67,14 @@ skygenHost<T>::~skygenHost()
 	delete [] cpu_hist;
 	delete [] cpu_maxCount;
 	delete [] cpu_state;
+	if(privateRNG) { gpu_rng_t::free_private(*(gpu_rng_t *)rng); }
 	delete rng;
 
 	this->pixels.free();
 	this->counts.free();
 	this->countsCovered.free();
 	this->nstars.free();
+	this->lfSum.free();
 
 	this->ks.destructor();
 }
@@ -200,6 +174,15 @@ void skygenHost<T>::upload(bool draw, int pixfrom, int pixto)
 	this->pixels.free();
 	this->pixels.upload(cpu_pixels + pixfrom, this->npixels);
 
+	// the most diagonals in a beam's cell range (see integrate_collapsed)
+	this->ndiag = 0;
+	FOR(0, this->npixels)
+	{
+		const pencilBeam &pix = cpu_pixels[pixfrom + i];
+		int x = pix.im1 - pix.im0, y = pix.iM1 - pix.iM0;
+		if(x && y) { this->ndiag = std::max(this->ndiag, x + y - 1); }
+	}
+
 	if(!draw)
 	{
 		cpu_countsCoveredPerBeam = cuxSmartPtr<float>(this->nthreads, this->npixels);
@@ -261,10 +244,16 @@ bool skygenHost<T>::init(
 		reset_absmag(M0, M1, this->dM);
 		MLOG(verb2) << " : Restricting absolute magnitude range to " << M0 << " - " << M1;
 	}
+	this->collapseCounts = sc.collapseCounts && T::separable && this->dm == this->dM;
 
-	// setup pixels
+	// setup pixels, sweeping all cells unless restricted by bound_cells()
 	cpu_pixels = new pencilBeam[this->npixels];
-	FOR(0, this->npixels) { cpu_pixels[i] = pixels[i]; }
+	FOR(0, this->npixels)
+	{
+		pencilBeam &pix = cpu_pixels[i] = pixels[i];
+		pix.im0 = std::max(pix.im0, 0); pix.im1 = std::min(pix.im1, this->nm);
+		pix.iM0 = std::max(pix.iM0, 0); pix.iM1 = std::min(pix.iM1, this->nM);
+	}
 
 	// For debugging/stats
 	this->lrho0 = -3.5f;
@@ -296,12 +285,122 @@ bool skygenHost<T>::init(
 	return true;
 }
 
+//
+// Find the cells in each beam that can contain observable stars, and sweep
+// only those. A cell (im, iM) can't if it's outside of the distance limits,
+// or if it's beyond the flux limit even with the minimum extinction along
+// the beam (as computed by find_extinction_minima). The kernel applies
+// exactly these tests to each cell, so pruning doesn't change the counts;
+// the bounds are padded to stay conservative with respect to its roundoff.
+//
+// The flux test is monotonic in both im and iM (the extinction in ext_beam
+// grows with DM), so the cells that pass it are found with a single walk
+// along the boundary.
+//
+template<typename T>
+void skygenHost<T>::bound_cells(cuxTexture<float, 3> &ext_beam)
+{
+	if(this->dm != this->dM) { return; }	// the kernel assumes distance is constant along the diagonals (see load_skyPixelizationConfig)
+
+	const double eps = 1e-3;		// padding of the bounds, in magnitudes
+
+	// the range of DM that passes the distance limits test
+	const double inf = std::numeric_limits<double>::infinity();
+	double DMmin = -inf, DMmax = inf;
+	if(this->dmin || this->dmax)
+	{
+		if(this->dmin > 0) { DMmin = 5.*log10(this->dmin) - 5.; }
+		DMmax = this->dmax > 0 ? 5.*log10(this->dmax) - 5. : -inf;	// nothing passes if dmax == 0 (see the kernel)
+	}
+
+	hptr<float, 3> Am = ext_beam;
+	const int nx = ext_beam.width(), ny = ext_beam.height(), nz = ext_beam.depth();
+	const afloat2 tcz = ext_beam.coords[2];
+
+	double ncells = 0;					// number of observable cells
+	double nswept = 0;					// number of cells within the bounds
+	FORj(p, 0, this->npixels)
+	{
+		pencilBeam &pix = cpu_pixels[p];
+		int xidx = std::min(std::max(pix.extIdx / 2048, 0), nx-1);
+		int yidx = std::min(std::max(pix.extIdx % 2048, 0), ny-1);
+
+		pix.im0 = this->nm; pix.im1 = 0;
+		pix.iM0 = this->nM; pix.iM1 = 0;
+
+		int iMflux = this->nM;	// cells with iM >= iMflux are beyond the flux limit (nonincreasing with im)
+		for(int im = 0; im != this->nm && iMflux != 0; im++)
+		{
+			double m = this->m0 + im*(double)this->dm;
+			double DM0 = m - this->M1;	// DM of cell (im, 0)
+
+			for(; iMflux != 0; iMflux--)
+			{
+				// the extinction at a slightly lower DM is a lower bound (ext_beam is point sampled, and nondecreasing in DM)
+				double DM = DM0 + (iMflux-1)*(double)this->dM;
+				double z = floor((DM - eps - tcz.x) * tcz.y + 0.5);
+				int iz = z < 0 ? 0 : z > nz-1 ? nz-1 : (int)z;
+				if(m + Am(xidx, yidx, iz) <= this->m1 + eps) { break; }
+			}
+
+			double lo = std::max(0., ceil((DMmin - eps - DM0) / this->dM));
+			double hi = std::min((double)iMflux, floor((DMmax + eps - DM0) / this->dM) + 1.);
+			if(lo >= hi) { continue; }
+
+			pix.im0 = std::min(pix.im0, im);
+			pix.im1 = im + 1;
+			pix.iM0 = std::min(pix.iM0, (int)lo);
+			pix.iM1 = std::max(pix.iM1, (int)hi);
+			ncells += hi - lo;
+		}
+
+		if(pix.im0 >= pix.im1)
+		{
+			// nothing is observable in this beam
+			pix.im0 = pix.im1 = pix.iM0 = pix.iM1 = 0;
+			continue;
+		}
+		nswept += (double)(pix.im1 - pix.im0) * (pix.iM1 - pix.iM0);
+	}
+
+	const double nall = (double)this->npixels * this->nm * this->nM;
+	MLOG(verb2) << "Comp. " << componentMap.compID(this->model.component()) << " cells : " << std::setprecision(3)
+		<< 100. * ncells / nall << "% observable, sweeping " << 100. * nswept / nall << "%.";
+}
+
+//
+// Compute and upload the prefix sums of the model's LFs over absolute
+// magnitude bins, lfSum[k*(nM+1) + iM] = sum_{i < iM} LF_k(M1 - i*dM),
+// used by the collapsed counting pass (see skygenGPU<T>::integrate_collapsed).
+//
+template<typename T>
+void skygenHost<T>::upload_lf_sums()
+{
+	const int nlf = this->model.nlf(), nM = this->nM;
+	std::vector<float> M(nM), phi(nM);
+	FOR(0, nM) { M[i] = this->M1 - i*this->dM; }	// as computed by the kernel
+
+	std::vector<NVTYPE> sums(nlf*(nM+1));
+	FORj(k, 0, nlf)
+	{
+		this->model.sample_lf(model_host_state, k, &phi[0], &M[0], nM);
+
+		NVTYPE *P = &sums[k*(nM+1)];
+		P[0] = 0.;
+		FOR(0, nM) { P[i+1] = P[i] + phi[i]; }
+	}
+
+	this->lfSum.free();
+	this->lfSum.upload(&sums[0], sums.size());
+}
+
 template<typename T>
-void skygenHost<T>::initRNG(rng_t &cpurng)	// initialize the random number generator from CPU RNG
+void skygenHost<T>::initRNG(rng_t &cpurng, bool shared)	// initialize the random number generator from CPU RNG
 {
 	// initialize rng
 	this->cpurng = &cpurng;
-	rng = new gpu_rng_t(cpurng);
+	privateRNG = !shared;
+	rng = shared ? new gpu_rng_t(cpurng) : new gpu_rng_t(gpu_rng_t::create_private(cpurng));
 }
 
 template<typename T>
@@ -320,7 +419,138 @@ void skygenHost<T>::setDensityNorm(float norm_)	// set the density normalization
 }
 
 template<typename T>
-double skygenHost<T>::integrateCounts(float &runtime, const char *denmapPrefix)
+bool skygenHost<T>::fusable(fusablePart &part) const	// describe the model for fusion with other models
+{
+	// fusedModel keeps bytewise copies of its parts
+	static const bool fusing = fusedModelType<T>::id != FUSED_NONE;
+	BOOST_STATIC_ASSERT(!fusing || sizeof(T) <= FUSED_MAXPARTSIZE);
+	BOOST_STATIC_ASSERT(!fusing || (boost::has_trivial_copy<T>::value && boost::has_trivial_destructor<T>::value));
+
+	part.type = fusedModelType<T>::id;
+	if(part.type == FUSED_NONE) { return false; }
+
+	part.model = &this->model;
+	part.size  = sizeof(this->model);
+	part.comp  = this->model.component();
+	part.lf    = this->model_host_state.lf;
+	part.M0    = this->M0;
+	part.M1    = this->M1 + 0.5*this->dM;	// M1 is the center of the last bin (see reset_absmag)
+
+	return true;
+}
+
+//
+// Hash of all inputs that integrateCounts() depends on. Note that the RNG
+// seed and the kernel configuration (number of threads) are not among
+// them; the counts only depend on the latter through roundoff.
+//
+template<typename T>
+uint64_t skygenHost<T>::counts_key(const countsCache &cache)
+{
+	skygenHash h;
+	h.add(cache.key);
+
+	// binning and limits
+	h.add(this->m0); h.add(this->m1); h.add(this->dm);
+	h.add(this->M0); h.add(this->M1); h.add(this->dM);
+	h.add(this->dmin); h.add(this->dmax);
+	h.add(this->nm); h.add(this->nM);
+	h.add(this->collapseCounts);
+	FOR(0, 2) { h.add(this->proj[i].l0); h.add(this->proj[i].b0); }
+
+	// pixelization and footprint
+	h.add(this->npixels);
+	FOR(0, this->npixels)
+	{
+		const pencilBeam &pb = cpu_pixels[i];
+		h.add(pb.X); h.add(pb.Y); h.add(pb.projIdx); h.add(pb.dx); h.add(pb.dA);
+		h.add(pb.coveredFraction); h.add(pb.extIdx);
+		h.add(pb.im0); h.add(pb.im1); h.add(pb.iM0); h.add(pb.iM1);
+	}
+
+	// the model's parameters and host state
+	this->model.hash_state(model_host_state, h);
+	h.add(this->norm);
+
+	return h.h;
+}
+
+static const int COUNTS_CACHE_MAGIC = 0x436e7443;	// "CtnC"
+static const int COUNTS_CACHE_VERSION = 2;
+
+//
+// Load the results of integrateCounts() from file fn. Returns false if the
+// file doesn't exist or has been computed for a different key.
+//
+template<typename T>
+bool skygenHost<T>::load_counts(const std::string &fn, uint64_t key, std::vector<double> &den)
+{
+	std::ifstream f(fn.c_str(), std::ios::binary);
+	if(!f) { return false; }
+	ibinarystream in(f, fn);
+
+	int magic, version, npixels, nhistbins;
+	uint64_t key2;
+	in >> magic >> version >> key2 >> npixels >> nhistbins;
+	if(!f || magic != COUNTS_CACHE_MAGIC || version != COUNTS_CACHE_VERSION || key2 != key ||
+		npixels != this->npixels || nhistbins != this->nhistbins)
+	{
+		MLOG(verb1) << "WARNING: Ignoring incompatible starcounts cache file " << fn << ".";
+		return false;
+	}
+
+	delete [] cpu_hist;
+	delete [] cpu_maxCount;
+	cpu_hist = new int[this->nhistbins];
+	cpu_maxCount = new float[this->nthreads];
+
+	// only the overall maximum density is stored (the file may have been
+	// written with a different number of threads); give it to every thread
+	float maxCount;
+	in >> nstarsExpectedToGenerate >> nstarsExpected >> maxCount;
+	in.read((char *)cpu_hist, sizeof(*cpu_hist)*this->nhistbins);
+	in.read((char *)&den[0], sizeof(den[0])*den.size());
+	FOR(0, this->nthreads) { cpu_maxCount[i] = maxCount; }
+
+	if(!f)
+	{
+		MLOG(verb1) << "WARNING: Ignoring truncated starcounts cache file " << fn << ".";
+		return false;
+	}
+	return true;
+}
+
+//
+// Store the results of integrateCounts() to file fn. The file is written
+// under a temporary name and renamed, so concurrent runs never see a
+// partially written cache.
+//
+template<typename T>
+void skygenHost<T>::store_counts(const std::string &fn, uint64_t key, const std::vector<double> &den)
+{
+	std::string tmpfn = fn + ".tmp." + str(getpid());
+	{
+		std::ofstream f(tmpfn.c_str(), std::ios::binary);
+		obinarystream out(f, tmpfn);
+
+		float maxCount = *std::max_element(cpu_maxCount, cpu_maxCount + this->nthreads);
+		out << COUNTS_CACHE_MAGIC << COUNTS_CACHE_VERSION << key << this->npixels << this->nhistbins;
+		out << nstarsExpectedToGenerate << nstarsExpected << maxCount;
+		out.write((const char *)cpu_hist, sizeof(*cpu_hist)*this->nhistbins);
+		out.write((const char *)&den[0], sizeof(den[0])*den.size());
+
+		if(!f)
+		{
+			MLOG(verb1) << "WARNING: Failed to write starcounts cache file " << tmpfn << ".";
+			unlink(tmpfn.c_str());
+			return;
+		}
+	}
+	rename(tmpfn.c_str(), fn.c_str());
+}
+
+template<typename T>
+double skygenHost<T>::integrateCounts(float &runtime, const char *denmapPrefix, const countsCache &cache)
 {
 	//
 	// First pass: compute total expected starcounts
@@ -328,43 +558,52 @@ double skygenHost<T>::integrateCounts(float &runtime, const char *denmapPrefix)
 	swatch.reset();
 	swatch.start();
 
-	FILE *fp = NULL;
-	if(denmapPrefix && denmapPrefix[0] != 0)
+	int lastpix = this->npixels;
+	std::vector<double> den(lastpix);	// expected starcounts in each beam
+
+	// Look for the results in the cache
+	bool cached = false;
+	uint64_t key = 0;
+	std::string cacheFile;
+	if(!cache.dir.empty())
 	{
-		std::string skyDensityMapFile(denmapPrefix);
-		skyDensityMapFile += "." + str(this->model.component()) + ".txt";
+		key = counts_key(cache);
 
-		fp = fopen(skyDensityMapFile.c_str(), "w");
-		ASSERT(fp != NULL);
+		char hex[17];
+		sprintf(hex, "%016llx", (unsigned long long)key);
+		cacheFile = cache.dir + "/counts." + hex + ".bin";
+
+		cached = load_counts(cacheFile, key, den);
 	}
 
-	int lastpix = this->npixels;
-	std::vector<double> den(lastpix);
+	if(!cached)
+	{
+		// Process in blocks of PIXBLOCK pixels, where PIXBLOCK is computed
+		// so that countsCoveredPerBeam array has about ~10M entries max
+		const int PIXBLOCK = 1024*1024*2 / this->nthreads;
+		//const int PIXBLOCK = this->nthreads;
+		ASSERT(PIXBLOCK >= 1);
+		//std::cerr << "npix, PIXELBLOCK = " << lastpix << " " << PIXBLOCK << "\n";
 
-	// Process in blocks of PIXBLOCK pixels, where PIXBLOCK is computed
-	// so that countsCoveredPerBeam array has about ~10M entries max
-	const int PIXBLOCK = 1024*1024*2 / this->nthreads;
-	//const int PIXBLOCK = this->nthreads;
-	ASSERT(PIXBLOCK >= 1);
-	//std::cerr << "npix, PIXELBLOCK = " << lastpix << " " << PIXBLOCK << "\n";
+		int step = (int)ceil(((float)lastpix/PIXBLOCK)/50);
+		ticker tick("Integrating", step);
 
-	int step = (int)ceil(((float)lastpix/PIXBLOCK)/50);
-	ticker tick("Integrating", step);
+		if(this->collapseCounts)
+		{
+			upload_lf_sums();
+		}
 
-	int startpix = 0;
-	while(startpix < lastpix)
-	{
-		tick.tick();
-		int endpix = std::min(startpix + PIXBLOCK, lastpix);
+		int startpix = 0;
+		while(startpix < lastpix)
+		{
+			tick.tick();
+			int endpix = std::min(startpix + PIXBLOCK, lastpix);
 
-		upload(false, startpix, endpix);
-		compute(false);
-		download(false, startpix, endpix);
+			upload(false, startpix, endpix);
+			compute(false);
+			download(false, startpix, endpix);
 
-		// sum up and print out the on-sky densities, if requested
-		if(fp != NULL)
-		{
-			int npix = endpix - startpix;
+			// sum up the on-sky densities
 			for(int px = startpix; px != endpix; px++)
 			{
 				double rho = 0;
@@ -374,22 +613,37 @@ double skygenHost<T>::integrateCounts(float &runtime, const char *denmapPrefix)
 				}
 				den[px] = rho;
 				//std::cout << cpu_countsCoveredPerBeam(100, px-startpix) << " " << rho << "\n";
-				
-				Radians l, b;
-				pencilBeam pb = cpu_pixels[px];
-				this->proj[pb.projIdx].deproject(l, b, pb.X, pb.Y);
-				l *= 180./dbl_pi; b *= 180./dbl_pi;
-				fprintf(fp, "% 9.4f % 8.4f %12.2f   % 8.4f % 8.4f %d\n", l, b, rho, pb.X, pb.Y, pb.projIdx);
 			}
+
+			startpix = endpix;
 		}
+		this->npixels = lastpix;
+		tick.close();
 
-		startpix = endpix;
+		if(!cacheFile.empty())
+		{
+			store_counts(cacheFile, key, den);
+		}
 	}
-	this->npixels = lastpix;
-	tick.close();
 
-	if(fp)
+	// print out the on-sky densities, if requested
+	if(denmapPrefix && denmapPrefix[0] != 0)
 	{
+		std::string skyDensityMapFile(denmapPrefix);
+		skyDensityMapFile += "." + str(this->model.component()) + ".txt";
+
+		FILE *fp = fopen(skyDensityMapFile.c_str(), "w");
+		ASSERT(fp != NULL);
+
+		for(int px = 0; px != lastpix; px++)
+		{
+			Radians l, b;
+			pencilBeam pb = cpu_pixels[px];
+			this->proj[pb.projIdx].deproject(l, b, pb.X, pb.Y);
+			l *= 180./dbl_pi; b *= 180./dbl_pi;
+			fprintf(fp, "% 9.4f % 8.4f %12.2f   % 8.4f % 8.4f %d\n", l, b, den[px], pb.X, pb.Y, pb.projIdx);
+		}
+
 		fclose(fp);
 
 		double total = accumulate(den.begin(), den.end(), 0.);
@@ -401,25 +655,32 @@ double skygenHost<T>::integrateCounts(float &runtime, const char *denmapPrefix)
 		}
 	}
 
-	std::ostringstream ss;
-	ss << "Histogram:     log(rho) |";
-	for(int i=0; i != this->nhistbins; i++)
+	if(this->collapseCounts)
 	{
-		ss << std::setw(8) << this->lrho0+i*this->dlrho << "|";
+		MLOG(verb2) << "Histogram:     not computed (the densities were integrated one distance bin at a time; set collapseCounts = 0 to compute it).";
 	}
-	MLOG(verb2) << ss.str();
-	ss.str("");
-	ss << "Histogram: rho=" << pow10f(this->lrho0 - this->dlrho*0.5) << "-->|";
-	for(int i=0; i != this->nhistbins; i++)
+	else
 	{
-		ss << std::setw(8) << this->cpu_hist[i] << "|";
+		std::ostringstream ss;
+		ss << "Histogram:     log(rho) |";
+		for(int i=0; i != this->nhistbins; i++)
+		{
+			ss << std::setw(8) << this->lrho0+i*this->dlrho << "|";
+		}
+		MLOG(verb2) << ss.str();
+		ss.str("");
+		ss << "Histogram: rho=" << pow10f(this->lrho0 - this->dlrho*0.5) << "-->|";
+		for(int i=0; i != this->nhistbins; i++)
+		{
+			ss << std::setw(8) << this->cpu_hist[i] << "|";
+		}
+		ss << "<--" << pow10f(this->lrho0+(this->nhistbins-0.5)*this->dlrho);
+		MLOG(verb2) << ss.str();
 	}
-	ss << "<--" << pow10f(this->lrho0+(this->nhistbins-0.5)*this->dlrho);
-	MLOG(verb2) << ss.str();
 
 	MLOG(verb1) << "Comp. " << componentMap.compID(this->model.component()) << " counts : " << std::setprecision(9)
 		<< this->nstarsExpectedToGenerate << " to generate, "
-		<< this->nstarsExpected << " within footprint.";
+		<< this->nstarsExpected << " within footprint" << (cached ? " (from cache)." : ".");
 
 	swatch.stop();
 	runtime = swatch.getTime();
@@ -432,19 +693,22 @@ double skygenHost<T>::integrateCounts(float &runtime, const char *denmapPrefix)
 // Draw the catalog
 //
 template<typename T>
-size_t skygenHost<T>::drawSources(otable &in, osink *nextlink, float &runtime)
+size_t skygenHost<T>::drawSources(skygenBatchQueue &out, float &runtime)
 {
 	swatch.reset();
 	swatch.start();
 
-	this->output_table_capacity = in.capacity();
-
 	this->ks.alloc(this->nthreads);
 	uint64_t totalGenerated = 0, totalStored = 0;
 	bool generated_all = false;
 	while(!generated_all)
 	{
 		// setup output destination
+		swatch.stop();
+		otable &in = out.acquire();
+		swatch.start();
+		this->output_table_capacity = in.capacity();
+
 		this->stars.lb      = in.col<double>("lb");
 		this->stars.projIdx = in.col<int>("projIdx");
 		this->stars.projXY  = in.col<float>("projXY");
@@ -469,46 +733,9 @@ size_t skygenHost<T>::drawSources(otable &in, osink *nextlink, float &runtime)
 			sort_sw.reset();
 			sort_sw.start();
 
-			//
-			// sort the generated stars by l,b,DM,M
-			//
-			std::vector<size_t> s(this->stars_generated);
-			__gnu_cxx::iota(s.begin(), s.end(), size_t(0));
-			std::vector<size_t> h2a(s), a2h(s);
-			star_comp sc(in);
-			std::sort(s.begin(), s.end(), sc);
-			
-			FOR(0, s.size())
-			{
-				#define  SWAP(arr)    std::swap(sc.arr(i),    sc.arr(j))
-				#define SWAP1(arr, k) std::swap(sc.arr(i, k), sc.arr(j, k))
-
-				int hi = a2h[i];
-				int hj = s[i];
-				int j = h2a[hj];
-
-				SWAP1(lb, 0);	SWAP1(lb, 1);
-				SWAP(projIdx);
-				SWAP1(projXY, 0);	SWAP1(projXY, 1);
-				SWAP(Am); SWAP(AmInf);
-				SWAP1(XYZ, 0);	SWAP1(XYZ, 1);	SWAP1(XYZ, 2);
-				SWAP(comp);
-				SWAP(M);
-				SWAP(DM);
-				SWAP(hidden);
-
-				std::swap(h2a[hi], h2a[hj]);
-				std::swap(a2h[i],  a2h[j]);
-
-				#undef SWAP
-				#undef SWAP1
-			}
-
-			// find the first star that is hidden, and truncate the table there
-			int *h0 = std::upper_bound(sc.hidden.ptr, sc.hidden.ptr + in.size(), 0);
-			size_t size = h0 - sc.hidden.ptr;
+			// sort the generated stars by l,b,DM,M, and drop the hidden ones
+			size_t size = sort_stars(in);
 			DLOG(verb1) << "Truncating table to " << size << " elements (others are hidden).";
-			in.set_size(size);
 
 			sort_sw.stop();
 			DLOG(verb1) << "Sort time: " << sort_sw.getTime();
@@ -519,10 +746,7 @@ size_t skygenHost<T>::drawSources(otable &in, osink *nextlink, float &runtime)
 
 		swatch.stop();
 		totalGenerated += this->stars_generated;
-		if(in.size())
-		{
-			totalStored += nextlink->process(in, 0, in.size(), *cpurng);
-		}
+		out.submit(in);
 		swatch.start();
 
 		if(!generated_all)
@@ -533,6 +757,10 @@ size_t skygenHost<T>::drawSources(otable &in, osink *nextlink, float &runtime)
 		}
 	};
 
+	swatch.stop();
+	totalStored = out.drain();
+	swatch.start();
+
 	double sigma = (totalGenerated - this->nstarsExpectedToGenerate) / sqrt(this->nstarsExpectedToGenerate);
 	char sigmas[50]; sprintf(sigmas, "%.1f", sigma);
 	MLOG(verb1) << "Comp. "<< componentMap.compID(this->model.component()) << " completed: " << totalStored << " stars (" << totalGenerated << " generated, " << sigmas << " sigma from " << this->nstarsExpectedToGenerate << ").";
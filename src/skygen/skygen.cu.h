@@ -126,31 +126,22 @@ public:
 		: gridDimK(gridDim), blockDimK(blockDim), shmemK(0)
 	{}
 
+	// Execute all threads of the kernel on the CPU thread pool. Each emulated
+	// thread sees the same threadIdx/blockIdx it would on the GPU.
 	template<typename K>
 	void launch(K kernel)
 	{
-		threadIdx.x = threadIdx.y = threadIdx.z = 0;
-		blockIdx.x = blockIdx.y = blockIdx.z = 0;
+		uint32_t nthreads = blockDimK.x*blockDimK.y*blockDimK.z * gridDimK.x*gridDimK.y*gridDimK.z;
 
-		::blockDim = blockDimK;
-		::gridDim = gridDimK;
-
-		uint32_t nthreads = blockDim.x*blockDim.y*blockDim.z * gridDim.x*gridDim.y*gridDim.z;
-
-		// Single-thread implementation
-		for(uint32_t i=0; i != nthreads; i++)
-		{
-			kernel();
-
-			threadIdx.x++;
-			if(threadIdx.x == blockDim.x) { threadIdx.x = 0; blockIdx.x++; }
-			if(blockIdx.x  == gridDim.x) { blockIdx.x = 0;  blockIdx.y++; }
-			if(blockIdx.y  == gridDim.y) { blockIdx.y = 0;  blockIdx.z++; }
-		}
+		cpu_kernel_slice<K> slice = { kernel,
+			{ gridDimK.x, gridDimK.y, gridDimK.z },
+			{ blockDimK.x, blockDimK.y, blockDimK.z } };
+		cpu_kernel_pool::run(nthreads, slice);
 	}
 };
 
-inline int atomicAdd(int *ptrx, int y) { int tmp = *ptrx; *ptrx += y; return tmp; }
+// Kernels running on the thread pool reserve output slots concurrently
+inline int atomicAdd(int *ptrx, int y) { return __sync_fetch_and_add(ptrx, y); }
 
 #define CPUGPU(name) cpu_##name
 
@@ -251,18 +242,11 @@ __device__ inline int ijToDiagIndex(int i, int j, const int x, const int y)
 } 
 
 /**
-	Given a 'diagonal' linear index in (X,Y,M,m) space, decompose it into ilb, iM, im
-	and k indices that can be used to compute physical coordinates.
+	Given a 'diagonal' linear index k within a beam's x*y cell range, decompose
+	it into the (i, j) cell (relative to the start of the range).
 */
-__device__ inline bool diagIndexToIJ(int &ilb, int &i, int &j, int &k, const int x, const int y)
+__device__ inline bool diagIndexToIJ(int &i, int &j, const int k, const int x, const int y)
 {
-	int kmax = x*y;
-	if(k >= kmax)
-	{
-		ilb += k / kmax;
-		k %= kmax;
-	}
-
 	int l = x < y ? x : y; // smaller dimension
 	int m = x < y ? y : x; // bigger dimension
 	int d;
@@ -299,13 +283,37 @@ __device__ inline bool diagIndexToIJ(int &ilb, int &i, int &j, int &k, const int
 	return true;
 }
 
+/**
+	Find the beam and its cell (i, j) with the linear index k in (XY,M,m) space.
+	k is relative to the first cell of beam ilb; the beams' [im0, im1) x [iM0, iM1)
+	cells follow one another, so this steps over the beams k runs past (keeping k
+	relative to the current one). Sets ilb to npixels if k is past the last cell.
+*/
+template<typename T>
+__device__ void skygenGPU<T>::seek(int &ilb, int &i, int &j, int &k, pencilBeam &pix, int &x, int &y) const
+{
+	for(; ilb < npixels; ilb++)
+	{
+		pix = pixels(ilb);
+		x = pix.im1 - pix.im0;
+		y = pix.iM1 - pix.iM0;
+		if(k < x*y) { break; }
+		k -= x*y;
+	}
+	if(ilb >= npixels) { return; }
+
+	diagIndexToIJ(i, j, k, x, y);
+}
+
 /**
 	Diagonally advance the index in (XY,M,m) space. Since most models can be decomposed
 	into LF(M)*den(X,Y,DM), this advancement usually leaves the thread in the same
 	distance bin, allowing the (usually expensive) computation of den() to be cached.
+	Past the last cell of the beam, continues with the first cell of the next nonempty
+	one (updating dir and its cell range x*y).
 */
 template<typename T>
-__device__ bool skygenGPU<T>::advance(int &ilb, int &i, int &j, pencilBeam &dir, const int x, const int y) const
+__device__ bool skygenGPU<T>::advance(int &ilb, int &i, int &j, int &k, pencilBeam &dir, int &x, int &y) const
 {
 	i++; j--;
 
@@ -340,20 +348,27 @@ __device__ bool skygenGPU<T>::advance(int &ilb, int &i, int &j, pencilBeam &dir,
 				i = x - y + j + 2; j = y-1;
 			}
 		}
-		if(i == x)
-		{
-			ilb++;
-			if(ilb != npixels)
-			{
-				dir = pixels(ilb);
-			}
-		}
 	}
 	else
 	{
 		return false;	// no need to recompute distance
 	}
 
+	if(i == x)
+	{
+		// slipped past the last cell; continue with the first cell of the
+		// next beam that has any, keeping k relative to it (see seek())
+		i = 0; j = 0;
+		k -= x*y;
+		for(ilb++; ilb != npixels; ilb++)
+		{
+			dir = pixels(ilb);
+			x = dir.im1 - dir.im0;
+			y = dir.iM1 - dir.iM0;
+			if(x*y) { break; }
+		}
+	}
+
 	return true; // recompute the distance
 }
 
@@ -362,9 +377,12 @@ __device__ bool skygenGPU<T>::advance(int &ilb, int &i, int &j, pencilBeam &dir,
 
 	Take care there's enough space in the output table for the generated
 	stars. If there isn't, ndraw will be != 0 upon return.
+
+	Each star is drawn from its own RNG substream, identified by its cell
+	(ilb, im, iM) and the number of stars left to draw (see skygenGPU<T>::kernel).
 */
 template<typename T>
-__device__ void skygenGPU<T>::draw_stars(int &ndraw, const float &M, const int &im, const pencilBeam &pix, float AmMin) const
+__device__ void skygenGPU<T>::draw_stars(int &ndraw, const float &M, const int &im, const int &iM, const int &ilb, const pencilBeam &pix, float AmMin, typename T::state &ms) const
 {
 	if(!ndraw) { return; }
 
@@ -372,6 +390,8 @@ __device__ void skygenGPU<T>::draw_stars(int &ndraw, const float &M, const int &
 
 	for(; ndraw && idx < stopstars; idx++, ndraw--)
 	{
+		rng.seek(ilb, (iM << 16) | im, ndraw);
+
 		// Draw the position within the pixel
 		float x = pix.X, y = pix.Y;
 		x += pix.dx*(rng.uniform() - 0.5f);
@@ -414,8 +434,7 @@ __device__ void skygenGPU<T>::draw_stars(int &ndraw, const float &M, const int &
 		stars.XYZ(idx, 2) = pos.z;
 
 		// Store the component ID
-		//stars.comp(idx) = model.component(pos.x, pos.y, pos.z, Mtmp, rng);
-		stars.comp(idx) = model.component();
+		stars.comp(idx) = model.component(ms, M, rng);
 
 		// Draw extinction
 		float Am0, Am1;
@@ -470,7 +489,14 @@ template<typename T>
 template<int draw>
 __device__ void skygenGPU<T>::kernel() const
 {
-	int ilb, im, iM, k, ndraw = 0;
+	if(!draw && T::separable && collapseCounts)
+	{
+		integrate_collapsed();
+		return;
+	}
+
+	int ilb, i, j, im, iM, k, ndraw = 0;		// (i, j) is the cell (im, iM) relative to the start of the beam's range
+	int x, y;					// the size of the beam's [im0, im1) x [iM0, iM1) cell range
 	float3 pos;
 	pencilBeam pix;
 	float Am;
@@ -490,6 +516,10 @@ __device__ void skygenGPU<T>::kernel() const
 		if(ks.continuing(tid))
 		{
 			ks.load(tid,   ilb, im, iM, k, bc, pos, D, pix, Am, ms, ndraw);
+			i = im - pix.im0;
+			j = iM - pix.iM0;
+			x = pix.im1 - pix.im0;
+			y = pix.iM1 - pix.iM0;
 		}
 		if(ilb >= npixels) { return; } // this thread has already finished
 		rng.load(tid);
@@ -498,7 +528,7 @@ __device__ void skygenGPU<T>::kernel() const
 		if(ndraw)
 		{
 			float M = M1 - iM*dM;
-			draw_stars(ndraw, M, im, pix, Am);
+			draw_stars(ndraw, M, im, iM, ilb, pix, Am, ms);
 		}
 	}
 
@@ -507,14 +537,21 @@ __device__ void skygenGPU<T>::kernel() const
 	// either sum them up or draw the stars.
 	//
 	// We crawl through this space by incrementing a linear 'diagonal index' k
-	// (TODO: explain this better).
+	// (TODO: explain this better). Only the cells in each beam's
+	// [im0, im1) x [iM0, iM1) range are indexed; the cells outside of it can't
+	// contain observable stars (see skygenHost<T>::bound_cells).
 	//
 	// To evenly distribute work, while still maintaining some locality (i.e.,
 	// not moving between distance bins often), we crawl in blocks of size 'block'
 	// and then jump block*nthreads ahead.
 	//
+	// The distance and extinction of a distance bin are computed only once
+	// the thread hits a cell in it that isn't skipped (when 'stale').
+	//
 	double rhoBeam = 0.f;
 	int ilbPrev = 0;
+	bool stale = false;
+	int imPos = 0; float MPos = 0.f;		// the cell where the thread entered the current distance bin
 	while(ndraw == 0)
 	{
 		// advance the index in (X,Y,M,m) space (indexed by (ilb,iM,im), or linear index k)
@@ -524,18 +561,19 @@ __device__ void skygenGPU<T>::kernel() const
 			// jump block*nthreads
 			bc = block;
 			k += block*nthreads;
-			diagIndexToIJ(ilb, im, iM, k, nm, nM);
+			seek(ilb, i, j, k, pix, x, y);
 			if(ilb >= npixels) { break; }
 
-			pix = pixels(ilb);
 			moved = true;
 		}
 		else
 		{
 			// advance by 1
-			moved = advance(ilb, im, iM, pix, nm, nM);
+			moved = advance(ilb, i, j, k, pix, x, y);
 		}
 		bc--;
+		im = pix.im0 + i;
+		iM = pix.iM0 + j;
 
 		// compute the absolute magnitude and position for this pixel
 		float M = M1 - iM*dM;
@@ -543,9 +581,16 @@ __device__ void skygenGPU<T>::kernel() const
 		{
 			if(ilb >= npixels) { break; }
 
-			// We moved to a new distance bin. Recompute and reset.
-			pos = compute_pos(D, Am, M, im, pix);
+			// We moved to a new distance bin. Recompute and reset (once we hit a cell that isn't skipped).
+			stale = true;
+			imPos = im; MPos = M;
+		}
+
+		if(stale)
+		{
+			pos = compute_pos(D, Am, MPos, imPos, pix);
 			model.setpos(ms, pos.x, pos.y, pos.z);
+			stale = false;
 		}
 
 		// apply distance limits, if they're both nonzero
@@ -568,10 +613,15 @@ __device__ void skygenGPU<T>::kernel() const
 		{
 			if(ndraw == 0)
 			{
+				// the number of stars comes from substream 0 of the cell,
+				// the stars themselves from substreams 1..ndraw. With a
+				// counter-based RNG, this makes the catalog independent
+				// of which thread processes which cell.
+				rng.seek(ilb, (iM << 16) | im, 0);
 				ndraw = rng.poisson(rho);
 			}
 
-			draw_stars(ndraw, M, im, pix, Am);
+			draw_stars(ndraw, M, im, iM, ilb, pix, Am, ms);
 		}
 		else
 		{
@@ -617,6 +667,97 @@ __device__ void skygenGPU<T>::kernel() const
 	}
 }
 
+/**
+	Compute the number of stars in the footprint, for separable models
+	(see modelConcept). Launched instead of kernel<0>() if collapseCounts
+	is set.
+
+	Distance, extinction, and thus the spatial density are constant along
+	each diagonal of (im, iM) space (the distance bins), so the density
+	only needs to be summed over the LF of the cells that pass the flux
+	limit. These are a contiguous run of the diagonal (the fainter im, the
+	sooner a cell is extincted away), and their LF sum is the difference
+	of two prefix sums from lfSum. The work is therefore proportional to
+	the number of (beam, distance bin) pairs, rather than cells.
+
+	The cells that are summed over are exactly those that kernel<0>()
+	would have evaluated, though the distance and extinction of each bin
+	are computed at a (roundoff-level) different point of the diagonal.
+	The density histograms are not computed, and maxCount holds the
+	maximum density of a distance bin (the sum over its cells), rather
+	than of a single cell.
+*/
+template<typename T>
+__device__ void skygenGPU<T>::integrate_collapsed() const
+{
+	double count = 0., countCovered = 0., rhoBeam = 0.;
+	float maxCount1 = 0.f;
+	int ilbPrev = 0;
+	float D, Am;
+	typename T::state ms;
+
+	const int tid = threadID();
+	for(int at = tid; at < npixels*ndiag; at += nthreads)
+	{
+		int ilb = at / ndiag;
+		pencilBeam pix = pixels(ilb);
+		int d = pix.im0 + pix.iM0 + at % ndiag;	// the diagonal, im + iM == d (see kernel())
+
+		// the range [j0, j1] of iM on the diagonal, within the beam's bounds (see skygenHost<T>::bound_cells)
+		int j0 = pix.iM0, j1 = pix.iM1-1;
+		if(j0 < d - (pix.im1-1))		{ j0 = d - (pix.im1-1); }
+		if(j1 > d - pix.im0)			{ j1 = d - pix.im0; }
+		if(j0 > j1) { continue; }
+
+		// apply distance limits, if they're both nonzero
+		float3 pos = compute_pos(D, Am, M1 - j0*dM, d - j0, pix);
+		if((dmin || dmax) && (dmin > D || dmax <= D))
+		{
+			continue;
+		}
+
+		// find the first cell that passes the flux limit (the cells after it are brighter, and pass it as well)
+		int jf = j0, jl = j1 + 1;
+		while(jf < jl)
+		{
+			int jc = (jf + jl) / 2;
+			float m = m0 + dm*(d - jc) + Am;
+			if(m > m1) { jf = jc + 1; } else { jl = jc; }
+		}
+		if(jf > j1) { continue; }
+
+		// sum up the density over the cells [jf, j1]
+		model.setpos(ms, pos.x, pos.y, pos.z);
+		float rho = 0.f;
+		for(int k = 0; k != model.nlf(); k++)
+		{
+			const NVTYPE *P = lfSum.ptr + k*(nM+1);
+			rho += model.den(ms, k) * (float)(P[j1+1] - P[jf]);
+		}
+		rho *= norm;
+		rho *= D*D*D;			  // multiply by volume (part one)
+		rho *= pix.dA * POGSON * dm * dM; // multiply by volume (part two)
+
+		if(ilbPrev != ilb)
+		{
+			// store the accumulated density within the current beam
+			countsCoveredPerBeam(tid, ilbPrev) = rhoBeam;
+			rhoBeam = 0.f;
+			ilbPrev = ilb;
+		}
+
+		count += rho;
+		countCovered += rho * pix.coveredFraction;
+		rhoBeam      += rho * pix.coveredFraction;
+		if(maxCount1 < rho) { maxCount1 = rho; }	// NOTE: this is the maximum per distance bin, not per cell
+	}
+
+	countsCoveredPerBeam(tid, ilbPrev) = rhoBeam;
+	counts(tid) = count;
+	countsCovered(tid) = countCovered;
+	maxCount(tid) = maxCount1;
+}
+
 // default kernels (do nothing)
 // NOTE: CUDA compatibility -- in principle, we could only _declare_, but 
 // not define these functions to ensure they can never be instantiated without
@@ -663,3 +804,4 @@ void skygenHost<T>::compute(bool draw)
 #include "model_powerLawEllipsoid.h"
 #include "model_brokenPowerLaw.h"
 #include "model_LCBulge.h"
+#include "model_fused.h"
@@ -27,8 +27,10 @@
 #include "module_lib.h"
 #include <astro/types.h>
 #include <string>
+#include <vector>
+#include <climits>
 
-typedef prngs::gpu::mwc gpuRng;
+typedef gpu_prng_impl gpuRng;
 using peyton::Radians;
 
 // some forward declarations
@@ -37,6 +39,88 @@ class otable;
 class osink;
 struct skygenParams;
 struct pencilBeam;
+struct fusablePart;
+
+//
+// 64-bit FNV-1a hash. Used to key the cached results of integrateCounts().
+//
+struct skygenHash
+{
+	uint64_t h;
+
+	skygenHash() : h(14695981039346656037ULL) {}
+
+	void add(const void *data, size_t size)
+	{
+		const unsigned char *p = (const unsigned char *)data;
+		for(size_t i = 0; i != size; i++)
+		{
+			h ^= p[i];
+			h *= 1099511628211ULL;
+		}
+	}
+
+	template<typename T>
+	void add(const T &v)
+	{
+		add(&v, sizeof(v));
+	}
+
+	template<typename T, int dim>
+	void add(cuxTexture<T, dim> &tex)	// hash texture contents and coordinates
+	{
+		uint32_t nx = tex.extent(0), ny = dim > 1 ? tex.extent(1) : 1, nz = dim > 2 ? tex.extent(2) : 1;
+		add(nx); add(ny); add(nz);
+
+		hptr<T, 3> hp = tex;
+		for(uint32_t z = 0; z != nz; z++)
+			for(uint32_t y = 0; y != ny; y++)
+				add((const char *)hp.ptr + y*hp.extent[0] + z*hp.extent[0]*hp.extent[1], nx*sizeof(T));
+
+		add(tex.coords, sizeof(tex.coords));
+	}
+};
+
+//
+// Where to cache the results of integrateCounts(), so that subsequent runs
+// with the same inputs (e.g., seed sweeps) can skip it.
+//
+struct countsCache
+{
+	std::string dir;	// cache directory (empty to disable caching)
+	uint64_t key;		// hash of the inputs shared by all models (the extinction maps)
+};
+
+// Sort the generated stars by (l, b, DM, M, Am) and drop the hidden ones.
+// Returns the number of remaining stars. Implemented in os_skygen.cpp.
+size_t sort_stars(otable &in);
+
+//
+// Hands the batches of generated stars over to the rest of the pipeline.
+// With depth > 1, the pipeline runs on a separate thread, processing one
+// batch while skygen generates the next one into another table (up to
+// depth tables are in flight). Batches are processed in the order they
+// were submitted. Implemented in os_skygen.cpp.
+//
+class skygenBatchQueue
+{
+protected:
+	struct impl;
+	impl *q;
+
+public:
+	skygenBatchQueue(otable &t, osink *nextlink, rng_t &rng, int depth);
+	~skygenBatchQueue();
+
+	otable &acquire();		// returns an empty table to generate into (blocks while all tables are in flight)
+	void submit(otable &t);		// queues a table for processing by the pipeline
+	size_t drain();			// waits until all submitted tables are processed. Returns the number of stars stored since the last drain().
+
+private:
+	// disallow copying
+	skygenBatchQueue(const skygenBatchQueue &);
+	skygenBatchQueue &operator=(const skygenBatchQueue &);
+};
 
 //
 // Abstract interface to mock catalog generator for a model. For each density model,
@@ -46,16 +130,18 @@ struct pencilBeam;
 //
 struct ALIGN(16) skygenInterface
 {
-	virtual double integrateCounts(float &runtime, const char *denmappfix) = 0;	// computes the expected source count
-	virtual size_t drawSources(otable &in, osink *nextlink, float &runtime) = 0;	// draws the sources, stores the output in the table, and invokes the rest of the pipeline
+	virtual double integrateCounts(float &runtime, const char *denmappfix, const countsCache &cache) = 0;	// computes the expected source count
+	virtual size_t drawSources(skygenBatchQueue &out, float &runtime) = 0;		// draws the sources, and hands them over to the rest of the pipeline
 	virtual uint32_t component() const = 0;						// returns the (sequential, internal) component ID of the model
 
 	virtual bool init(								// initialize the catalog generator for this model
 		const peyton::system::Config &model_cfg,
 		const skygenParams &sc,
 		const pencilBeam *pixels) = 0;
-	virtual void initRNG(rng_t &rng) = 0;		// initialize the random number generator from CPU RNG
+	virtual void bound_cells(cuxTexture<float, 3> &ext_beam) = 0;	// restrict the (m, M) cells swept in each beam to those that can contain observable stars
+	virtual void initRNG(rng_t &rng, bool shared = true) = 0;	// initialize the random number generator from CPU RNG. If !shared, the model gets its own streams (see gpu_rng_t::create_private)
 	virtual void setDensityNorm(float norm) = 0;	// explicitly set the overall density normalization of the model.
+	virtual bool fusable(fusablePart &part) const = 0;	// describe the model for fusion with others into a single pass (see model_fused.h). Returns false if the model can't be fused.
 	virtual ~skygenInterface() {};
 };
 
@@ -71,15 +157,73 @@ struct modelConcept
 	void prerun(host_state_t &hstate, bool draw);				// called before executing the model generation kernel
 	void postrun(host_state_t &hstate, bool draw);				// called after executing the model generation kernel
 	bool hint_absmag(host_state_t &hstate, float &M0, float &M1) const;	// allow the model to provide a hint as to the range of absmags that is nonzero
+	void hash_state(host_state_t &hstate, skygenHash &h) const;		// add the model parameters and host state (e.g., textures) to the hash of model inputs
 
 	__device__ void setpos(state &s, float x, float y, float z) const;	// set the 3D position which will be implied in subsequent calls to rho()
 	__device__ float rho(state &s, float M) const;				// return the number density at the position set by setpos, and absolute magnitude M
 
+	//
+	// Models whose density is a sum of nlf() terms, each a product of a
+	// spatial density and a luminosity function,
+	//
+	//	rho(s, M) == sum_k den(s, k) * LF_k(M),
+	//
+	// declare it by setting separable = true. Their starcounts are then
+	// integrated over M using prefix sums of the LFs, one distance bin at
+	// a time (see skygenGPU<T>::integrate_collapsed). The defaults below
+	// are for a single term, with the LF in host_state_t::lf.
+	//
+	static const bool separable = false;
+	__host__ __device__ int nlf() const { return 1; }
+	template<typename H>
+	void sample_lf(H &hstate, int k, float *phi, const float *M, int n) const	// sample LF_k at absolute magnitudes M[0..n), exactly as rho() does
+	{
+		cuxTexSampler<float, 1>(hstate.lf, true).sample(phi, M, n);
+	}
+	template<typename S>
+	__device__ float den(S &s, int k) const { return s.rho; }		// density of term k at the position set by setpos, before multiplying by LF_k
+
 	int comp;
 	__device__ int component() const
 	{
 		return comp;
 	}
+
+	// return the component of a star drawn at the position set by setpos, and
+	// absolute magnitude M. Composite models (e.g., fusedModel) override this.
+	template<typename S, typename R>
+	__device__ int component(S &s, float M, const R &rng) const
+	{
+		return comp;
+	}
+};
+
+//
+// Models that can be evaluated by fusedModel, in a single pass together
+// with other models (see model_fused.h). A model becomes fusable by
+// specializing fusedModelType<> with its ID. fusedModel stores bytewise
+// copies of its parts, so fusable models must be trivially copyable and
+// no larger than FUSED_MAXPARTSIZE (checked in skygenHost<T>::fusable()).
+//
+enum { FUSED_NONE = -1, FUSED_EXPDISK, FUSED_POWERLAWELLIPSOID, FUSED_BROKENPOWERLAW, FUSED_LCBULGE };
+static const int FUSED_MAXPARTS = 8;		// maximum number of models in a fusedModel
+static const int FUSED_MAXPARTSIZE = 256;	// maximum size of a fusable model, in bytes
+
+template<typename Model>
+struct fusedModelType
+{
+	static const int id = FUSED_NONE;
+};
+
+// A fusable model, as exported by skygenInterface::fusable()
+struct fusablePart
+{
+	int type;			// fusedModelType<>::id of the model
+	const void *model;		// the model (a copy is made by fusedModel)
+	size_t size;			// size of the model, in bytes
+	int comp;			// component ID of the model
+	cuxTexture<float> lf;		// luminosity function
+	float M0, M1;			// the range of absolute magnitudes where the model is nonzero
 };
 
 //
@@ -96,9 +240,12 @@ struct ALIGN(16) pencilBeam : public direction
 
 	int extIdx;		// index into per-beam extinction texture
 
+	int im0, im1, iM0, iM1;	// only the cells in [im0, im1) x [iM0, iM1) can contain observable stars (see skygenHost<T>::bound_cells)
+
 	__device__ __host__ pencilBeam() {}
 	__device__ __host__ pencilBeam(Radians l_, Radians b_, float X_, float Y_, int projIdx_, float dx_, float coveredFraction_, int extIdx_)
-	: direction(l_, b_), X(X_), Y(Y_), projIdx(projIdx_), dx(dx_), dA(dx_*dx_), coveredFraction(coveredFraction_), extIdx(extIdx_)
+	: direction(l_, b_), X(X_), Y(Y_), projIdx(projIdx_), dx(dx_), dA(dx_*dx_), coveredFraction(coveredFraction_), extIdx(extIdx_),
+	  im0(0), im1(INT_MAX), iM0(0), iM1(INT_MAX)
 	{ }
 };
 
@@ -158,6 +305,7 @@ struct ALIGN(16) skygenParams
 
 	int nthreads;			// total number of threads processing the sky
 	int stopstars;			// stop after this many stars have been generated
+	bool collapseCounts;		// integrate the counts one distance bin at a time, for separable models (see modelConcept)
 
 	lambert proj[2];		// north/south sky lambert projections
 
@@ -271,6 +419,8 @@ struct ALIGN(16) skygenGPU : public skygenParams
 	Model_t model;
 
 	cuxDevicePtr<pencilBeam> pixels;	// pixels on the sky to process
+	int ndiag;				// the largest number of diagonals in a beam's [im0, im1) x [iM0, iM1) (for integrate_collapsed)
+	cuxDevicePtr<NVTYPE> lfSum;		// prefix sums of the LFs over absmag bins, nlf() x (nM+1) sized (for integrate_collapsed)
 
 	cuxDevicePtr<int> nstars;
 	cuxDevicePtr<NVTYPE> counts, countsCovered;
@@ -281,15 +431,17 @@ struct ALIGN(16) skygenGPU : public skygenParams
 	cuxDevicePtr<int> rhoHistograms;	// nthreads*nbins sized array
 	float lrho0, dlrho;		// histogram array start (bin midpoint), bin size
 
-	cuxDevicePtr<float> maxCount;	// [nthreads] sized array, returning the maximum density found by each thread
+	cuxDevicePtr<float> maxCount;	// [nthreads] sized array, returning the maximum density found by each thread (per cell; per distance bin if collapseCounts)
 
 	runtime_state<Model> ks;
 	float norm;			// normalization of overall density (usually 1.f)
 
 	template<int draw> __device__ void kernel() const;
+	__device__ void integrate_collapsed() const;
 	__device__ float3 compute_pos(float &D, float &Am, float M, const int im, const pencilBeam &dir) const;
-	__device__ bool advance(int &ilb, int &i, int &j, pencilBeam &pix, const int x, const int y) const;
-	__device__ void draw_stars(int &ndraw, const float &M, const int &im, const pencilBeam &pix, float AmMin) const;
+	__device__ void seek(int &ilb, int &i, int &j, int &k, pencilBeam &pix, int &x, int &y) const;
+	__device__ bool advance(int &ilb, int &i, int &j, int &k, pencilBeam &pix, int &x, int &y) const;
+	__device__ void draw_stars(int &ndraw, const float &M, const int &im, const int &iM, const int &ilb, const pencilBeam &pix, float AmMin, typename Model::state &ms) const;
 };
 
 //
@@ -308,6 +460,7 @@ protected:
 //	float Rg;		// distance to the galactic center
 
 	gpuRng *rng;
+	bool privateRNG;	// true if rng was made with gpu_rng_t::create_private()
 	rng_t *cpurng;
 	unsigned seed;
 	pencilBeam *cpu_pixels;
@@ -330,6 +483,11 @@ protected:
 	stopwatch swatch;		// runtime of this model (measured in integrateCounts() and run()).
 
 	void upload_self(bool draw = false);
+	void upload_lf_sums();
+
+	uint64_t counts_key(const countsCache &cache);
+	bool load_counts(const std::string &fn, uint64_t key, std::vector<double> &den);
+	void store_counts(const std::string &fn, uint64_t key, const std::vector<double> &den);
 
 	void compute(bool draw = false);
 	void upload(bool draw, int pixfrom, int pixto);
@@ -340,16 +498,18 @@ public:
 	~skygenHost();
 
 	// external interface (skygenInterface)
-	virtual double integrateCounts(float &runtime, const char *denmapPrefix);	// return the expected starcounts contributed by this model
-	virtual size_t drawSources(otable &in, osink *nextlink, float &runtime);
+	virtual double integrateCounts(float &runtime, const char *denmapPrefix, const countsCache &cache);	// return the expected starcounts contributed by this model
+	virtual size_t drawSources(skygenBatchQueue &out, float &runtime);
 	virtual uint32_t component() const { return this->model.comp; }			// NOTE: this should actually point to model.component(), but it wouldn't compile on gcc 4.3.4 + CUDA 2.3
 
-	virtual void initRNG(rng_t &rng);		// initialize the random number generator from CPU RNG
+	virtual void initRNG(rng_t &rng, bool shared = true);	// initialize the random number generator from CPU RNG
 	virtual void setDensityNorm(float norm);	// explicitly set the overall density normalization of the model.
+	virtual bool fusable(fusablePart &part) const;	// describe the model for fusion with other models
 	virtual bool init(
 		const peyton::system::Config &cfg,	// model cfg file
 		const skygenParams &sc,
 		const pencilBeam *pixels);
+	virtual void bound_cells(cuxTexture<float, 3> &ext_beam);
 };
 
 //
@@ -1572,3 +1572,820 @@ bool os_photoErrors::init(const Config &cfg, otable &t)
 #endif
 
 #endif
+
+//////////////////////////////////////////////////////////////////////////
+// Self-tests and benchmarks. Run with `galfast util test <name>`.
+//////////////////////////////////////////////////////////////////////////
+
+#include "galfast_config.h"
+#include "gpu.h"
+#include "otable.h"
+#include "skygen.h"
+#include "module_lib.h"
+#include "photometry.h"
+#include "io.h"
+
+#include <vector>
+#include <cstring>
+#include <sstream>
+#include <set>
+#include <algorithm>
+#include <astro/exceptions.h>
+#include <astro/util.h>
+#include <astro/system/log.h>
+#include <astro/useall.h>
+
+//
+// Host texture sampling: nearest-neighbor lookup as it was done before
+// linear filtering was implemented, vs. scalar and batched linear
+// interpolation. Also verifies the batched sampler returns results
+// identical to the scalar one.
+//
+static int test_texsample()
+{
+	const int N = 10*1000*1000;
+	const int nx = 351, ny = 1201;		// typical isochrone texture size
+	cuxTexture<float4, 2> tex(nx, ny, texcoord_from_range(0, nx, -3, 0.5), texcoord_from_range(0, ny, 3, 15));
+	FOR(0, nx) { FORj(j, 0, ny) { tex(i, j) = make_float4(drand48(), drand48(), drand48(), drand48()); } }
+
+	std::vector<float> x(N), y(N);
+	std::vector<float4> out(N), out2(N);
+	FOR(0, N) { x[i] = -3.1 + 3.7*drand48(); y[i] = 2.9 + 12.2*drand48(); }
+
+	cuxTexSampler<float4, 2> linear(tex, true);
+	const float2 tcx = tex.coords[0], tcy = tex.coords[1];
+	stopwatch sw;
+
+	sw.start();
+	FOR(0, N)
+	{
+		float xi = (x[i] - tcx.x) * tcx.y + 0.5f;
+		float yi = (y[i] - tcy.x) * tcy.y + 0.5f;
+		xi = xi < 0.f ? 0.f : (xi >= nx ? nx-1 : xi);
+		yi = yi < 0.f ? 0.f : (yi >= ny ? ny-1 : yi);
+		out[i] = tex((uint32_t)xi, (uint32_t)yi);
+	}
+	sw.stop();
+	MLOG(verb1) << "texsample: nearest neighbor (old):  " << N / sw.getTime() / 1e6 << " Msamples/s";
+
+	sw.reset(); sw.start();
+	FOR(0, N)
+	{
+		out[i] = linear.fetch(linear.texcoord(x[i], 0), linear.texcoord(y[i], 1));
+	}
+	sw.stop();
+	MLOG(verb1) << "texsample: bilinear, scalar:        " << N / sw.getTime() / 1e6 << " Msamples/s";
+
+	sw.reset(); sw.start();
+	linear.sample(&out2[0], &x[0], &y[0], N);
+	sw.stop();
+	MLOG(verb1) << "texsample: bilinear, batch" << (CUX_SSE ? " (SSE):  " : ":        ") << N / sw.getTime() / 1e6 << " Msamples/s";
+
+	if(memcmp(&out[0], &out2[0], N*sizeof(float4)) != 0)
+	{
+		MLOG(verb1) << "texsample: FAILED (batched and scalar samples differ)";
+		return -1;
+	}
+	MLOG(verb1) << "texsample: OK";
+	return 0;
+}
+
+//
+// Sorting of the stars generated by skygen: the old sort of an index
+// array followed by element-by-element swaps of all columns, vs.
+// sort_stars(). Verifies both produce the same tables.
+//
+struct sortstars_ref_comp
+{
+	cdouble_t::host_t lb;
+	cfloat_t::host_t M, Am, DM;
+	cint_t::host_t hidden;
+
+	bool operator()(const size_t a, const size_t b) const
+	{
+		return	hidden(a)<  hidden(b)   ||      hidden(a)== hidden(b) && (
+			lb(a, 0) <  lb(b, 0)	||	lb(a, 0) == lb(b, 0) && (
+			lb(a, 1) <  lb(b, 1)	||	lb(a, 1) == lb(b, 1) && (
+			DM(a)    <  DM(b)	||	DM(a)    == DM(b) && (
+			M(a)     <  M(b)	||	M(a)     == M(b)  && (
+			Am(a)    <  Am(b)
+			)))));
+	}
+};
+
+static void sortstars_fill(otable &t, size_t n)
+{
+	cdouble_t::host_t lb = t.col<double>("lb");
+	cint_t::host_t projIdx = t.col<int>("projIdx"), comp = t.col<int>("comp"), hidden = t.col<int>("hidden");
+	cfloat_t::host_t projXY = t.col<float>("projXY"), XYZ = t.col<float>("XYZ");
+	cfloat_t::host_t M = t.col<float>("absmag"), Am = t.col<float>("Am"), AmInf = t.col<float>("AmInf"), DM = t.col<float>("DM");
+
+	srand48(42);
+	t.set_size(n);
+	FOR(0, n)
+	{
+		// ~1% of stars share (l, b) with another star, to exercise the tie breaking
+		double l = 360.*drand48();
+		if(i && drand48() < 0.01) { l = lb(i-1, 0); }
+		lb(i, 0) = l;			lb(i, 1) = -90. + 180.*drand48();
+		projIdx(i) = i % 2;		projXY(i, 0) = drand48();	projXY(i, 1) = drand48();
+		XYZ(i, 0) = drand48();		XYZ(i, 1) = drand48();		XYZ(i, 2) = drand48();
+		comp(i) = i % 3;
+		M(i) = 15.*drand48();		DM(i) = 5. + 15.*drand48();
+		Am(i) = drand48();		AmInf(i) = Am(i) + drand48();
+		hidden(i) = drand48() < 0.1;
+	}
+}
+
+static int test_sortstars()
+{
+	const size_t N = 5*1000*1000;
+	otable t(N, "test");
+	t.use_column("lb");	t.use_column("projIdx");	t.use_column("projXY");
+	t.use_column("Am");	t.use_column("AmInf");		t.use_column("XYZ");
+	t.use_column("comp");	t.use_column("DM");		t.use_column("hidden");
+	t.use_column("absSDSSr"); t.alias_column("absSDSSr", "absmag");
+
+	const char *cols[] = { "lb", "projIdx", "projXY", "Am", "AmInf", "XYZ", "comp", "absmag", "DM" };
+	const int ncols = sizeof(cols)/sizeof(cols[0]);
+	stopwatch sw;
+
+	// old: sort an index array, then permute the columns row by row
+	sortstars_fill(t, N);
+	sw.start();
+	{
+		sortstars_ref_comp sc;
+		sc.lb = t.col<double>("lb");	sc.M = t.col<float>("absmag");
+		sc.Am = t.col<float>("Am");	sc.DM = t.col<float>("DM");
+		sc.hidden = t.col<int>("hidden");
+
+		std::vector<size_t> s(N);
+		FOR(0, N) { s[i] = i; }
+		std::sort(s.begin(), s.end(), sc);
+
+		std::vector<char> tmp;
+		FORj(c, 0, ncols)
+		{
+			int es, width; size_t pitch;
+			char *base = (char *)t.getColumn(cols[c]).rawdataptr(es, width, pitch);
+			tmp.resize(N*es);
+			FORj(k, 0, width)
+			{
+				char *row = base + k*pitch;
+				FOR(0, N) { memcpy(&tmp[i*es], row + s[i]*es, es); }
+				FOR(0, N) { memcpy(row + i*es, &tmp[i*es], es); }
+			}
+		}
+
+		int *h0 = std::upper_bound(sc.hidden.ptr, sc.hidden.ptr + N, 0);
+		t.set_size(h0 - sc.hidden.ptr);
+	}
+	sw.stop();
+	MLOG(verb1) << "sortstars: index sort + per-row permutation (old): " << sw.getTime() << "s";
+
+	size_t nref = t.size();
+	std::vector<std::vector<char> > ref(ncols);
+	FORj(c, 0, ncols)
+	{
+		int es, width; size_t pitch;
+		char *base = (char *)t.getColumn(cols[c]).rawdataptr(es, width, pitch);
+		FORj(k, 0, width) { ref[c].insert(ref[c].end(), base + k*pitch, base + k*pitch + nref*es); }
+	}
+
+	// new: sort_stars()
+	sortstars_fill(t, N);
+	sw.reset(); sw.start();
+	size_t n = sort_stars(t);
+	sw.stop();
+	MLOG(verb1) << "sortstars: sort_stars():                          " << sw.getTime() << "s";
+
+	bool ok = n == nref;
+	FORj(c, 0, ncols)
+	{
+		int es, width; size_t pitch;
+		char *base = (char *)t.getColumn(cols[c]).rawdataptr(es, width, pitch);
+		for(int k = 0; ok && k != width; k++)
+		{
+			ok = memcmp(base + k*pitch, &ref[c][k*nref*es], nref*es) == 0;
+		}
+	}
+	if(!ok)
+	{
+		MLOG(verb1) << "sortstars: FAILED (tables sorted by the old and new code differ)";
+		return -1;
+	}
+	MLOG(verb1) << "sortstars: OK (" << n << " of " << N << " stars visible)";
+	return 0;
+}
+
+//
+// Fills t with N rows of typical galfast output (used by the text I/O
+// tests below).
+//
+static void textio_fill(otable &t, size_t N)
+{
+	t.use_column("lb");	t.use_column("XYZ");	t.use_column("comp");
+	t.use_column("DM");	t.use_column("Am");	t.use_column("FeH");
+	t.use_column("vcyl");	t.use_column("hidden");
+	t.use_column("absSDSSr");
+	t.use_column("Ncomp{type=int;fmt=%1d;}");
+	t.use_column("prob{type=double;fmt=%.5e;}");	// not handled by the fast formatter
+
+	cdouble_t::host_t lb = t.col<double>("lb"), prob = t.col<double>("prob");
+	cfloat_t::host_t XYZ = t.col<float>("XYZ"), vcyl = t.col<float>("vcyl");
+	cfloat_t::host_t DM = t.col<float>("DM"), Am = t.col<float>("Am"), FeH = t.col<float>("FeH"), M = t.col<float>("absSDSSr");
+	cint_t::host_t comp = t.col<int>("comp"), Ncomp = t.col<int>("Ncomp"), hidden = t.col<int>("hidden");
+
+	srand48(42);
+	t.set_size(N);
+	FOR(0, N)
+	{
+		lb(i, 0) = 360.*drand48();	lb(i, 1) = -90. + 180.*drand48();
+		FORj(k, 0, 3) { XYZ(i, k) = -20000. + 40000.*drand48(); vcyl(i, k) = -500. + 1000.*drand48(); }
+		DM(i) = 5. + 15.*drand48();	Am(i) = drand48();
+		FeH(i) = -3. + 3.5*drand48();	M(i) = -1. + 15.*drand48();
+		if(i % 7 == 0) { Am(i) = (int)(1000*Am(i)) / 1000. + 0.0005; }	// rounding ties (up to float precision)
+		if(i % 11 == 0) { FeH(i) = -0.0001*drand48(); }			// rounds to -0.000
+		comp(i) = i % 4 - 1;		Ncomp(i) = 1 + i % 3;
+		prob(i) = drand48();
+		hidden(i) = drand48() < 0.1;
+	}
+}
+
+//
+// Text serialization of tables: the old per-row, per-field snprintf
+// path, vs. otable::serialize_body(). Verifies the two produce
+// byte-identical output.
+//
+struct serialize_mask : otable::mask_functor
+{
+	cint_t::host_t hidden;
+	serialize_mask(cint_t::host_t &h) : hidden(h) {}
+	virtual bool shouldOutput(int row) const { return !hidden(row); }
+};
+
+static int test_serialize()
+{
+	const size_t N = 2*1000*1000;
+	otable t(N, "test");
+	textio_fill(t, N);
+	cint_t::host_t hidden = t.col<int>("hidden");
+
+	std::ostringstream hdr;
+	t.serialize_header(hdr);
+	serialize_mask mask(hidden);
+	stopwatch sw;
+
+	// old: format row by row, field by field
+	std::vector<const otable::columndef *> cols;
+	t.getSortedColumnsForOutput(cols);
+	std::ostringstream ref;
+	sw.start();
+	FOR(0, N)
+	{
+		if(!mask.shouldOutput(i)) { continue; }
+
+		fmtout line;
+		FOREACHj(c, cols) { (*c)->serialize(line, i); }
+		ref << line.c_str() << "\n";
+	}
+	sw.stop();
+	std::string refs = ref.str();
+	MLOG(verb1) << "serialize: row by row, snprintf (old): " << refs.size() / sw.getTime() / (1<<20) << " MB/s";
+
+	// new: serialize_body()
+	std::ostringstream out;
+	sw.reset(); sw.start();
+	t.serialize_body(out, 0, N, mask);
+	sw.stop();
+	std::string outs = out.str();
+	MLOG(verb1) << "serialize: serialize_body():           " << outs.size() / sw.getTime() / (1<<20) << " MB/s";
+
+	if(outs != refs)
+	{
+		MLOG(verb1) << "serialize: FAILED (outputs of the old and new code differ)";
+		return -1;
+	}
+	MLOG(verb1) << "serialize: OK (" << refs.size() << " bytes)";
+	return 0;
+}
+
+//
+// Parsing of text tables: the old operator>>-based unserialize_body(),
+// vs. the block-parsing one. Verifies both read in identical tables.
+//
+static int test_textin()
+{
+	const size_t N = 2*1000*1000;
+	std::string text;
+	{
+		otable t(N, "");
+		textio_fill(t, N);
+		std::ostringstream out;
+		out << "# ";
+		t.serialize_header(out);
+		out << "\n";
+		t.serialize_body(out);
+		text = out.str();
+	}
+	stopwatch sw;
+
+	// old: operator>>
+	otable a(N, "");
+	std::set<std::string> cols;
+	std::istringstream ina(text);
+	a.unserialize_header(ina, &cols);
+	FOREACH(cols) { a.use_column(*i); }
+	sw.start();
+	a.unserialize_body(ina);
+	sw.stop();
+	MLOG(verb1) << "textin: operator>> (old):       " << text.size() / sw.getTime() / (1<<20) << " MB/s";
+
+	// new: block parsing
+	otable b(N, "");
+	std::istringstream inb(text);
+	b.unserialize_header(inb);
+	FOREACH(cols) { b.use_column(*i); }
+	otable::text_buffer buf;
+	sw.reset(); sw.start();
+	bool more = b.unserialize_body(inb, buf);
+	sw.stop();
+	MLOG(verb1) << "textin: block parsing:          " << text.size() / sw.getTime() / (1<<20) << " MB/s";
+
+	bool ok = a.size() == N && b.size() == N && !more;
+	FOREACH(cols)
+	{
+		int es, width; size_t pitch;
+		char *pa = (char *)a.getColumn(*i).rawdataptr(es, width, pitch);
+		char *pb = (char *)b.getColumn(*i).rawdataptr(es, width, pitch);
+		for(int k = 0; ok && k != width; k++)
+		{
+			ok = memcmp(pa + k*pitch, pb + k*pitch, N*es) == 0;
+		}
+	}
+	if(!ok)
+	{
+		MLOG(verb1) << "textin: FAILED (tables read by the old and new code differ)";
+		return -1;
+	}
+	MLOG(verb1) << "textin: OK (" << cols.size() << " columns, " << N << " rows)";
+	return 0;
+}
+
+//
+// Binary serialization of tables: writes a table in several chunks,
+// with the hidden rows masked out, and reads it back in through a
+// smaller table (so that chunks get split across reads). Verifies the
+// visible rows round-trip bit for bit.
+//
+static int test_binio()
+{
+	const size_t N = 2*1000*1000, M = 300*1000;
+	otable t(N, "");
+	textio_fill(t, N);
+	cint_t::host_t hidden = t.col<int>("hidden");
+	serialize_mask mask(hidden);
+
+	std::ostringstream hdr, out;
+	hdr << "# ";
+	t.serialize_header(hdr);
+	hdr << "\n";
+	stopwatch sw;
+	sw.start();
+	size_t nout = 0;
+	nout += t.serialize_body_binary(out, 0, 12345, mask);
+	nout += t.serialize_body_binary(out, 12345, 12345, mask);
+	nout += t.serialize_body_binary(out, 12345, N, mask);
+	sw.stop();
+	std::string bin = out.str();
+	MLOG(verb1) << "binio: serialize_body_binary():   " << bin.size() / sw.getTime() / (1<<20) << " MB/s";
+
+	otable b(M, "");
+	std::set<std::string> cols;
+	std::istringstream inb(hdr.str());
+	b.unserialize_header(inb, &cols);
+	FOREACH(cols) { b.use_column(*i); }
+	otable::binary_buffer buf(bin.data(), bin.data() + bin.size());
+
+	bool ok = true, more;
+	size_t row = 0;
+	sw.reset();
+	do {
+		sw.start();
+		more = b.unserialize_body_binary(buf);
+		sw.stop();
+
+		// the rows of t that were read in
+		std::vector<size_t> rows;
+		for(; rows.size() != b.size() && row != N; row++)
+		{
+			if(!hidden(row)) { rows.push_back(row); }
+		}
+		ok = rows.size() == b.size();
+
+		FOREACH(cols)
+		{
+			int es, width; size_t pitch, pitchb;
+			char *pt = (char *)t.getColumn(*i).rawdataptr(es, width, pitch);
+			char *pb = (char *)b.getColumn(*i).rawdataptr(es, width, pitchb);
+			for(int k = 0; ok && k != width; k++)
+			{
+				FORj(j, 0, rows.size())
+				{
+					if(memcmp(pt + k*pitch + rows[j]*es, pb + k*pitchb + j*es, es) != 0) { ok = false; break; }
+				}
+			}
+		}
+	} while(ok && more);
+	MLOG(verb1) << "binio: unserialize_body_binary(): " << bin.size() / sw.getTime() / (1<<20) << " MB/s";
+
+	while(row != N && hidden(row)) { row++; }
+	if(!ok || row != N || buf.rowsRead != nout)
+	{
+		MLOG(verb1) << "binio: FAILED (the table read back differs from the one written out)";
+		return -1;
+	}
+	MLOG(verb1) << "binio: OK (" << cols.size() << " columns, " << nout << " rows)";
+	return 0;
+}
+
+//
+// CPU photometry kernel: the scalar os_photometry_kernel vs. its batched
+// version (os_photometry_batch). Computes photometry of binary systems
+// (with some secondaries missing) in five bands from a synthetic
+// isochrone. Verifies the flags are identical, and the magnitudes agree
+// to within PHOTOMETRY_TOL. The approximations in exp10_batch/log10_batch
+// are good to ~3e-7 mag; the rest is float rounding of the sums (one ulp
+// is ~4e-6 for magnitudes between 32 and 64).
+//
+extern os_photometry_data os_photometry_params;
+
+static int test_photometry()
+{
+	const size_t N = 2*1000*1000;
+	const float PHOTOMETRY_TOL = 2e-5f;	// mag
+	const int ncolors = 5, nFeH = 351, nMr = 1201;
+
+	// isochrone with smoothly varying colors, and randomly set extrapolation flags
+	std::vector<cuxTexture<float4, 2> > iso, ef;
+	srand48(42);
+	FORj(t, 0, 4)
+	{
+		iso.push_back(cuxTexture<float4, 2>(nFeH, nMr, texcoord_from_range(0, nFeH, -3, 0.5), texcoord_from_range(0, nMr, -1, 15)));
+		 ef.push_back(cuxTexture<float4, 2>(nFeH, nMr, texcoord_from_range(0, nFeH, -3, 0.5), texcoord_from_range(0, nMr, -1, 15)));
+		FOR(0, nFeH) { FORj(j, 0, nMr)
+		{
+			float c[4], f[4];
+			FORj(k, 0, 4)
+			{
+				c[k] = 0.1*(4*t+k) + 0.05*(-1 + j*16./nMr) + 0.1*(-3 + i*3.5/nFeH) + 0.01*drand48();
+				f[k] = drand48() < 0.01;
+			}
+			iso[t](i, j) = make_float4(c[0], c[1], c[2], c[3]);
+			 ef[t](i, j) = make_float4(f[0], f[1], f[2], f[3]);
+		} }
+	}
+	cuxTextureBinder tc0(color0, iso[0]), tc1(color1, iso[1]), tc2(color2, iso[2]), tc3(color3, iso[3]);
+	cuxTextureBinder tf0(cflags0, ef[0]), tf1(cflags1, ef[1]), tf2(cflags2, ef[2]), tf3(cflags3, ef[3]);
+
+	os_photometry_params.ncolors = ncolors;
+	os_photometry_params.bidx = 2;
+	FOR(0, ncolors+1) { os_photometry_params.reddening[i] = 1.5 - 0.2*i; }
+
+	bit_map applyToComponents;
+	applyToComponents.set_all(false);
+	applyToComponents.set(0); applyToComponents.set(1); applyToComponents.set(2);
+
+	otable t(N, "");
+	t.use_column("comp");	t.use_column("hidden");	t.use_column("DM");
+	t.use_column("Am");	t.use_column("FeH");
+	t.use_column("absSDSSrSys[2]{type=float;}");
+	t.use_column("testMags[6]{type=float;}");
+	t.use_column("testMagsPhotoFlags{type=int;}");
+	cint_t &comp = t.col<int>("comp"), &hidden = t.col<int>("hidden"), &flags = t.col<int>("testMagsPhotoFlags");
+	cfloat_t &DM = t.col<float>("DM"), &Am = t.col<float>("Am"), &FeH = t.col<float>("FeH");
+	cfloat_t &Mr = t.col<float>("absSDSSrSys"), &mags = t.col<float>("testMags");
+
+	t.set_size(N);
+	{
+		cint_t::host_t hcomp = comp, hhidden = hidden, hflags = flags;
+		cfloat_t::host_t hDM = DM, hAm = Am, hFeH = FeH, hMr = Mr, hmags = mags;
+		FOR(0, N)
+		{
+			hcomp(i) = i % 4;		hhidden(i) = drand48() < 0.1;
+			hDM(i) = 5. + 15.*drand48();	hAm(i) = drand48();
+			hFeH(i) = -3.1 + 3.7*drand48();
+			hMr(i, 0) = drand48() < 0.05 ? ABSMAG_NOT_PRESENT : -1.5 + 17.*drand48();
+			hMr(i, 1) = drand48() < 0.5  ? ABSMAG_NOT_PRESENT : -1.5 + 17.*drand48();
+			FORj(b, 0, ncolors+1) { hmags(i, b) = 1e-6 + drand48(); }
+			hflags(i) = -1;
+		}
+	}
+
+	// run both versions of the kernel on copies of the output columns
+	std::vector<float> mags0(N*(ncolors+1)), mags1[2];
+	std::vector<int> flags1[2];
+	{
+		cfloat_t::host_t hmags = mags;
+		FOR(0, N) { FORj(b, 0, ncolors+1) { mags0[i*(ncolors+1)+b] = hmags(i, b); } }
+	}
+	stopwatch sw[2];
+	FORj(k, 0, 2)
+	{
+		{
+			cfloat_t::host_t hmags = mags;
+			cint_t::host_t hflags = flags;
+			FOR(0, N) { hflags(i) = -1; FORj(b, 0, ncolors+1) { hmags(i, b) = mags0[i*(ncolors+1)+b]; } }
+		}
+
+		os_photometry_params.batched = k;
+		activeDevice dev(-1);
+		sw[k].start();
+		cpulaunch_os_photometry_kernel(otable_ks(0, N, -1, sizeof(float)*ncolors), applyToComponents, Am, flags, DM, Mr, Mr.width(), mags, FeH, comp, hidden);
+		sw[k].stop();
+
+		cfloat_t::host_t hmags = mags;
+		cint_t::host_t hflags = flags;
+		FOR(0, N) { flags1[k].push_back(hflags(i)); FORj(b, 0, ncolors+1) { mags1[k].push_back(hmags(i, b)); } }
+	}
+
+	MLOG(verb1) << "photometry: scalar kernel:  " << N / sw[0].getTime() / 1e6 << " Mstars/s";
+	MLOG(verb1) << "photometry: batched kernel: " << N / sw[1].getTime() / 1e6 << " Mstars/s";
+
+	float maxdiff = 0.f;
+	FOR(0, mags1[0].size()) { maxdiff = std::max(maxdiff, std::abs(mags1[0][i] - mags1[1][i])); }
+	if(flags1[0] != flags1[1] || !(maxdiff < PHOTOMETRY_TOL))
+	{
+		MLOG(verb1) << "photometry: FAILED (flags " << (flags1[0] == flags1[1] ? "agree" : "differ") << ", max. magnitude difference " << maxdiff << ")";
+		return -1;
+	}
+	MLOG(verb1) << "photometry: OK (max. magnitude difference " << maxdiff << ", tolerance " << PHOTOMETRY_TOL << ")";
+	return 0;
+}
+
+//
+// Host MWC generator: verifies that the numbers drawn through
+// prngs::cpu::mwc, and the state it stores back, are bit-identical to
+// those of the original implementation that kept the state in emulated
+// shared memory (reproduced here as mwc_shmem_uniform). Also compares the
+// speed of the two.
+//
+static float mwc_shmem_uniform()
+{
+	#define a  (shmem(uint32_t)[               threadIdx.x])
+	#define c  (shmem(uint32_t)[  blockDim.x + threadIdx.x])
+	#define xn (shmem(uint32_t)[2*blockDim.x + threadIdx.x])
+	uint64_t xnew = (uint64_t)a*xn + c;
+	c = xnew >> 32;
+	xn = (xnew << 32) >> 32;
+	return 2.32830643708e-10f * xn;
+	#undef a
+	#undef c
+	#undef xn
+}
+
+static int test_mwc()
+{
+	const uint32_t nstreams = 4096, nthreads = 192;
+
+	prngs::cpu::mwc rng = prngs::cpu::mwc::create();
+	rng.srand(42, nstreams, (datadir() + "/safeprimes32.txt").c_str());
+	std::vector<uint32_t> ref(rng.gstate, rng.gstate + 3*nstreams);
+
+	// a few "kernel launches", with each thread drawing a different
+	// number of variates from its stream. The numbers drawn are compared
+	// via an (order-sensitive) checksum of their bits.
+	blockDim.x = nthreads;
+	size_t ndraws = 0;
+	uint32_t hash[2] = { 0, 0 };
+	stopwatch sw[2];
+	FORj(pass, 0, 3)
+	{
+		sw[0].start();
+		FORj(tid, 0, nstreams)
+		{
+			threadIdx.x = tid % nthreads;
+			rng.load(tid);
+			int n = (tid*7919 + pass*31) % 2000;
+			FOR(0, n) { float u = rng.uniform(); uint32_t b; memcpy(&b, &u, 4); hash[0] = hash[0]*31 + b; }
+			rng.store(tid);
+			ndraws += n;
+		}
+		sw[0].stop();
+
+		sw[1].start();
+		FORj(tid, 0, nstreams)
+		{
+			threadIdx.x = tid % nthreads;
+			FOR(0, 3) { shmem(uint32_t)[i*blockDim.x + threadIdx.x] = ref[i*nstreams + tid]; }
+			int n = (tid*7919 + pass*31) % 2000;
+			FOR(0, n) { float u = mwc_shmem_uniform(); uint32_t b; memcpy(&b, &u, 4); hash[1] = hash[1]*31 + b; }
+			FOR(0, 3) { ref[i*nstreams + tid] = shmem(uint32_t)[i*blockDim.x + threadIdx.x]; }
+		}
+		sw[1].stop();
+	}
+	bool stateok = std::equal(ref.begin(), ref.end(), rng.gstate);
+	rng.free();
+
+	MLOG(verb1) << "mwc: host generator:      " << sw[0].getTime() / ndraws * 1e9 << " ns/draw";
+	MLOG(verb1) << "mwc: shared memory state: " << sw[1].getTime() / ndraws * 1e9 << " ns/draw";
+	if(hash[0] != hash[1] || !stateok)
+	{
+		MLOG(verb1) << "mwc: FAILED (numbers drawn " << (hash[0] == hash[1] ? "agree" : "differ") << ", final state " << (stateok ? "agrees" : "differs") << ")";
+		return -1;
+	}
+	MLOG(verb1) << "mwc: OK (" << ndraws << " numbers and the final state are identical)";
+	return 0;
+}
+
+//
+// Creates a host instance of the kernel RNG, and loads one of its streams
+// into (emulated) shared memory of a single emulated thread. Release with
+// rng.store(stream); rng.free().
+//
+static cpu_prng_impl create_test_rng(uint32_t &stream)
+{
+	cpu_prng_impl rng = cpu_prng_impl::create();
+#if COUNTER_RNG
+	rng.srand(42, 0);
+#else
+	rng.srand(42, 1<<16, (datadir() + "/safeprimes32.txt").c_str());
+#endif
+	// The first few MWC multipliers in safeprimes32.txt are small and
+	// make poor generators, so test with a stream from the far end of
+	// the file.
+	blockDim.x = 1; threadIdx.x = 0;
+	stream = rng.nstreams ? rng.nstreams - 1 : 0;
+	rng.load(stream);
+	return rng;
+}
+
+//
+// Poisson sampler: draws N deviates for a range of means straddling the
+// switch between the multiplication method and PTRS (at mu = 10), and
+// checks the sample mean, variance, and the histogram (chi-square) against
+// the exact Poisson PMF. Fails if any statistic is off by more than five
+// sigma.
+//
+static int test_poisson()
+{
+	const int N = 1000*1000;
+	const double mus[] = { 0.5, 3, 9.99, 10, 17.3, 100, 1234.5, 1e5, 3e6 };
+	const double ZMAX = 5.;
+
+	uint32_t stream;
+	cpu_prng_impl rng = create_test_rng(stream);
+
+	int ret = 0;
+	std::vector<unsigned int> k(N);
+	FOR(0, sizeof(mus)/sizeof(mus[0]))
+	{
+		const double mu = mus[i];
+
+		stopwatch sw;
+		sw.start();
+		FORj(j, 0, N) { k[j] = rng.poisson(mu); }
+		sw.stop();
+
+		// moments
+		double m = 0., v = 0.;
+		FORj(j, 0, N) { m += k[j]; }
+		m /= N;
+		FORj(j, 0, N) { v += sqr(k[j] - m); }
+		v /= N - 1;
+		double zm = (m - mu) / sqrt(mu / N);
+		double zv = (v - mu) / sqrt((2*mu*mu + mu) / N);
+
+		// chi-square, pooling adjacent bins until the expected count is >= 5.
+		// The bins below kmin and above kmax are pooled into the tails.
+		unsigned int kmin = (unsigned int)std::max(0., floor(mu - 8*sqrt(mu) - 1));
+		unsigned int kmax = (unsigned int)ceil(mu + 8*sqrt(mu) + 8);
+		std::vector<int> hist(kmax - kmin + 1);
+		FORj(j, 0, N) { hist[std::min(std::max(k[j], kmin), kmax) - kmin]++; }
+
+		double chi2 = 0., pcum = 0., e = 0.;
+		int o = 0, dof = -1;
+		for(unsigned int kk = kmin; kk <= kmax; kk++)
+		{
+			double p = kk == kmax ? 1. - pcum : exp(-mu + kk*log(mu) - lgamma(kk + 1.));
+			if(kk == kmin && kk != 0)
+			{
+				// everything below kmin
+				p = 0.;
+				for(unsigned int q = 0; q <= kmin; q++) { p += exp(-mu + q*log(mu) - lgamma(q + 1.)); }
+			}
+			pcum += p;
+			e += N*p;
+			o += hist[kk - kmin];
+			if(e >= 5. || kk == kmax)
+			{
+				chi2 += sqr(o - e) / e;
+				dof++;
+				e = 0.; o = 0;
+			}
+		}
+		double zchi2 = (chi2 - dof) / sqrt(2.*dof);
+
+		bool ok = fabs(zm) < ZMAX && fabs(zv) < ZMAX && zchi2 < ZMAX;
+		MLOG(verb1) << "poisson: mu=" << mu << ": <k>=" << m << " (z=" << zm << "), var=" << v << " (z=" << zv << ")"
+			<< ", chi2/dof=" << chi2 << "/" << dof << " (z=" << zchi2 << "), "
+			<< sw.getTime() / N * 1e9 << " ns/draw" << (ok ? "" : "  FAILED");
+		if(!ok) { ret = -1; }
+	}
+
+	rng.store(stream);
+	rng.free();
+
+	MLOG(verb1) << "poisson: " << (ret == 0 ? "OK" : "FAILED");
+	return ret;
+}
+
+//
+// Gaussian samplers: benchmarks the polar and Ziggurat methods, and checks
+// the first four moments and the histogram (chi-square, in 0.05 sigma
+// bins out to 6 sigma, with the tails pooled) of each against the unit
+// normal. Fails if any statistic is off by more than five sigma.
+//
+static int test_gaussian()
+{
+	const int N = 10*1000*1000;
+	const double ZMAX = 5., XMAX = 6., DX = 0.05;
+	const char *method[] = { "polar", "ziggurat" };
+
+	uint32_t stream;
+	cpu_prng_impl rng = create_test_rng(stream);
+
+	int ret = 0;
+	std::vector<float> z(N);
+	FORj(m, 0, 2)
+	{
+		stopwatch sw;
+		sw.start();
+		if(m == 0)	{ FOR(0, N) { z[i] = rng.gaussian_polar(1.f); } }
+		else		{ FOR(0, N) { z[i] = rng.gaussian_ziggurat(); } }
+		sw.stop();
+
+		// moments (mean, variance, skewness, excess kurtosis)
+		double mom[5] = { 0 };
+		FOR(0, N) { double p = 1.; FORj(k, 0, 5) { mom[k] += p; p *= z[i]; } }
+		FORj(k, 1, 5) { mom[k] /= N; }
+		double zmom[4] = {
+			mom[1] / sqrt(1./N),
+			(mom[2] - 1.) / sqrt(2./N),
+			mom[3] / sqrt(6./N),
+			(mom[4] - 3.) / sqrt(24./N)
+		};
+
+		// chi-square against the normal CDF, pooling adjacent bins until
+		// the expected count is >= 5
+		const int nbins = (int)(2*XMAX/DX + 0.5) + 2;
+		std::vector<int> hist(nbins);
+		FOR(0, N) { hist[std::min(std::max((int)floor((z[i] + XMAX) / DX) + 1, 0), nbins-1)]++; }
+
+		double chi2 = 0., e = 0., cdf0 = 0.;
+		int o = 0, dof = -1;
+		FOR(0, nbins)
+		{
+			double x1 = -XMAX + i*DX;
+			double cdf1 = i == nbins-1 ? 1. : 0.5*erfc(-x1/M_SQRT2);
+			e += N*(cdf1 - cdf0);
+			o += hist[i];
+			cdf0 = cdf1;
+			if(e >= 5. || i == nbins-1)
+			{
+				chi2 += sqr(o - e) / e;
+				dof++;
+				e = 0.; o = 0;
+			}
+		}
+		double zchi2 = (chi2 - dof) / sqrt(2.*dof);
+
+		bool ok = zchi2 < ZMAX;
+		FORj(k, 0, 4) { ok = ok && fabs(zmom[k]) < ZMAX; }
+		MLOG(verb1) << "gaussian: " << method[m] << ": " << sw.getTime() / N * 1e9 << " ns/draw, "
+			<< "moment z-scores = " << zmom[0] << " " << zmom[1] << " " << zmom[2] << " " << zmom[3]
+			<< ", chi2/dof=" << chi2 << "/" << dof << " (z=" << zchi2 << ")" << (ok ? "" : "  FAILED");
+		if(!ok) { ret = -1; }
+	}
+
+	rng.store(stream);
+	rng.free();
+
+	MLOG(verb1) << "gaussian: " << (ret == 0 ? "OK" : "FAILED");
+	return ret;
+}
+
+int run_test(const std::string &name)
+{
+	if(name == "texsample") { return test_texsample(); }
+	if(name == "sortstars") { return test_sortstars(); }
+	if(name == "serialize") { return test_serialize(); }
+	if(name == "textin") { return test_textin(); }
+	if(name == "binio") { return test_binio(); }
+	if(name == "photometry") { return test_photometry(); }
+	if(name == "poisson") { return test_poisson(); }
+	if(name == "gaussian") { return test_gaussian(); }
+	if(name == "mwc") { return test_mwc(); }
+
+	THROW(EAny, "Unknown test '" + name + "'.");
+}
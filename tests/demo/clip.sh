@@ -0,0 +1,39 @@
+#!/bin/bash
+#
+# Verify that clipping to the footprint with the pixel index (the
+# default) gives the same catalog as testing every star against the
+# polygon of its pixel (clipIndex = 0). Checked for the demo footprint,
+# and for an annulus whose hole makes pixels near the center partially
+# covered.
+#
+# Usage: ./clip.sh [path/to/galfast]
+#
+
+GALFAST=${1:-galfast}
+
+echo -n "Testing, please wait... ";
+
+(grep -v '^footprint_beam' foot.conf; echo "footprint_beam = 0 90 5 1.3") > foot.annulus.conf
+(cat skygen.conf; echo "clipIndex = 0") > skygen.noindex.conf
+
+ERR=0
+for FOOT in foot foot.annulus; do
+	sed -e "s/^footprints = .*/footprints = $FOOT.conf/" cmd.conf > cmd.index.conf
+	sed -e "s/^footprints = .*/footprints = $FOOT.conf/" -e 's/^input = skygen.conf/input = skygen.noindex.conf/' cmd.conf > cmd.noindex.conf
+
+	$GALFAST catalog cmd.index.conf   --output=sky.index.txt   > output.$FOOT.index.log 2>&1
+	$GALFAST catalog cmd.noindex.conf --output=sky.noindex.txt > output.$FOOT.noindex.log 2>&1
+
+	if [ ! -s sky.index.txt ] || ! cmp sky.index.txt sky.noindex.txt; then
+		echo "Error, catalogs clipped to $FOOT.conf with and without the pixel index differ (see output.$FOOT.*.log).";
+		ERR=1
+		break
+	fi
+done
+
+if [ $ERR -eq 0 ]; then
+	echo "OK.";
+	rm -f output.foot*.log sky.index.txt sky.noindex.txt cmd.index.conf cmd.noindex.conf skygen.noindex.conf foot.annulus.conf
+else
+	exit -1
+fi
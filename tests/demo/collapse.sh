@@ -0,0 +1,33 @@
+#!/bin/bash
+#
+# Verify that the expected starcounts of separable models, integrated one
+# distance bin at a time (collapseCounts, the default), agree with those
+# computed by the full sweep through (pixel, m, M) space.
+#
+# Usage: ./collapse.sh [path/to/galfast]
+#
+
+GALFAST=${1:-galfast}
+
+echo -n "Testing, please wait... ";
+
+sed 's/^input = skygen.conf/input = skygen.full.conf/' cmd.conf > cmd.full.conf
+(cat skygen.conf; echo "collapseCounts = 0") > skygen.full.conf
+
+$GALFAST catalog cmd.conf      --output=sky.collapsed.txt > output.collapsed.log 2>&1
+$GALFAST catalog cmd.full.conf --output=sky.full.txt      > output.full.log 2>&1
+
+# expected starcounts of each component, and in total. Allow for roundoff,
+# and (on the GPU) for the limited precision of texture interpolation of
+# the LFs, which the collapsed integration samples on the host.
+counts() { grep -E "counts :|Stars expected:" $1 | sed 's/.*: //' | grep -oE "[0-9][0-9.e+-]*"; }
+counts output.collapsed.log > counts.collapsed.txt
+counts output.full.log      > counts.full.txt
+
+if [ -s counts.collapsed.txt ] && paste counts.collapsed.txt counts.full.txt | awk '{ d = $1 - $2; if(d < 0) d = -d; if($2 == "" || d > 1e-4*$2) exit 1 }'; then
+	echo "OK.";
+	rm -f output.collapsed.log output.full.log counts.collapsed.txt counts.full.txt sky.collapsed.txt sky.full.txt cmd.full.conf skygen.full.conf
+else
+	echo "Error, starcounts integrated by distance bins and by the full sweep differ (see output.collapsed.log and output.full.log).";
+	exit -1
+fi
@@ -0,0 +1,42 @@
+#!/bin/bash
+#
+# Verify that gzip and bzip2 compressed catalogs (written by galfast as a
+# sequence of independently compressed blocks) decompress to the plain
+# text catalog, both with the standard tools and when read back by
+# galfast's own input module.
+#
+# Usage: ./compress.sh [path/to/galfast]
+#
+
+GALFAST=${1:-galfast}
+
+echo -n "Testing, please wait... ";
+
+$GALFAST catalog cmd.conf --output=sky.plain.txt    > output.log 2>&1
+$GALFAST catalog cmd.conf --output=sky.plain.txt.gz  >> output.log 2>&1
+COMPRESS_THREADS=3 $GALFAST catalog cmd.conf --output=sky.plain.txt.bz2 >> output.log 2>&1
+
+# a pipeline that reads a catalog and writes it back out
+echo "module = textin" > textin.conf
+cat > cmd.textin.conf <<EOT
+module = config
+definitions = definitions.conf
+input = textin.conf
+EOT
+
+for EXT in "" .gz .bz2; do
+	$GALFAST catalog cmd.textin.conf --input=sky.plain.txt$EXT --output=sky.readback$EXT.txt >> output.log 2>&1
+done
+
+if [ -s sky.plain.txt ] && \
+   gzip -dc sky.plain.txt.gz | cmp - sky.plain.txt && \
+   bzip2 -dc sky.plain.txt.bz2 | cmp - sky.plain.txt && \
+   [ -s sky.readback.txt ] && \
+   cmp sky.readback.txt sky.readback.gz.txt && \
+   cmp sky.readback.txt sky.readback.bz2.txt; then
+	echo "OK.";
+	rm -f output.log sky.plain.txt sky.plain.txt.gz sky.plain.txt.bz2 sky.readback.txt sky.readback.gz.txt sky.readback.bz2.txt textin.conf cmd.textin.conf
+else
+	echo "Error, compressed catalogs don't round-trip (see output.log).";
+	exit -1
+fi
@@ -0,0 +1,34 @@
+#!/bin/bash
+#
+# Verify that catalogs generated using cached starcounts are identical
+# to those generated by computing them from scratch, and that the cache
+# is reused by runs with a different number of threads.
+#
+# Usage: ./countsCache.sh [path/to/galfast]
+#
+
+GALFAST=${1:-galfast}
+
+echo -n "Testing, please wait... ";
+
+rm -rf counts.cache
+sed 's/^input = skygen.conf/input = skygen.cache.conf/' cmd.conf > cmd.cache.conf
+(cat skygen.conf; echo "countsCache = counts.cache") > skygen.cache.conf
+
+$GALFAST catalog cmd.conf       --output=sky.nocache.txt  > output.log 2>&1
+$GALFAST catalog cmd.cache.conf --output=sky.cold.txt    >> output.log 2>&1	# fills the cache
+$GALFAST catalog cmd.cache.conf --output=sky.warm.txt    >> output.log 2>&1	# reads from the cache
+CPU_THREADS=1 $GALFAST catalog cmd.cache.conf --output=sky.warm1.txt > output.warm1.log 2>&1	# so does a single-threaded run
+
+if ! grep -q "(from cache)" output.log || ! grep -q "(from cache)" output.warm1.log; then
+	echo "Error, the cached starcounts were not used (see output.log).";
+	exit -1
+fi
+
+if cmp sky.nocache.txt sky.cold.txt && cmp sky.nocache.txt sky.warm.txt; then
+	echo "OK.";
+	rm -rf output.log output.warm1.log sky.nocache.txt sky.cold.txt sky.warm.txt sky.warm1.txt cmd.cache.conf skygen.cache.conf counts.cache
+else
+	echo "Error, catalogs generated with and without cached starcounts differ (see output.log).";
+	exit -1
+fi
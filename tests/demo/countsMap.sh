@@ -0,0 +1,43 @@
+#!/bin/bash
+#
+# Verify the cumulative (coadd) counts written by the countsMap module.
+#
+# Bins the demo catalog with countsMap.conf (switched to the SDSSugrizy
+# magnitudes the demo generates), and a coadd that depends on SDSSr
+# alone. The coadd column of each pixel must then equal the running sum
+# (over magnitude bins) of the N(SDSSugrizy[2]) column.
+#
+# Usage: ./countsMap.sh [path/to/galfast]
+#
+
+GALFAST=${1:-galfast}
+
+echo -n "Testing, please wait... ";
+
+sed 's/^#output = fitsout.conf/output = countsMap.coadd.conf/' cmd.conf > cmd.coadd.conf
+(grep -Ev '^(filename|z) ' countsMap.conf; cat <<EOT
+filename = counts.coadd.txt
+z = SDSSugrizy
+coadd.r = -100 -100 0 -100 -100
+EOT
+) > countsMap.coadd.conf
+
+$GALFAST catalog cmd.coadd.conf > output.log 2>&1
+
+# columns: map, lon, lat, mag, N(SDSSugrizy[0..4]), coadd.r, dA
+if [ -s counts.coadd.txt ] && awk '
+	/^#/ { next }
+	{
+		pix = $1 " " $2 " " $3
+		if(pix != last) { sum = 0; last = pix }
+		sum += $7
+		if($10 != sum) { bad++ }
+		n++
+	}
+	END { exit !(n > 0 && bad == 0) }' counts.coadd.txt; then
+	echo "OK.";
+	rm -f output.log cmd.coadd.conf countsMap.coadd.conf counts.coadd.txt
+else
+	echo "Error, cumulative coadd counts are incorrect (see output.log and counts.coadd.txt).";
+	exit -1
+fi
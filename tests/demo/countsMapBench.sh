@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# Benchmark os_countsMap binning into a fine, 0.1 degree resolution,
+# all-sky map (3600 x 1800 pixels).
+#
+# Usage: ./countsMapBench.sh [path/to/galfast]
+#
+
+GALFAST=${1:-galfast}
+
+echo -n "Benchmarking, please wait... ";
+
+sed 's/^#output = fitsout.conf/output = countsMap.bench.conf/' cmd.conf > cmd.bench.conf
+(grep -Ev '^(filename|z|x0|x1|dx|y0|y1|dy) ' countsMap.conf; cat <<EOT
+filename = counts.bench.txt
+z = SDSSugrizy
+x0 = 0.05
+x1 = 359.95
+dx = 0.1
+y0 = -89.95
+y1 = 89.95
+dy = 0.1
+EOT
+) > countsMap.bench.conf
+
+START=$(date +%s.%N)
+$GALFAST catalog cmd.bench.conf > output.log 2>&1
+RET=$?
+END=$(date +%s.%N)
+
+if [ $RET -ne 0 ]; then
+	echo "Error, galfast failed (see output.log).";
+	exit -1
+fi
+
+echo "done in $(echo "$END - $START" | bc) seconds ($(grep -vc '^#' counts.bench.txt) bins written)."
+rm -f output.log cmd.bench.conf countsMap.bench.conf counts.bench.txt
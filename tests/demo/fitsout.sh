@@ -0,0 +1,80 @@
+#!/bin/bash
+#
+# Round-trip the demo catalog through FITS: write it with the text and
+# the fitsout module (in small batches, so that the fitsout writer thread
+# has several batches in flight), and verify that the FITS table holds
+# the same rows, columns and header as the text catalog. Then check that
+# a failure to write the FITS file fails the run.
+#
+# Needs python with astropy to read the FITS file.
+#
+# Usage: ./fitsout.sh [path/to/galfast]
+#
+
+GALFAST=${1:-galfast}
+
+if ! python -c "import astropy.io.fits" > /dev/null 2>&1; then
+	echo "Skipped (reading FITS files needs python with astropy).";
+	exit 0
+fi
+
+echo -n "Testing, please wait... ";
+
+sed 's/^#output = fitsout.conf/output = fitsout.conf/' cmd.conf > cmd.fits.conf
+
+export KBATCH=20000
+$GALFAST catalog cmd.conf --output=sky.roundtrip.txt > output.log 2>&1
+$GALFAST catalog cmd.fits.conf --output=sky.roundtrip.fits >> output.log 2>&1
+
+# a run whose FITS output can't be written completely must fail
+(trap '' XFSZ; ulimit -f 16; $GALFAST catalog cmd.fits.conf --output=sky.roundtrip.full.fits >> output.log 2>&1)
+FAILED=$?
+
+python - sky.roundtrip.txt sky.roundtrip.fits >> output.log 2>&1 <<'EOT'
+import sys
+from astropy.io import fits
+
+# text catalog: '# <header>' line, then one row of whitespace-separated fields
+txt = open(sys.argv[1])
+header = txt.readline()[2:].rstrip('\n')
+rows = [ line.split() for line in txt if not line.startswith('#') ]
+
+hdus = fits.open(sys.argv[2])
+cat = hdus['CATALOG'].data
+fheader = hdus['METADATA'].data['HEADER'][0]
+
+assert fheader.strip() == header.strip(), "FITS and text headers differ"
+assert len(cat) == len(rows), "row counts differ: %d (FITS) vs %d (text)" % (len(cat), len(rows))
+
+def fields(row):
+	for v in row:
+		if hasattr(v, '__len__') and not isinstance(v, str):
+			for x in v: yield x
+		else:
+			yield v
+
+for i, (frow, trow) in enumerate(zip(cat, rows)):
+	f = list(fields(frow))
+	assert len(f) == len(trow), "row %d: %d fields (FITS) vs %d (text)" % (i, len(f), len(trow))
+	for a, b in zip(f, trow):
+		if isinstance(a, str):
+			assert a.strip() == b, "row %d: '%s' != '%s'" % (i, a, b)
+			continue
+		# the text value was rounded to the digits it was printed with
+		if 'e' in b.lower():
+			tol = 1e-5 * abs(float(b))
+		else:
+			digits = len(b.split('.')[1]) if '.' in b else 0
+			tol = 0.51 * 10**-digits + 1e-6 * abs(float(b))
+		assert abs(float(a) - float(b)) <= tol, "row %d: %s != %s" % (i, a, b)
+
+print("%d rows, %d columns compared." % (len(rows), len(cat.columns)))
+EOT
+
+if [ $? -eq 0 ] && [ -s sky.roundtrip.txt ] && [ $FAILED -ne 0 ]; then
+	echo "OK.";
+	rm -f output.log cmd.fits.conf sky.roundtrip.txt sky.roundtrip.fits sky.roundtrip.full.fits
+else
+	echo "Error, the FITS catalog doesn't match the text catalog, or a failed FITS write didn't fail the run (see output.log).";
+	exit -1
+fi
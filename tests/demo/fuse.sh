@@ -0,0 +1,61 @@
+#!/bin/bash
+#
+# Compare generating the demo models in a single fused pass (fuse = 1)
+# with generating them one at a time (the default), and report the time
+# each takes.
+#
+# The two draw their random numbers in a different order, so the
+# catalogs differ star by star. Instead, the test verifies that the
+# expected number of stars is the same (to roundoff), and that the
+# number of stars drawn for each component agrees within Poisson noise.
+#
+# Usage: ./fuse.sh [path/to/galfast]
+#
+
+GALFAST=${1:-galfast}
+
+echo -n "Testing, please wait... ";
+
+sed 's/^input = skygen.conf/input = skygen.fused.conf/' cmd.conf > cmd.fused.conf
+(cat skygen.conf; echo "fuse = 1") > skygen.fused.conf
+
+T0=$(date +%s.%N)
+$GALFAST catalog cmd.conf       --output=sky.unfused.txt > output.unfused.log 2>&1
+T1=$(date +%s.%N)
+$GALFAST catalog cmd.fused.conf --output=sky.fused.txt   > output.fused.log 2>&1
+T2=$(date +%s.%N)
+
+# expected number of stars (the fused model reports a single component)
+expected() { grep "Stars expected:" $1 | sed 's/.*: //' | grep -oE "^[0-9][0-9.e+-]*"; }
+
+# number of stars of each component in the catalog
+compcounts() {
+	awk 'NR == 1 {
+		c = 1;
+		for(i = 2; i <= NF; i++)
+		{
+			n = $i; sub(/\{.*/, "", n);
+			w = 1; if(match(n, /\[[0-9]+\]/)) { w = substr(n, RSTART+1, RLENGTH-2); n = substr(n, 1, RSTART-1); }
+			if(n == "comp") { col = c; }
+			c += w;
+		}
+		next;
+	}
+	/^#/ { next }
+	{ N[$col]++ }
+	END { for(k in N) print k, N[k] }' $1 | sort
+}
+
+E1=$(expected output.unfused.log)
+E2=$(expected output.fused.log)
+compcounts sky.unfused.txt > comps.unfused.txt
+compcounts sky.fused.txt   > comps.fused.txt
+
+if [ -n "$E1" ] && echo "$E1 $E2" | awk '{ d = $1 - $2; if(d < 0) d = -d; if($2 == "" || d > 1e-6*$1) exit 1 }' && \
+   [ -s comps.unfused.txt ] && join -a1 -a2 -e0 -o 0,1.2,2.2 comps.unfused.txt comps.fused.txt | awk '{ d = $2 - $3; if(d < 0) d = -d; if(d > 5*sqrt($2 + $3) + 5) exit 1 }'; then
+	echo "OK (unfused: $(echo "$T1 - $T0" | bc) s, fused: $(echo "$T2 - $T1" | bc) s).";
+	rm -f output.unfused.log output.fused.log sky.unfused.txt sky.fused.txt comps.unfused.txt comps.fused.txt cmd.fused.conf skygen.fused.conf
+else
+	echo "Error, fused and unfused runs differ (see output.unfused.log, output.fused.log, comps.unfused.txt and comps.fused.txt).";
+	exit -1
+fi
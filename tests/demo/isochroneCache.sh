@@ -0,0 +1,32 @@
+#!/bin/bash
+#
+# Verify that catalogs generated using cached resampled isochrones are
+# identical to those generated by resampling them from scratch.
+#
+# Usage: ./isochroneCache.sh [path/to/galfast]
+#
+
+GALFAST=${1:-galfast}
+
+echo -n "Testing, please wait... ";
+
+rm -rf isochrones.cache
+sed 's/photometry\.conf/photometry.cache.conf/' cmd.conf > cmd.cache.conf
+(cat photometry.conf; echo "isochroneCache = isochrones.cache") > photometry.cache.conf
+
+$GALFAST catalog cmd.conf       --output=sky.nocache.txt  > output.log 2>&1
+$GALFAST catalog cmd.cache.conf --output=sky.cold.txt    >> output.log 2>&1	# fills the cache
+$GALFAST catalog cmd.cache.conf --output=sky.warm.txt    >> output.log 2>&1	# reads from the cache
+
+if ! grep -q "isochrones loaded from cache" output.log; then
+	echo "Error, the cached isochrones were not used (see output.log).";
+	exit -1
+fi
+
+if cmp sky.nocache.txt sky.cold.txt && cmp sky.nocache.txt sky.warm.txt; then
+	echo "OK.";
+	rm -rf output.log sky.nocache.txt sky.cold.txt sky.warm.txt cmd.cache.conf photometry.cache.conf isochrones.cache
+else
+	echo "Error, catalogs generated with and without cached isochrones differ (see output.log).";
+	exit -1
+fi
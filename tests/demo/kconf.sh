@@ -0,0 +1,25 @@
+#!/bin/bash
+#
+# Verify that a galfast built with the counter-based random number
+# generator (cmake -DCOUNTER_RNG=ON) produces identical catalogs for
+# different skygen kernel configurations.
+#
+# Usage: ./kconf.sh [path/to/galfast]
+#
+
+GALFAST=${1:-galfast}
+
+echo -n "Testing, please wait... ";
+
+export CUDA_DEVICE=-1
+
+SKYGEN_KCONF="120 1 1 64 1 1"   $GALFAST catalog cmd.conf --output=sky.kconf1.txt   > output.log 2>&1
+SKYGEN_KCONF="7 1 1 32 1 1"     $GALFAST catalog cmd.conf --output=sky.kconf2.txt  >> output.log 2>&1
+
+if cmp sky.kconf1.txt sky.kconf2.txt; then
+	echo "OK.";
+	rm -f output.log sky.kconf1.txt sky.kconf2.txt
+else
+	echo "Error, catalogs generated with different kernel configurations differ (see output.log).";
+	exit -1
+fi
@@ -0,0 +1,28 @@
+#!/bin/bash
+#
+# Benchmark overlapping sky generation with the rest of the pipeline
+# (pipelineDepth = 2) against alternating the two (pipelineDepth = 1),
+# in CPU mode. Prints the throughput skygen reports for each.
+#
+# Usage: ./pipelineBench.sh [path/to/galfast]
+#
+
+GALFAST=${1:-galfast}
+
+echo -n "Benchmarking, please wait... ";
+
+export CUDA_DEVICE=-1
+
+sed 's/^input = skygen.conf/input = skygen.bench.conf/' cmd.conf > cmd.bench.conf
+
+for DEPTH in 1 2; do
+	(cat skygen.conf; echo "pipelineDepth = $DEPTH") > skygen.bench.conf
+	if ! $GALFAST catalog cmd.bench.conf --output=sky.bench.txt > output.depth$DEPTH.log 2>&1; then
+		echo "Error, galfast failed (see output.depth$DEPTH.log).";
+		exit -1
+	fi
+	RATE[$DEPTH]=$(grep "Throughput :" output.depth$DEPTH.log | sed 's/.*: //' | grep -oE "^[0-9][0-9.e+-]*")
+done
+
+echo "pipelineDepth = 1: ${RATE[1]} stars/s, pipelineDepth = 2: ${RATE[2]} stars/s."
+rm -f output.depth1.log output.depth2.log cmd.bench.conf skygen.bench.conf sky.bench.txt
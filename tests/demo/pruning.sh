@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# Verify that skipping the cells beyond the flux and distance limits
+# (pruneCells) doesn't change the expected starcounts. The pruned run uses
+# a small kernel configuration, so that the threads' blocks of cells
+# straddle beams with different (pruned) cell ranges.
+#
+# Usage: ./pruning.sh [path/to/galfast]
+#
+
+GALFAST=${1:-galfast}
+
+echo -n "Testing, please wait... ";
+
+export CUDA_DEVICE=-1
+
+sed 's/^input = skygen.conf/input = skygen.prune.conf/'   cmd.conf > cmd.prune.conf
+sed 's/^input = skygen.conf/input = skygen.noprune.conf/' cmd.conf > cmd.noprune.conf
+(cat skygen.conf; echo "pruneCells = 1") > skygen.prune.conf
+(cat skygen.conf; echo "pruneCells = 0") > skygen.noprune.conf
+
+SKYGEN_KCONF="7 1 1 32 1 1" $GALFAST catalog cmd.prune.conf --output=sky.prune.txt > output.prune.log 2>&1
+$GALFAST catalog cmd.noprune.conf --output=sky.noprune.txt > output.noprune.log 2>&1
+
+# expected starcounts of each component, and in total. These are summed
+# in a different order with and without pruning, so allow for roundoff.
+counts() { grep -E "counts :|Stars expected:" $1 | sed 's/.*: //' | grep -oE "[0-9][0-9.e+-]*"; }
+counts output.prune.log   > counts.prune.txt
+counts output.noprune.log > counts.noprune.txt
+
+if [ -s counts.prune.txt ] && paste counts.prune.txt counts.noprune.txt | awk '{ d = $1 - $2; if(d < 0) d = -d; if($2 == "" || d > 1e-6*$2) exit 1 }'; then
+	echo "OK.";
+	rm -f output.prune.log output.noprune.log counts.prune.txt counts.noprune.txt sky.prune.txt sky.noprune.txt cmd.prune.conf cmd.noprune.conf skygen.prune.conf skygen.noprune.conf
+else
+	echo "Error, starcounts computed with and without pruning differ (see output.prune.log and output.noprune.log).";
+	exit -1
+fi
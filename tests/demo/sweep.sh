@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# Verify that the skygen kernel visits every (pixel, M, m) cell exactly
+# once, independently of the kernel configuration. The magnitude ranges
+# are chosen to give a prime number of m bins (797) and an odd number of
+# M bins, so that the number of cells per beam is not a multiple of the
+# kernel's block size.
+#
+# Usage: ./sweep.sh [path/to/galfast]
+#
+
+GALFAST=${1:-galfast}
+
+echo -n "Testing, please wait... ";
+
+export CUDA_DEVICE=-1
+
+sed 's/^input = skygen.conf/input = skygen.sweep.conf/' cmd.conf > cmd.sweep.conf
+(cat skygen.conf; echo "m1 = 22.97"; echo "M1 = 27.97") > skygen.sweep.conf
+
+SKYGEN_KCONF="120 1 1 64 1 1" $GALFAST catalog cmd.sweep.conf --output=sky.sweep1.txt > output.sweep1.log 2>&1
+SKYGEN_KCONF="7 1 1 32 1 1"   $GALFAST catalog cmd.sweep.conf --output=sky.sweep2.txt > output.sweep2.log 2>&1
+
+# expected starcounts of each component, and in total. These are summed
+# in a different order by different kernel configurations, so allow for
+# roundoff.
+counts() { grep -E "counts :|Stars expected:" $1 | sed 's/.*: //' | grep -oE "[0-9][0-9.e+-]*"; }
+counts output.sweep1.log > counts.sweep1.txt
+counts output.sweep2.log > counts.sweep2.txt
+
+if [ -s counts.sweep1.txt ] && paste counts.sweep1.txt counts.sweep2.txt | awk '{ d = $1 - $2; if(d < 0) d = -d; if($2 == "" || d > 1e-6*$2) exit 1 }'; then
+	echo "OK.";
+	rm -f output.sweep1.log output.sweep2.log counts.sweep1.txt counts.sweep2.txt sky.sweep1.txt sky.sweep2.txt cmd.sweep.conf skygen.sweep.conf
+else
+	echo "Error, starcounts computed with different kernel configurations differ (see output.sweep1.log and output.sweep2.log).";
+	exit -1
+fi
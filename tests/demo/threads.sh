@@ -0,0 +1,25 @@
+#!/bin/bash
+#
+# Verify that CPU kernels produce identical catalogs regardless of the
+# number of threads they're executed on.
+#
+# Usage: ./threads.sh [path/to/galfast] [nthreads]
+#
+
+GALFAST=${1:-galfast}
+NTHREADS=${2:-4}
+
+echo -n "Testing, please wait... ";
+
+export CUDA_DEVICE=-1
+
+CPU_THREADS=1           $GALFAST catalog cmd.conf --output=sky.serial.txt   > output.log 2>&1
+CPU_THREADS=$NTHREADS   $GALFAST catalog cmd.conf --output=sky.parallel.txt >> output.log 2>&1
+
+if cmp sky.serial.txt sky.parallel.txt; then
+	echo "OK.";
+	rm -f output.log sky.serial.txt sky.parallel.txt
+else
+	echo "Error, serial and $NTHREADS-thread catalogs differ (see output.log).";
+	exit -1
+fi
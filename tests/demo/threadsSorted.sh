@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# Verify that skygen draws the same stars regardless of the number of
+# CPU threads its kernels run on. The threads reserve output slots
+# concurrently, so the order of the stars within a batch (and the batch
+# a star lands in) may differ; the catalogs are compared after sorting.
+#
+# The postprocessing modules are left out, as they draw their random
+# numbers in row order.
+#
+# Usage: ./threadsSorted.sh [path/to/galfast] [nthreads]
+#
+
+GALFAST=${1:-galfast}
+NTHREADS=${2:-4}
+
+echo -n "Testing, please wait... ";
+
+export CUDA_DEVICE=-1
+
+sed 's/^modules = .*/modules =/' cmd.conf > cmd.sorted.conf
+
+CPU_THREADS=1           $GALFAST catalog cmd.sorted.conf --output=sky.serial.txt   > output.log 2>&1
+CPU_THREADS=2           $GALFAST catalog cmd.sorted.conf --output=sky.two.txt     >> output.log 2>&1
+CPU_THREADS=$NTHREADS   $GALFAST catalog cmd.sorted.conf --output=sky.parallel.txt >> output.log 2>&1
+
+for f in serial two parallel; do
+	grep -v '^#' sky.$f.txt | LC_ALL=C sort > sky.$f.sorted.txt
+done
+
+if [ -s sky.serial.sorted.txt ] && cmp sky.serial.sorted.txt sky.two.sorted.txt && cmp sky.serial.sorted.txt sky.parallel.sorted.txt; then
+	echo "OK.";
+	rm -f output.log cmd.sorted.conf sky.{serial,two,parallel}.txt sky.{serial,two,parallel}.sorted.txt
+else
+	echo "Error, catalogs generated on 1, 2 and $NTHREADS threads contain different stars (see output.log).";
+	exit -1
+fi